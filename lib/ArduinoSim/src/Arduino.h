@@ -0,0 +1,81 @@
+#ifndef ARDUINO_SIM_ARDUINO_H
+#define ARDUINO_SIM_ARDUINO_H
+
+// Host replacement for the Arduino core header. Only the part of the API the
+// firmware uses is provided; time is virtual and hardware is simulated in
+// ArduinoSim.h.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+#ifndef ARDUINO_SIM
+#define ARDUINO_SIM
+#endif
+
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+
+// ========== CORE TYPES AND CONSTANTS ==========
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define DEC 10
+#define HEX 16
+#define BIN 2
+
+#define SDA 20
+#define SCL 21
+
+// ========== PROGRAM MEMORY ==========
+// Flash and RAM share one address space on the host
+#define PROGMEM
+#define PSTR(s) (s)
+#define PGM_P const char*
+#define pgm_read_byte(address) (*(const uint8_t*)(address))
+#define pgm_read_word(address) (*(const uint16_t*)(address))
+#define pgm_read_dword(address) (*(const uint32_t*)(address))
+#define pgm_read_ptr(address) (*(const void* const*)(address))
+#define memcpy_P memcpy
+#define strlen_P strlen
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper*>(PSTR(string_literal)))
+
+// ========== CORE FUNCTIONS ==========
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+void analogWrite(uint8_t pin, int value);
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+void noInterrupts();
+void interrupts();
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+void setup();
+void loop();
+
+#include "WString.h"
+#include "Print.h"
+#include "HardwareSerial.h"
+
+#endif // ARDUINO_SIM_ARDUINO_H
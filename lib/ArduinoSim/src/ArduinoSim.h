@@ -0,0 +1,109 @@
+#ifndef ARDUINO_SIM_H
+#define ARDUINO_SIM_H
+
+// Control surface of the simulated board used by the native build. The
+// firmware itself only sees Arduino.h; the step timer and LCD bus hook in
+// here through the hardware abstraction in src/hal.h.
+
+#include "Arduino.h"
+
+// ========== VIRTUAL CLOCK ==========
+// Time only moves when the simulator advances it: once per loop() pass and
+// inside delay(). An attached timer sees every advance, so interrupts fire
+// at the right virtual time even during a delay().
+typedef void (*SimTimerCallback)(unsigned long elapsedMicros);
+
+unsigned long simMicros();
+void simAdvanceMicros(unsigned long us);
+void simAttachTimer(SimTimerCallback callback);
+
+// Runs handler as an interrupt that fired at atMicros, earlier in the
+// advance being replayed: micros() and millis() read atMicros until it
+// returns, so timestamps taken in a handler are those of its match
+void simRunInterruptAt(unsigned long atMicros, void (*handler)());
+
+// Idle sleep: skips the clock ahead by up to maxMicros, but never past the
+// wake limit the scenario runner sets (the end of the current @wait), and
+// returns how far it went. simSleptMicros() totals every sleep.
+unsigned long simSleep(unsigned long maxMicros);
+void simSetWakeLimit(unsigned long atMicros);
+unsigned long simSleptMicros();
+
+// Wall-clock nanoseconds of the host, for measuring how long firmware code
+// takes to run; wraps every 4.3 s
+uint32_t simHostNanos();
+
+// ========== SIMULATED GPIO ==========
+#define SIM_PIN_COUNT 70
+
+uint8_t simPinMode(uint8_t pin);
+uint8_t simPinValue(uint8_t pin);
+unsigned long simPinEdges(uint8_t pin);
+
+// Duty (0-255) of the last analogWrite(), or -1 when the pin was last
+// driven by digitalWrite()
+int simPinDuty(uint8_t pin);
+
+// Writes every output change to path as "<micros> <pin> <value>", value 0/1
+// or p<duty> after analogWrite(); shift register outputs appear as pin
+// q<register>.<bit> when latched. Timestamps come from micros(), so changes
+// made by a replayed interrupt carry the time it fired.
+bool simCaptureEdges(const char* path);
+
+// ========== SIMULATED EEPROM ==========
+// 4 KiB like the ATmega2560, erased to 0xFF. Writes complete at once; every
+// byte counts its writes for wear reports. With --eeprom <file> the contents
+// are loaded before setup() and saved on exit, so two runs act like a reset.
+#define SIM_EEPROM_SIZE 4096
+
+uint8_t simEepromRead(uint16_t address);
+void simEepromWrite(uint16_t address, uint8_t value);
+unsigned long simEepromWrites(uint16_t address);
+bool simEepromLoad(const char* path);
+bool simEepromSave(const char* path);
+
+// ========== SIMULATED TWI BUS ==========
+// A PCF8574 backpack driving an HD44780 is the only device on the bus; it
+// answers at any address
+void simTwiTransmit(uint8_t address, uint8_t value);
+
+// ========== SIMULATED LCD ==========
+#define SIM_LCD_COLUMNS 20
+#define SIM_LCD_ROWS 4
+
+void simLcdReadRow(uint8_t row, char* text);
+bool simLcdBacklight();
+
+// ========== SIMULATED SHIFT REGISTERS ==========
+// A chain of 74HC595s on the SPI pins with RCLK on latchPin. Bytes shift in
+// MSB first, so bit 0 lands on QA; each byte pushes the earlier ones one
+// register further from the board. A rising edge on latchPin copies the
+// chain to the outputs. spiHz only feeds the wire time of a burst, which
+// is reported as the SPI would take it on the board.
+#define SIM_SHIFT_REGISTERS_MAX 32
+
+void simShiftRegisterAttach(uint8_t latchPin, uint8_t count, unsigned long spiHz);
+void simSpiTransfer(uint8_t value);
+uint8_t simShiftRegisterCount();
+uint8_t simShiftRegisterOutput(uint8_t index);
+unsigned long simShiftRegisterLatches();
+unsigned int simShiftRegisterBurstBytes();
+float simShiftRegisterBurstMicros();
+
+// ========== SIMULATED UART ==========
+size_t simSerialInput(const char* text);
+size_t simSerialInputBytes(const uint8_t* data, size_t length);
+
+// In hex mode transmitted bytes print as "[sim] tx: 03 01 ..." with one line
+// per 0x00-terminated frame, for watching binary protocols
+void simSerialHexOutput(bool on);
+
+// Collects transmitted text in buffer instead of printing it, without the
+// CRs and always terminated; what does not fit is dropped. A NULL buffer
+// goes back to standard output.
+void simSerialCapture(char* buffer, size_t size);
+
+// ========== SCENARIO RUNNER ==========
+void simRunFor(unsigned long ms);
+
+#endif // ARDUINO_SIM_H
@@ -0,0 +1,99 @@
+#include "Arduino.h"
+#include <stdio.h>
+
+// ========== SIMULATED UART IMPLEMENTATION ==========
+
+HardwareSerial Serial;
+
+static bool simSerialHex = false;
+static bool simSerialHexLineOpen = false;
+static char* simSerialCaptureBuffer = NULL;
+static size_t simSerialCaptureSize = 0;
+static size_t simSerialCaptureLength = 0;
+
+void simSerialCapture(char* buffer, size_t size) {
+  simSerialCaptureBuffer = size > 0 ? buffer : NULL;
+  simSerialCaptureSize = size;
+  simSerialCaptureLength = 0;
+  if (simSerialCaptureBuffer != NULL) {
+    buffer[0] = '\0';
+  }
+}
+
+void simSerialHexOutput(bool on) {
+  if (simSerialHexLineOpen) {
+    putchar('\n');
+    simSerialHexLineOpen = false;
+  }
+  simSerialHex = on;
+}
+
+HardwareSerial::HardwareSerial() : rxHead(0), rxTail(0), baud(0) {
+}
+
+void HardwareSerial::begin(unsigned long baud) {
+  this->baud = baud;
+}
+
+void HardwareSerial::end() {
+  baud = 0;
+}
+
+int HardwareSerial::available() {
+  return (rxHead - rxTail) % SIM_SERIAL_RX_BUFFER_SIZE;
+}
+
+int HardwareSerial::read() {
+  if (rxHead == rxTail) return -1;
+  uint8_t value = rxBuffer[rxTail];
+  rxTail = (rxTail + 1) % SIM_SERIAL_RX_BUFFER_SIZE;
+  return value;
+}
+
+int HardwareSerial::peek() {
+  if (rxHead == rxTail) return -1;
+  return rxBuffer[rxTail];
+}
+
+// The simulated UART never backs up
+int HardwareSerial::availableForWrite() {
+  return SIM_SERIAL_RX_BUFFER_SIZE - 1;
+}
+
+void HardwareSerial::flush() {
+  fflush(stdout);
+}
+
+size_t HardwareSerial::write(uint8_t value) {
+  if (simSerialCaptureBuffer != NULL) {
+    if (value != '\r' && simSerialCaptureLength + 1 < simSerialCaptureSize) {
+      simSerialCaptureBuffer[simSerialCaptureLength++] = value;
+      simSerialCaptureBuffer[simSerialCaptureLength] = '\0';
+    }
+    return 1;
+  }
+  
+  if (simSerialHex) {
+    printf(simSerialHexLineOpen ? " %02X" : "[sim] tx: %02X", value);
+    simSerialHexLineOpen = value != 0;
+    if (value == 0) {
+      putchar('\n');
+    }
+    return 1;
+  }
+  
+  // Drop the CR of CRLF line endings so host output reads naturally
+  if (value != '\r') {
+    putchar(value);
+  }
+  return 1;
+}
+
+// Returns false, like a real UART overrun, when the firmware is not reading
+bool HardwareSerial::receive(uint8_t value) {
+  unsigned int next = (rxHead + 1) % SIM_SERIAL_RX_BUFFER_SIZE;
+  if (next == rxTail) return false;
+  rxBuffer[rxHead] = value;
+  rxHead = next;
+  return true;
+}
@@ -0,0 +1,46 @@
+#ifndef ARDUINO_SIM_HARDWARE_SERIAL_H
+#define ARDUINO_SIM_HARDWARE_SERIAL_H
+
+#include "Print.h"
+
+// ========== SIMULATED UART ==========
+// Received bytes are injected with simSerialInput(); transmitted bytes go to
+// the host's standard output.
+#define SIM_SERIAL_RX_BUFFER_SIZE 256
+
+class Stream : public Print {
+ public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+};
+
+class HardwareSerial : public Stream {
+ public:
+  HardwareSerial();
+  
+  void begin(unsigned long baud);
+  void end();
+  virtual int available();
+  virtual int read();
+  virtual int peek();
+  int availableForWrite();
+  void flush();
+  virtual size_t write(uint8_t value);
+  using Print::write;
+  operator bool() { return true; }
+  
+  // Host side of the wire
+  bool receive(uint8_t value);
+  unsigned long baudRate() const { return baud; }
+ 
+ private:
+  uint8_t rxBuffer[SIM_SERIAL_RX_BUFFER_SIZE];
+  unsigned int rxHead;
+  unsigned int rxTail;
+  unsigned long baud;
+};
+
+extern HardwareSerial Serial;
+
+#endif // ARDUINO_SIM_HARDWARE_SERIAL_H
@@ -0,0 +1,99 @@
+#include "Arduino.h"
+
+// ========== PRINT IMPLEMENTATION ==========
+
+size_t Print::write(const uint8_t* buffer, size_t size) {
+  size_t written = 0;
+  while (size-- > 0) {
+    written += write(*buffer++);
+  }
+  return written;
+}
+
+size_t Print::write(const char* text) {
+  return write((const uint8_t*)text, strlen(text));
+}
+
+size_t Print::print(const __FlashStringHelper* text) {
+  return write((const char*)text);
+}
+
+size_t Print::print(const String& text) {
+  return write((const uint8_t*)text.c_str(), text.length());
+}
+
+size_t Print::print(const char* text) {
+  return write(text);
+}
+
+size_t Print::print(char c) {
+  return write((uint8_t)c);
+}
+
+size_t Print::print(unsigned char value, int base) {
+  return print(String((unsigned int)value, base));
+}
+
+size_t Print::print(int value, int base) {
+  return print(String(value, base));
+}
+
+size_t Print::print(unsigned int value, int base) {
+  return print(String(value, base));
+}
+
+size_t Print::print(long value, int base) {
+  return print(String(value, base));
+}
+
+size_t Print::print(unsigned long value, int base) {
+  return print(String(value, base));
+}
+
+size_t Print::print(double value, int decimalPlaces) {
+  return print(String(value, decimalPlaces));
+}
+
+size_t Print::println() {
+  return write("\r\n");
+}
+
+size_t Print::println(const __FlashStringHelper* text) {
+  return print(text) + println();
+}
+
+size_t Print::println(const String& text) {
+  return print(text) + println();
+}
+
+size_t Print::println(const char* text) {
+  return print(text) + println();
+}
+
+size_t Print::println(char c) {
+  return print(c) + println();
+}
+
+size_t Print::println(unsigned char value, int base) {
+  return print(value, base) + println();
+}
+
+size_t Print::println(int value, int base) {
+  return print(value, base) + println();
+}
+
+size_t Print::println(unsigned int value, int base) {
+  return print(value, base) + println();
+}
+
+size_t Print::println(long value, int base) {
+  return print(value, base) + println();
+}
+
+size_t Print::println(unsigned long value, int base) {
+  return print(value, base) + println();
+}
+
+size_t Print::println(double value, int decimalPlaces) {
+  return print(value, decimalPlaces) + println();
+}
@@ -0,0 +1,44 @@
+#ifndef ARDUINO_SIM_PRINT_H
+#define ARDUINO_SIM_PRINT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "WString.h"
+
+class __FlashStringHelper;
+
+// ========== PRINT CLASS ==========
+// Text formatting on top of a byte sink, as in the Arduino core
+class Print {
+ public:
+  virtual ~Print() {}
+  
+  virtual size_t write(uint8_t value) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size);
+  size_t write(const char* text);
+  
+  size_t print(const __FlashStringHelper* text);
+  size_t print(const String& text);
+  size_t print(const char* text);
+  size_t print(char c);
+  size_t print(unsigned char value, int base = 10);
+  size_t print(int value, int base = 10);
+  size_t print(unsigned int value, int base = 10);
+  size_t print(long value, int base = 10);
+  size_t print(unsigned long value, int base = 10);
+  size_t print(double value, int decimalPlaces = 2);
+  
+  size_t println();
+  size_t println(const __FlashStringHelper* text);
+  size_t println(const String& text);
+  size_t println(const char* text);
+  size_t println(char c);
+  size_t println(unsigned char value, int base = 10);
+  size_t println(int value, int base = 10);
+  size_t println(unsigned int value, int base = 10);
+  size_t println(long value, int base = 10);
+  size_t println(unsigned long value, int base = 10);
+  size_t println(double value, int decimalPlaces = 2);
+};
+
+#endif // ARDUINO_SIM_PRINT_H
@@ -0,0 +1,167 @@
+#include "Arduino.h"
+#include <stdio.h>
+
+// ========== STRING IMPLEMENTATION ==========
+
+String::String(const char* text) : buffer(NULL), len(0) {
+  if (text == NULL) {
+    text = "";
+  }
+  assign(text, strlen(text));
+}
+
+String::String(const String& other) : buffer(NULL), len(0) {
+  assign(other.buffer, other.len);
+}
+
+String::String(char c) : buffer(NULL), len(0) {
+  assign(&c, 1);
+}
+
+String::String(int value, unsigned char base) : buffer(NULL), len(0) {
+  formatUnsigned(value < 0 && base == 10 ? -(unsigned long)value : (unsigned int)value, base, value < 0 && base == 10);
+}
+
+String::String(unsigned int value, unsigned char base) : buffer(NULL), len(0) {
+  formatUnsigned(value, base, false);
+}
+
+String::String(long value, unsigned char base) : buffer(NULL), len(0) {
+  formatUnsigned(value < 0 && base == 10 ? -(unsigned long)value : (unsigned long)value, base, value < 0 && base == 10);
+}
+
+String::String(unsigned long value, unsigned char base) : buffer(NULL), len(0) {
+  formatUnsigned(value, base, false);
+}
+
+String::String(double value, unsigned char decimalPlaces) : buffer(NULL), len(0) {
+  char text[64];
+  int length = snprintf(text, sizeof(text), "%.*f", decimalPlaces, value);
+  assign(text, length);
+}
+
+String::~String() {
+  free(buffer);
+}
+
+String& String::operator=(const String& other) {
+  if (this != &other) {
+    assign(other.buffer, other.len);
+  }
+  return *this;
+}
+
+String& String::operator+=(const String& other) {
+  append(other.buffer, other.len);
+  return *this;
+}
+
+char String::operator[](unsigned int index) const {
+  return index < len ? buffer[index] : '\0';
+}
+
+bool String::equals(const String& other) const {
+  return len == other.len && memcmp(buffer, other.buffer, len) == 0;
+}
+
+bool String::startsWith(const String& prefix) const {
+  return prefix.len <= len && memcmp(buffer, prefix.buffer, prefix.len) == 0;
+}
+
+int String::indexOf(char c, unsigned int from) const {
+  for (unsigned int i = from; i < len; i++) {
+    if (buffer[i] == c) return i;
+  }
+  return -1;
+}
+
+String String::substring(unsigned int from) const {
+  return substring(from, len);
+}
+
+String String::substring(unsigned int from, unsigned int to) const {
+  String result;
+  if (to > len) {
+    to = len;
+  }
+  if (from < to) {
+    result.assign(buffer + from, to - from);
+  }
+  return result;
+}
+
+long String::toInt() const {
+  return atol(buffer);
+}
+
+void String::toLowerCase() {
+  for (unsigned int i = 0; i < len; i++) {
+    buffer[i] = tolower(buffer[i]);
+  }
+}
+
+void String::trim() {
+  unsigned int begin = 0;
+  unsigned int end = len;
+  while (begin < end && isspace((unsigned char)buffer[begin])) {
+    begin++;
+  }
+  while (end > begin && isspace((unsigned char)buffer[end - 1])) {
+    end--;
+  }
+  memmove(buffer, buffer + begin, end - begin);
+  len = end - begin;
+  buffer[len] = '\0';
+}
+
+String operator+(const String& lhs, const String& rhs) {
+  String result(lhs);
+  result.append(rhs.buffer, rhs.len);
+  return result;
+}
+
+String operator+(const char* lhs, const String& rhs) {
+  String result(lhs);
+  result.append(rhs.buffer, rhs.len);
+  return result;
+}
+
+String operator+(const String& lhs, const char* rhs) {
+  String result(lhs);
+  result.append(rhs, strlen(rhs));
+  return result;
+}
+
+void String::assign(const char* text, unsigned int length) {
+  char* copy = (char*)malloc(length + 1);
+  memcpy(copy, text, length);
+  copy[length] = '\0';
+  free(buffer);
+  buffer = copy;
+  len = length;
+}
+
+void String::append(const char* text, unsigned int length) {
+  buffer = (char*)realloc(buffer, len + length + 1);
+  memcpy(buffer + len, text, length);
+  len += length;
+  buffer[len] = '\0';
+}
+
+void String::formatUnsigned(unsigned long value, unsigned char base, bool negative) {
+  char text[34];
+  char* cursor = &text[sizeof(text) - 1];
+  *cursor = '\0';
+  if (base < 2) {
+    base = 10;
+  }
+  do {
+    unsigned char digit = value % base;
+    *--cursor = digit < 10 ? '0' + digit : 'A' + digit - 10;
+    value /= base;
+  } while (value > 0);
+  if (negative) {
+    *--cursor = '-';
+  }
+  assign(cursor, strlen(cursor));
+}
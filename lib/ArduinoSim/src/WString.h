@@ -0,0 +1,52 @@
+#ifndef ARDUINO_SIM_WSTRING_H
+#define ARDUINO_SIM_WSTRING_H
+
+#include <stddef.h>
+
+// ========== STRING CLASS ==========
+// Heap-backed String with the subset of the Arduino interface the firmware
+// uses. Numbers format the way the AVR core does (base 10, two decimals).
+class String {
+ public:
+  String(const char* text = "");
+  String(const String& other);
+  explicit String(char c);
+  explicit String(int value, unsigned char base = 10);
+  explicit String(unsigned int value, unsigned char base = 10);
+  explicit String(long value, unsigned char base = 10);
+  explicit String(unsigned long value, unsigned char base = 10);
+  explicit String(double value, unsigned char decimalPlaces = 2);
+  ~String();
+  
+  String& operator=(const String& other);
+  String& operator+=(const String& other);
+  
+  unsigned int length() const { return len; }
+  const char* c_str() const { return buffer; }
+  char operator[](unsigned int index) const;
+  
+  bool equals(const String& other) const;
+  bool operator==(const String& other) const { return equals(other); }
+  bool operator!=(const String& other) const { return !equals(other); }
+  bool startsWith(const String& prefix) const;
+  int indexOf(char c, unsigned int from = 0) const;
+  String substring(unsigned int from) const;
+  String substring(unsigned int from, unsigned int to) const;
+  long toInt() const;
+  void toLowerCase();
+  void trim();
+  
+  friend String operator+(const String& lhs, const String& rhs);
+  friend String operator+(const char* lhs, const String& rhs);
+  friend String operator+(const String& lhs, const char* rhs);
+ 
+ private:
+  void assign(const char* text, unsigned int length);
+  void append(const char* text, unsigned int length);
+  void formatUnsigned(unsigned long value, unsigned char base, bool negative);
+  
+  char* buffer;
+  unsigned int len;
+};
+
+#endif // ARDUINO_SIM_WSTRING_H
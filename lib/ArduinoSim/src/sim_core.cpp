@@ -0,0 +1,305 @@
+#include "ArduinoSim.h"
+#include <stdio.h>
+#include <time.h>
+
+// ========== VIRTUAL CLOCK STATE ==========
+static unsigned long simNowMicros = 0;
+static SimTimerCallback simTimer = NULL;
+static unsigned long simWakeLimit = 0;
+static unsigned long simSleepTotal = 0;
+static bool simInInterrupt = false;
+static unsigned long simInterruptMicros = 0;
+
+// ========== SIMULATED GPIO STATE ==========
+// A pin written with analogWrite() keeps its duty until the next
+// digitalWrite(); edges then counts duty changes
+struct SimPin {
+  uint8_t mode;
+  uint8_t value;
+  unsigned long edges;
+  bool pwm;
+  uint8_t duty;
+};
+
+static SimPin simPins[SIM_PIN_COUNT];
+static FILE* simEdgeFile = NULL;
+
+// ========== SIMULATED SHIFT REGISTER STATE ==========
+// burstBytes counts bytes shifted since the last latch; lastBurstBytes is
+// that count at the latch
+struct SimShiftChain {
+  uint8_t latchPin;
+  uint8_t count;
+  unsigned long spiHz;
+  uint8_t shift[SIM_SHIFT_REGISTERS_MAX];
+  uint8_t output[SIM_SHIFT_REGISTERS_MAX];
+  unsigned long latches;
+  unsigned int burstBytes;
+  unsigned int lastBurstBytes;
+};
+
+static SimShiftChain simShift;
+
+static void simShiftRegisterLatch();
+
+// ========== SIMULATED EEPROM STATE ==========
+static uint8_t simEeprom[SIM_EEPROM_SIZE];
+static unsigned long simEepromWear[SIM_EEPROM_SIZE];
+static bool simEepromErased = false;
+
+static void simEepromErase() {
+  if (!simEepromErased) {
+    memset(simEeprom, 0xFF, sizeof(simEeprom));
+    simEepromErased = true;
+  }
+}
+
+// ========== VIRTUAL CLOCK ==========
+
+unsigned long simMicros() {
+  return simNowMicros;
+}
+
+void simAdvanceMicros(unsigned long us) {
+  simNowMicros += us;
+  if (simTimer != NULL) {
+    simTimer(us);
+  }
+}
+
+void simAttachTimer(SimTimerCallback callback) {
+  simTimer = callback;
+}
+
+void simRunInterruptAt(unsigned long atMicros, void (*handler)()) {
+  simInInterrupt = true;
+  simInterruptMicros = atMicros;
+  handler();
+  simInInterrupt = false;
+}
+
+unsigned long simSleep(unsigned long maxMicros) {
+  long available = (long)(simWakeLimit - simNowMicros);
+  if (available <= 0) return 0;
+  
+  unsigned long us = (unsigned long)available < maxMicros ? available : maxMicros;
+  simSleepTotal += us;
+  simAdvanceMicros(us);
+  return us;
+}
+
+void simSetWakeLimit(unsigned long atMicros) {
+  simWakeLimit = atMicros;
+}
+
+unsigned long simSleptMicros() {
+  return simSleepTotal;
+}
+
+uint32_t simHostNanos() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint32_t)now.tv_sec * 1000000000UL + now.tv_nsec;
+}
+
+unsigned long millis() {
+  return micros() / 1000;
+}
+
+unsigned long micros() {
+  return simInInterrupt ? simInterruptMicros : simNowMicros;
+}
+
+void delay(unsigned long ms) {
+  simAdvanceMicros(ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+  simAdvanceMicros(us);
+}
+
+void yield() {
+}
+
+// There is a single thread of execution; timer callbacks only run from
+// simAdvanceMicros(), never in the middle of firmware code
+void noInterrupts() {
+}
+
+void interrupts() {
+}
+
+// ========== SIMULATED GPIO ==========
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  if (pin >= SIM_PIN_COUNT) return;
+  simPins[pin].mode = mode;
+  if (mode == INPUT_PULLUP) {
+    simPins[pin].value = HIGH;
+  }
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  if (pin >= SIM_PIN_COUNT) return;
+  value = value ? HIGH : LOW;
+  if (simPins[pin].value != value || simPins[pin].pwm) {
+    simPins[pin].value = value;
+    simPins[pin].edges++;
+    if (simEdgeFile != NULL) {
+      fprintf(simEdgeFile, "%lu %u %u\n", micros(), pin, value);
+    }
+    if (simShift.count > 0 && pin == simShift.latchPin && value == HIGH) {
+      simShiftRegisterLatch();
+    }
+  }
+  simPins[pin].pwm = false;
+}
+
+void analogWrite(uint8_t pin, int value) {
+  if (pin >= SIM_PIN_COUNT) return;
+  uint8_t duty = constrain(value, 0, 255);
+  if (!simPins[pin].pwm || simPins[pin].duty != duty) {
+    simPins[pin].duty = duty;
+    simPins[pin].edges++;
+    if (simEdgeFile != NULL) {
+      fprintf(simEdgeFile, "%lu %u p%u\n", micros(), pin, duty);
+    }
+  }
+  simPins[pin].pwm = true;
+  simPins[pin].value = duty > 0 ? HIGH : LOW;
+}
+
+int digitalRead(uint8_t pin) {
+  if (pin >= SIM_PIN_COUNT) return LOW;
+  return simPins[pin].value;
+}
+
+uint8_t simPinMode(uint8_t pin) {
+  return pin < SIM_PIN_COUNT ? simPins[pin].mode : INPUT;
+}
+
+uint8_t simPinValue(uint8_t pin) {
+  return pin < SIM_PIN_COUNT ? simPins[pin].value : LOW;
+}
+
+unsigned long simPinEdges(uint8_t pin) {
+  return pin < SIM_PIN_COUNT ? simPins[pin].edges : 0;
+}
+
+int simPinDuty(uint8_t pin) {
+  return pin < SIM_PIN_COUNT && simPins[pin].pwm ? simPins[pin].duty : -1;
+}
+
+bool simCaptureEdges(const char* path) {
+  simEdgeFile = fopen(path, "w");
+  return simEdgeFile != NULL;
+}
+
+// ========== SIMULATED SHIFT REGISTERS ==========
+
+void simShiftRegisterAttach(uint8_t latchPin, uint8_t count, unsigned long spiHz) {
+  memset(&simShift, 0, sizeof(simShift));
+  simShift.latchPin = latchPin;
+  simShift.count = count < SIM_SHIFT_REGISTERS_MAX ? count : SIM_SHIFT_REGISTERS_MAX;
+  simShift.spiHz = spiHz;
+}
+
+void simSpiTransfer(uint8_t value) {
+  if (simShift.count == 0) return;
+  memmove(simShift.shift + 1, simShift.shift, simShift.count - 1);
+  simShift.shift[0] = value;
+  simShift.burstBytes++;
+}
+
+static void simShiftRegisterLatch() {
+  if (simEdgeFile != NULL) {
+    for (uint8_t i = 0; i < simShift.count; i++) {
+      uint8_t changed = simShift.output[i] ^ simShift.shift[i];
+      for (uint8_t bit = 0; bit < 8; bit++) {
+        if (changed & (1 << bit)) {
+          fprintf(simEdgeFile, "%lu q%u.%u %u\n", micros(), i, bit, (simShift.shift[i] >> bit) & 1);
+        }
+      }
+    }
+  }
+  memcpy(simShift.output, simShift.shift, simShift.count);
+  simShift.latches++;
+  simShift.lastBurstBytes = simShift.burstBytes;
+  simShift.burstBytes = 0;
+}
+
+uint8_t simShiftRegisterCount() {
+  return simShift.count;
+}
+
+uint8_t simShiftRegisterOutput(uint8_t index) {
+  return index < simShift.count ? simShift.output[index] : 0;
+}
+
+unsigned long simShiftRegisterLatches() {
+  return simShift.latches;
+}
+
+unsigned int simShiftRegisterBurstBytes() {
+  return simShift.lastBurstBytes;
+}
+
+float simShiftRegisterBurstMicros() {
+  return simShift.spiHz > 0 ? simShift.lastBurstBytes * 8 * 1e6f / simShift.spiHz : 0;
+}
+
+// ========== SIMULATED EEPROM ==========
+
+uint8_t simEepromRead(uint16_t address) {
+  simEepromErase();
+  return address < SIM_EEPROM_SIZE ? simEeprom[address] : 0xFF;
+}
+
+void simEepromWrite(uint16_t address, uint8_t value) {
+  simEepromErase();
+  if (address < SIM_EEPROM_SIZE) {
+    simEeprom[address] = value;
+    simEepromWear[address]++;
+  }
+}
+
+unsigned long simEepromWrites(uint16_t address) {
+  return address < SIM_EEPROM_SIZE ? simEepromWear[address] : 0;
+}
+
+// A missing file leaves the EEPROM erased, as on a new board
+bool simEepromLoad(const char* path) {
+  simEepromErase();
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) return false;
+  size_t length = fread(simEeprom, 1, sizeof(simEeprom), file);
+  fclose(file);
+  return length == sizeof(simEeprom);
+}
+
+bool simEepromSave(const char* path) {
+  FILE* file = fopen(path, "wb");
+  if (file == NULL) return false;
+  size_t length = fwrite(simEeprom, 1, sizeof(simEeprom), file);
+  fclose(file);
+  return length == sizeof(simEeprom);
+}
+
+// ========== SIMULATED UART ==========
+
+// Returns how many bytes fit in the receive buffer
+size_t simSerialInput(const char* text) {
+  size_t accepted = 0;
+  while (text[accepted] != '\0' && Serial.receive(text[accepted])) {
+    accepted++;
+  }
+  return accepted;
+}
+
+size_t simSerialInputBytes(const uint8_t* data, size_t length) {
+  size_t accepted = 0;
+  while (accepted < length && Serial.receive(data[accepted])) {
+    accepted++;
+  }
+  return accepted;
+}
@@ -0,0 +1,136 @@
+#include "ArduinoSim.h"
+
+// ========== PCF8574 BACKPACK WIRING ==========
+#define SIM_LCD_PIN_RS 0x01
+#define SIM_LCD_PIN_EN 0x04
+#define SIM_LCD_PIN_BACKLIGHT 0x08
+
+#define SIM_LCD_DDRAM_SIZE 0x80
+
+// ========== HD44780 MODEL STATE ==========
+struct SimLcd {
+  uint8_t expander;
+  bool fourBitMode;
+  bool highNibblePending;
+  uint8_t highNibble;
+  bool addressCgram;
+  uint8_t address;
+  char ddram[SIM_LCD_DDRAM_SIZE];
+};
+
+static SimLcd simLcd = {0, false, false, 0, false, 0, {0}};
+static bool simLcdPoweredUp = false;
+
+static const uint8_t SIM_LCD_ROW_OFFSETS[4] = {0x00, 0x40, 0x14, 0x54};
+
+// ========== HD44780 MODEL ==========
+
+static void simLcdClear() {
+  memset(simLcd.ddram, ' ', sizeof(simLcd.ddram));
+  simLcd.address = 0;
+  simLcd.addressCgram = false;
+}
+
+// Two-line mode: each line holds 40 characters and the address runs from
+// the end of one line into the start of the other
+static void simLcdIncrementAddress() {
+  if (simLcd.addressCgram) {
+    simLcd.address = (simLcd.address + 1) & 0x3F;
+  } else if (simLcd.address == 0x27) {
+    simLcd.address = 0x40;
+  } else if (simLcd.address == 0x67) {
+    simLcd.address = 0x00;
+  } else {
+    simLcd.address++;
+  }
+}
+
+static void simLcdInstruction(uint8_t value) {
+  if (value & 0x80) {
+    simLcd.addressCgram = false;
+    simLcd.address = value & 0x7F;
+  } else if (value & 0x40) {
+    simLcd.addressCgram = true;
+    simLcd.address = value & 0x3F;
+  } else if (value & 0x20) {
+    simLcd.fourBitMode = (value & 0x10) == 0;
+  } else if (value == 0x01) {
+    simLcdClear();
+  } else if ((value & 0xFE) == 0x02) {
+    simLcd.addressCgram = false;
+    simLcd.address = 0;
+  }
+  // Entry mode, display control and shift are left at their reset defaults
+}
+
+static void simLcdData(uint8_t value) {
+  if (!simLcd.addressCgram) {
+    simLcd.ddram[simLcd.address] = value;
+  }
+  simLcdIncrementAddress();
+}
+
+// The controller samples the data lines on the falling edge of EN
+static void simLcdLatch(uint8_t expander) {
+  uint8_t nibble = expander >> 4;
+  bool data = (expander & SIM_LCD_PIN_RS) != 0;
+  
+  if (!simLcd.fourBitMode) {
+    // 8-bit interface with only D4-D7 wired: each strobe is a full
+    // instruction whose low nibble reads as zero
+    if (!data) {
+      simLcdInstruction(nibble << 4);
+    }
+    simLcd.highNibblePending = false;
+    return;
+  }
+  
+  if (!simLcd.highNibblePending) {
+    simLcd.highNibble = nibble;
+    simLcd.highNibblePending = true;
+    return;
+  }
+  
+  simLcd.highNibblePending = false;
+  uint8_t value = (simLcd.highNibble << 4) | nibble;
+  if (data) {
+    simLcdData(value);
+  } else {
+    simLcdInstruction(value);
+  }
+}
+
+// ========== SIMULATED TWI BUS ==========
+
+void simTwiTransmit(uint8_t address, uint8_t value) {
+  if (!simLcdPoweredUp) {
+    simLcdClear();
+    simLcdPoweredUp = true;
+  }
+  
+  if ((simLcd.expander & SIM_LCD_PIN_EN) && !(value & SIM_LCD_PIN_EN)) {
+    simLcdLatch(simLcd.expander);
+  }
+  simLcd.expander = value;
+}
+
+// ========== SIMULATED LCD ==========
+
+// Fills text with SIM_LCD_COLUMNS characters plus a terminator. Custom
+// characters (codes 0-7) show as '*'.
+void simLcdReadRow(uint8_t row, char* text) {
+  if (!simLcdPoweredUp) {
+    simLcdClear();
+    simLcdPoweredUp = true;
+  }
+  
+  for (uint8_t col = 0; col < SIM_LCD_COLUMNS; col++) {
+    char c = row < SIM_LCD_ROWS ? simLcd.ddram[SIM_LCD_ROW_OFFSETS[row] + col] : ' ';
+    text[col] = (uint8_t)c < 8 ? '*' : c;
+  }
+  text[SIM_LCD_COLUMNS] = '\0';
+}
+
+bool simLcdBacklight() {
+  return (simLcd.expander & SIM_LCD_PIN_BACKLIGHT) != 0;
+}
@@ -0,0 +1,219 @@
+#include "ArduinoSim.h"
+#include <stdio.h>
+
+// ========== SCENARIO RUNNER ==========
+// Runs setup(), then replays a script from a file or standard input. Each
+// line is typed into the UART followed by a newline, except:
+//   # ...        comment
+//   @wait <ms>   keep calling loop() for ms of virtual time
+//   @lcd         print the LCD contents
+//   @pins        print every output pin that has changed
+//   @time        print the virtual time
+//   @sleep       print how much of the virtual time was spent in idle sleep
+//   @eeprom      print EEPROM wear: bytes written and the most-written byte
+//   @shift       print the shift register outputs and the last SPI burst
+//   @rx <hex>    put raw bytes on the UART, e.g. "@rx 03 01 02 00"
+//   @tx hex|text show transmitted bytes as hex frames or as text
+// Every loop() pass costs SIM_LOOP_PASS_US of virtual time (--pass-us).
+// --eeprom <file> keeps the EEPROM in a file across runs.
+// --edges <file> records every output change with its virtual time.
+// Idle sleep may only skip ahead inside an @wait.
+#define SIM_LOOP_PASS_US 100
+#define SIM_SCRIPT_LINE_MAX 256
+
+static unsigned long simLoopPassMicros = SIM_LOOP_PASS_US;
+
+static void simLoopPass() {
+  loop();
+  simAdvanceMicros(simLoopPassMicros);
+}
+
+void simRunFor(unsigned long ms) {
+  unsigned long start = simMicros();
+  simSetWakeLimit(start + ms * 1000UL);
+  while (simMicros() - start < ms * 1000UL) {
+    simLoopPass();
+  }
+  simSetWakeLimit(simMicros());
+}
+
+// Unit tests under test/ bring their own main() and drive setup(), loop()
+// and the simulator directly
+#ifndef PIO_UNIT_TESTING
+
+static void simPrintSleep() {
+  unsigned long total = simMicros();
+  unsigned long asleep = simSleptMicros();
+  printf("[sim] asleep %lu of %lu ms (%.1f%%)\n", asleep / 1000, total / 1000,
+         total > 0 ? 100.0 * asleep / total : 0.0);
+}
+
+static void simPrintEeprom() {
+  unsigned long total = 0;
+  unsigned int used = 0;
+  unsigned long most = 0;
+  unsigned int mostAddress = 0;
+  for (unsigned int address = 0; address < SIM_EEPROM_SIZE; address++) {
+    unsigned long writes = simEepromWrites(address);
+    total += writes;
+    used += writes > 0;
+    if (writes > most) {
+      most = writes;
+      mostAddress = address;
+    }
+  }
+  printf("[sim] eeprom: %lu writes over %u bytes, most %lu at 0x%03X\n", total, used, most, mostAddress);
+}
+
+static void simType(const char* text) {
+  while (*text != '\0') {
+    size_t accepted = simSerialInput(text);
+    text += accepted;
+    simLoopPass();
+  }
+  // Let the firmware pick up the last bytes
+  while (Serial.available() > 0) {
+    simLoopPass();
+  }
+}
+
+static void simPrintLcd() {
+  char row[SIM_LCD_COLUMNS + 1];
+  printf("[sim] +--------------------+\n");
+  for (uint8_t i = 0; i < SIM_LCD_ROWS; i++) {
+    simLcdReadRow(i, row);
+    printf("[sim] |%s|\n", row);
+  }
+  printf("[sim] +--------------------+\n");
+}
+
+static void simPrintPins() {
+  for (uint8_t pin = 0; pin < SIM_PIN_COUNT; pin++) {
+    if (simPinMode(pin) != OUTPUT || simPinEdges(pin) == 0) continue;
+    if (simPinDuty(pin) >= 0) {
+      printf("[sim] pin %u = PWM %d/255 (%lu changes)\n", pin, simPinDuty(pin), simPinEdges(pin));
+    } else {
+      printf("[sim] pin %u = %s (%lu edges)\n", pin, simPinValue(pin) ? "HIGH" : "LOW", simPinEdges(pin));
+    }
+  }
+}
+
+// Outputs as QH..QA, register 0 (next to the board) first
+static void simPrintShiftRegisters() {
+  uint8_t count = simShiftRegisterCount();
+  if (count == 0) {
+    printf("[sim] shift: no registers attached\n");
+    return;
+  }
+  printf("[sim] shift: %u registers, %lu latches, last burst %u bytes (%.1f us on the wire)\n",
+         count, simShiftRegisterLatches(), simShiftRegisterBurstBytes(), simShiftRegisterBurstMicros());
+  for (uint8_t i = 0; i < count; i++) {
+    uint8_t value = simShiftRegisterOutput(i);
+    char bits[9];
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      bits[bit] = (value & (0x80 >> bit)) ? '1' : '0';
+    }
+    bits[8] = '\0';
+    printf("[sim] shift %u = %s (0x%02X)\n", i, bits, value);
+  }
+}
+
+static void simTypeBytes(const char* hex) {
+  uint8_t data[SIM_SCRIPT_LINE_MAX / 2];
+  size_t length = 0;
+  char* end;
+  for (;;) {
+    unsigned long value = strtoul(hex, &end, 16);
+    if (end == hex || length == sizeof(data)) break;
+    data[length++] = value;
+    hex = end;
+  }
+  
+  const uint8_t* cursor = data;
+  while (length > 0) {
+    size_t accepted = simSerialInputBytes(cursor, length);
+    cursor += accepted;
+    length -= accepted;
+    simLoopPass();
+  }
+  while (Serial.available() > 0) {
+    simLoopPass();
+  }
+}
+
+static void simDirective(const char* line) {
+  if (strncmp(line, "@wait", 5) == 0) {
+    simRunFor(strtoul(line + 5, NULL, 10));
+  } else if (strcmp(line, "@lcd") == 0) {
+    simPrintLcd();
+  } else if (strcmp(line, "@pins") == 0) {
+    simPrintPins();
+  } else if (strncmp(line, "@rx", 3) == 0) {
+    simTypeBytes(line + 3);
+  } else if (strcmp(line, "@tx hex") == 0) {
+    simSerialHexOutput(true);
+  } else if (strcmp(line, "@tx text") == 0) {
+    simSerialHexOutput(false);
+  } else if (strcmp(line, "@sleep") == 0) {
+    simPrintSleep();
+  } else if (strcmp(line, "@eeprom") == 0) {
+    simPrintEeprom();
+  } else if (strcmp(line, "@shift") == 0) {
+    simPrintShiftRegisters();
+  } else if (strcmp(line, "@time") == 0) {
+    printf("[sim] t=%lu ms\n", millis());
+  } else {
+    fprintf(stderr, "[sim] unknown directive: %s\n", line);
+  }
+}
+
+int main(int argc, char** argv) {
+  FILE* script = stdin;
+  const char* eepromPath = NULL;
+  
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--pass-us") == 0 && i + 1 < argc) {
+      simLoopPassMicros = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--eeprom") == 0 && i + 1 < argc) {
+      eepromPath = argv[++i];
+      simEepromLoad(eepromPath);
+    } else if (strcmp(argv[i], "--edges") == 0 && i + 1 < argc) {
+      if (!simCaptureEdges(argv[++i])) {
+        perror(argv[i]);
+        return 1;
+      }
+    } else {
+      script = fopen(argv[i], "r");
+      if (script == NULL) {
+        perror(argv[i]);
+        return 1;
+      }
+    }
+  }
+  
+  setup();
+  
+  // Room to append the newline
+  char line[SIM_SCRIPT_LINE_MAX + 2];
+  while (fgets(line, SIM_SCRIPT_LINE_MAX, script) != NULL) {
+    line[strcspn(line, "\r\n")] = '\0';
+    if (line[0] == '#') continue;
+    
+    fflush(stdout);
+    if (line[0] == '@') {
+      simDirective(line);
+    } else {
+      strcat(line, "\n");
+      simType(line);
+    }
+  }
+  
+  fflush(stdout);
+  if (eepromPath != NULL && !simEepromSave(eepromPath)) {
+    perror(eepromPath);
+    return 1;
+  }
+  return 0;
+}
+
+#endif // PIO_UNIT_TESTING
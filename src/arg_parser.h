@@ -0,0 +1,102 @@
+#ifndef ARG_PARSER_H
+#define ARG_PARSER_H
+
+#include <Arduino.h>
+
+// ========== ARGUMENT PARSER FUNCTION DECLARATIONS ==========
+const char* skipSpaces(const char* cursor);
+bool parseLong(const char*& cursor, long& value);
+bool parseChar(const char*& cursor, char expected);
+bool parseEnd(const char* cursor);
+bool parseWord(const char*& cursor, const __FlashStringHelper* word);
+template <typename Rest>
+bool parseWordThen(const char*& cursor, const __FlashStringHelper* word, Rest rest);
+bool parseLongArg(const char* args, long& value);
+
+// ========== ARGUMENT PARSER FUNCTION IMPLEMENTATIONS ==========
+
+const char* skipSpaces(const char* cursor) {
+  while (*cursor == ' ' || *cursor == '\t') {
+    cursor++;
+  }
+  return cursor;
+}
+
+// Parses an optionally signed decimal integer and advances the cursor past it
+bool parseLong(const char*& cursor, long& value) {
+  const char* p = skipSpaces(cursor);
+  bool negative = false;
+  if (*p == '-' || *p == '+') {
+    negative = (*p == '-');
+    p++;
+  }
+  if (*p < '0' || *p > '9') {
+    return false;
+  }
+  
+  unsigned long magnitude = 0;
+  while (*p >= '0' && *p <= '9') {
+    unsigned long next = magnitude * 10 + (*p - '0');
+    if (next > 0x7FFFFFFFUL) {
+      return false;
+    }
+    magnitude = next;
+    p++;
+  }
+  
+  value = negative ? -(long)magnitude : (long)magnitude;
+  cursor = p;
+  return true;
+}
+
+bool parseChar(const char*& cursor, char expected) {
+  const char* p = skipSpaces(cursor);
+  if (*p != expected) {
+    return false;
+  }
+  cursor = p + 1;
+  return true;
+}
+
+bool parseEnd(const char* cursor) {
+  cursor = skipSpaces(cursor);
+  return *cursor == '\0' || *cursor == '\r' || *cursor == '\n';
+}
+
+// Matches word, a lower-case string in flash, case-insensitively and
+// advances the cursor past it. The word must end at a space or the end of
+// the line, so "runx" is not "run" followed by "x".
+bool parseWord(const char*& cursor, const __FlashStringHelper* word) {
+  const char* p = skipSpaces(cursor);
+  const char* letter = (const char*)word;
+  for (char c = pgm_read_byte(letter); c != '\0'; c = pgm_read_byte(++letter)) {
+    if (tolower(*p) != c) {
+      return false;
+    }
+    p++;
+  }
+  if (*p != ' ' && *p != '\t' && !parseEnd(p)) {
+    return false;
+  }
+  cursor = p;
+  return true;
+}
+
+// A subcommand: word, then whatever rest(cursor) parses after it. Both
+// run on a copy of the cursor, which moves on only if the whole of it
+// matches, so a failed branch leaves the next one the same input.
+template <typename Rest>
+bool parseWordThen(const char*& cursor, const __FlashStringHelper* word, Rest rest) {
+  const char* p = cursor;
+  if (!parseWord(p, word) || !rest(p)) {
+    return false;
+  }
+  cursor = p;
+  return true;
+}
+
+bool parseLongArg(const char* args, long& value) {
+  return parseLong(args, value) && parseEnd(args);
+}
+
+#endif // ARG_PARSER_H
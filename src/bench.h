@@ -0,0 +1,232 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "console.h"
+#include "cycle_counter.h"
+#include "motor.h"
+#include "traffic_light.h"
+#include "commands.h"
+#include "lcd.h"
+
+// ========== BENCHMARK RESULT STRUCTURE ==========
+struct BenchResult {
+  uint32_t minimum;
+  uint32_t maximum;
+  uint32_t total;
+  unsigned int iterations;
+};
+
+// ========== BENCHMARK STATE STRUCTURE ==========
+struct BenchState {
+  bool requested;
+  bool running;
+  uint32_t overhead;
+  BenchResult result;
+};
+
+static BenchState benchmark;
+
+// Commands timed through the dispatch table, including a miss and an
+// upper-case name
+static const char* const BENCH_COMMAND_CORPUS[] = {
+  "f100", "r100", "s5", "accel800", "vmax1000", "stop", "demo", "traffic",
+  "red", "yellow", "green", "alloff", "allon", "flash", "emergency",
+  "timing5000,2000,4000", "loop", "help", "FLASH", "unknown"
+};
+
+#define BENCH_COMMAND_CORPUS_SIZE (sizeof(BENCH_COMMAND_CORPUS) / sizeof(BENCH_COMMAND_CORPUS[0]))
+
+// ========== BENCHMARK FUNCTION DECLARATIONS ==========
+void requestBenchmarks();
+bool benchmarkPending();
+bool benchmarkRunning();
+void runBenchmarks();
+void benchBegin();
+void benchSample(uint32_t start);
+void benchReport(const char* name);
+void benchLoopPass();
+void benchExecuteStep();
+void benchCommandLookup();
+void benchLcdRedraw();
+void benchLampLatch();
+
+// ========== BENCHMARK FUNCTION IMPLEMENTATIONS ==========
+
+// The suite calls loop() itself, so it cannot run from inside a command
+// handler; loop() starts it on its next pass
+void requestBenchmarks() {
+  benchmark.requested = true;
+}
+
+bool benchmarkPending() {
+  return benchmark.requested;
+}
+
+// True while the suite is calling loop() itself
+bool benchmarkRunning() {
+  return benchmark.running;
+}
+
+// Prints one CSV row per benchmark:
+//   bench,<name>,<iterations>,<unit>,<min>,<mean>,<max>
+void runBenchmarks() {
+  benchmark.requested = false;
+  if (motorState.isRunning) {
+    console.println(F("Benchmarks need the motor idle"));
+    return;
+  }
+  
+  cycleCounterStart();
+  benchmark.running = true;
+  
+  // Cost of reading the counter itself, subtracted from every sample
+  benchmark.overhead = 0xFFFFFFFFUL;
+  for (uint8_t i = 0; i < 16; i++) {
+    uint32_t start = cycleCounterRead();
+    uint32_t elapsed = cycleCounterRead() - start;
+    if (elapsed < benchmark.overhead) {
+      benchmark.overhead = elapsed;
+    }
+  }
+  
+  console.println(F("bench,name,iterations,unit,min,mean,max"));
+  benchLoopPass();
+  benchExecuteStep();
+  benchCommandLookup();
+  benchLcdRedraw();
+  benchLampLatch();
+  console.println(F("bench,end"));
+  
+  benchmark.running = false;
+  cycleCounterStop();
+}
+
+void benchBegin() {
+  benchmark.result.minimum = 0xFFFFFFFFUL;
+  benchmark.result.maximum = 0;
+  benchmark.result.total = 0;
+  benchmark.result.iterations = 0;
+}
+
+void benchSample(uint32_t start) {
+  uint32_t elapsed = cycleCounterRead() - start;
+  elapsed = elapsed > benchmark.overhead ? elapsed - benchmark.overhead : 0;
+  
+  if (elapsed < benchmark.result.minimum) {
+    benchmark.result.minimum = elapsed;
+  }
+  if (elapsed > benchmark.result.maximum) {
+    benchmark.result.maximum = elapsed;
+  }
+  benchmark.result.total += elapsed;
+  benchmark.result.iterations++;
+}
+
+void benchReport(const char* name) {
+  BenchResult& result = benchmark.result;
+  console.print(F("bench,"));
+  console.print(name);
+  console.print(',');
+  console.print(result.iterations);
+  console.print(',');
+  console.print(CYCLE_COUNTER_UNIT);
+  console.print(',');
+  console.print(result.minimum);
+  console.print(',');
+  console.print(result.iterations > 0 ? result.total / result.iterations : 0);
+  console.print(',');
+  console.println(result.maximum);
+}
+
+// Whole loop() passes with the traffic cycle task in the scheduler. A
+// stopped cycle gets its task queued a phase ahead, long past the run, so
+// the lamps and the console are left alone; if it did fire it would only
+// see the cycle stopped and end.
+void benchLoopPass() {
+  bool queuedTask = !trafficLight.isRunning;
+  if (queuedTask) {
+    scheduleTask(TASK_TRAFFIC_CYCLE, runTrafficLightCycle, trafficLight.program.phases[0].durationMs);
+  }
+  
+  benchBegin();
+  for (unsigned int i = 0; i < BENCH_LOOP_PASSES; i++) {
+    uint32_t start = cycleCounterRead();
+    loop();
+    benchSample(start);
+  }
+  benchReport("loop_pass");
+  
+  if (queuedTask) {
+    cancelTask(TASK_TRAFFIC_CYCLE);
+  }
+}
+
+// Forward and back pairs so the rotor ends where it started
+void benchExecuteStep() {
+  benchBegin();
+  for (unsigned int i = 0; i < BENCH_STEP_ITERATIONS; i++) {
+    uint32_t start = cycleCounterRead();
+    executeStep((i & 1) ? COUNTER_CLOCKWISE : CLOCKWISE);
+    benchSample(start);
+  }
+  releaseCoils();
+  benchReport("execute_step");
+}
+
+// Name lookup and argument split only: the handlers print to a 9600 baud
+// console and would time the UART instead. test/test_bench times the whole
+// of processCommand() on the host.
+void benchCommandLookup() {
+  benchBegin();
+  for (unsigned int round = 0; round < BENCH_COMMAND_ROUNDS; round++) {
+    for (uint8_t i = 0; i < BENCH_COMMAND_CORPUS_SIZE; i++) {
+      const char* args;
+      uint32_t start = cycleCounterRead();
+      findCommand(BENCH_COMMAND_CORPUS[i], args);
+      benchSample(start);
+    }
+  }
+  benchReport("command_lookup");
+}
+
+// Drawing plus the first budgeted flush; the bus transfer itself runs in
+// the TWI interrupt and is waited out between samples
+void benchLcdRedraw() {
+  benchBegin();
+  for (uint8_t i = 0; i < BENCH_LCD_REDRAWS; i++) {
+    memset(lcdFrame.glass, 0, sizeof(lcdFrame.glass));
+    uint32_t start = cycleCounterRead();
+    updateLCDStatus();
+    benchSample(start);
+    
+    while (lcdFrame.pending) {
+      lcd.waitIdle();
+      lcdService();
+    }
+  }
+  benchReport("lcd_redraw_full");
+  
+  benchBegin();
+  for (uint8_t i = 0; i < BENCH_LCD_REDRAWS; i++) {
+    uint32_t start = cycleCounterRead();
+    updateLCDStatus();
+    benchSample(start);
+  }
+  benchReport("lcd_redraw_unchanged");
+}
+
+// Puts every intersection's lamps on the outputs as they already are, so
+// nothing visibly changes
+void benchLampLatch() {
+  benchBegin();
+  for (unsigned int i = 0; i < BENCH_LAMP_LATCHES; i++) {
+    uint32_t start = cycleCounterRead();
+    lampOutputLatch();
+    benchSample(start);
+  }
+  benchReport("lamp_latch");
+}
+
+#endif // BENCH_H
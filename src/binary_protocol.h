@@ -0,0 +1,297 @@
+#ifndef BINARY_PROTOCOL_H
+#define BINARY_PROTOCOL_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "console.h"
+#include "motor.h"
+#include "traffic_light.h"
+#include "commands.h"
+#include "stats.h"
+#include "trace.h"
+
+// ========== FRAME FORMAT ==========
+// Each packet is COBS encoded and terminated by a 0x00 byte:
+//   request: seq, opcode, payload..., crc16 (little endian)
+//   reply:   seq, opcode | 0x80, status, payload..., crc16
+// The CRC is CRC-16/CCITT-FALSE over everything before it. Opcodes below
+// 0x10 belong to the protocol; the rest are COMMAND_TABLE opcodes whose
+// payload is the command's argument text (e.g. "100" for f).
+#define PROTOCOL_OP_PING 0x01
+#define PROTOCOL_OP_STATUS 0x02
+#define PROTOCOL_OP_TEXT_MODE 0x03
+#define PROTOCOL_OP_REPLY 0x80
+
+#define PROTOCOL_STATUS_OK 0x00
+#define PROTOCOL_STATUS_BAD_FRAME 0x01
+#define PROTOCOL_STATUS_BAD_CRC 0x02
+#define PROTOCOL_STATUS_UNKNOWN_OPCODE 0x03
+#define PROTOCOL_STATUS_BAD_ARGUMENT 0x04
+
+#define PROTOCOL_HEADER_SIZE 2
+#define PROTOCOL_CRC_SIZE 2
+#define PROTOCOL_PING_ECHO_MAX 8
+#define PROTOCOL_REPLY_MAX 16
+
+// ========== PROTOCOL STATE STRUCTURE ==========
+struct BinaryProtocolState {
+  bool active;
+  uint8_t frame[PROTOCOL_FRAME_MAX];
+  uint8_t length;
+  bool overflow;
+  bool haveLastSeq;
+  uint8_t lastSeq;
+  uint8_t lastReply[PROTOCOL_REPLY_MAX];
+  uint8_t lastReplyLength;
+  unsigned int framesReceived;
+  unsigned int frameErrors;
+};
+
+static BinaryProtocolState binaryProtocol;
+
+// ========== PROTOCOL FUNCTION DECLARATIONS ==========
+uint16_t crc16Update(uint16_t crc, uint8_t value);
+uint16_t crc16(const uint8_t* data, uint8_t length);
+bool cobsDecode(uint8_t* buffer, uint8_t& length);
+void startBinaryProtocol();
+void stopBinaryProtocol();
+bool binaryProtocolActive();
+void pollBinaryProtocol();
+void handleBinaryFrame();
+uint8_t buildBinaryReply(uint8_t* reply, uint8_t seq, uint8_t opcode, uint8_t status, const uint8_t* payload, uint8_t length);
+void sendBinaryReply(uint8_t seq, uint8_t opcode, uint8_t status, const uint8_t* payload, uint8_t length);
+void sendBinaryError(uint8_t seq, uint8_t opcode, uint8_t status);
+void sendCobsFrame(const uint8_t* packet, uint8_t length);
+
+// ========== CRC AND COBS IMPLEMENTATIONS ==========
+
+uint16_t crc16Update(uint16_t crc, uint8_t value) {
+  crc ^= (uint16_t)value << 8;
+  for (uint8_t bit = 0; bit < 8; bit++) {
+    crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+uint16_t crc16(const uint8_t* data, uint8_t length) {
+  uint16_t crc = 0xFFFF;
+  while (length-- > 0) {
+    crc = crc16Update(crc, *data++);
+  }
+  return crc;
+}
+
+// Decodes in place; a code byte that points past the end is a broken frame
+bool cobsDecode(uint8_t* buffer, uint8_t& length) {
+  uint8_t read = 0;
+  uint8_t write = 0;
+  while (read < length) {
+    uint8_t code = buffer[read++];
+    if (code == 0 || read + code - 1 > length) return false;
+    for (uint8_t i = 1; i < code; i++) {
+      buffer[write++] = buffer[read++];
+    }
+    if (code != 0xFF && read < length) {
+      buffer[write++] = 0;
+    }
+  }
+  length = write;
+  return true;
+}
+
+// Encodes on the fly: each block is a code byte (distance to the next zero)
+// followed by the non-zero bytes before it
+void sendCobsFrame(const uint8_t* packet, uint8_t length) {
+  uint8_t start = 0;
+  for (;;) {
+    uint8_t end = start;
+    while (end < length && packet[end] != 0 && end - start < 254) {
+      end++;
+    }
+    Serial.write((uint8_t)(end - start + 1));
+    Serial.write(packet + start, end - start);
+    if (end == length) break;
+    
+    if (packet[end] == 0) {
+      start = end + 1;
+      if (start == length) {
+        // A trailing zero still needs an empty block after it
+        Serial.write((uint8_t)1);
+        break;
+      }
+    } else {
+      start = end;
+    }
+  }
+  Serial.write((uint8_t)0);
+}
+
+// ========== PROTOCOL FUNCTION IMPLEMENTATIONS ==========
+
+// The core's begin() sets the USART double-speed bit (U2X0) on its own;
+// PROTOCOL_BAUD_RATE is chosen so UBRR divides F_CPU exactly with it
+void startBinaryProtocol() {
+  printLine(console, F("Binary protocol at "), PROTOCOL_BAUD_RATE, F(" baud"));
+  Serial.flush();
+  console.mute(true);
+  Serial.begin(PROTOCOL_BAUD_RATE);
+  
+  binaryProtocol.active = true;
+  binaryProtocol.length = 0;
+  binaryProtocol.overflow = false;
+  binaryProtocol.haveLastSeq = false;
+}
+
+void stopBinaryProtocol() {
+  Serial.flush();
+  Serial.begin(SERIAL_BAUD_RATE);
+  binaryProtocol.active = false;
+  console.mute(false);
+  console.println(F("Text console"));
+}
+
+bool binaryProtocolActive() {
+  return binaryProtocol.active;
+}
+
+void pollBinaryProtocol() {
+  while (Serial.available() > 0) {
+    uint8_t value = Serial.read();
+    if (value != 0) {
+      if (binaryProtocol.length < PROTOCOL_FRAME_MAX) {
+        binaryProtocol.frame[binaryProtocol.length++] = value;
+      } else {
+        binaryProtocol.overflow = true;
+      }
+      continue;
+    }
+    
+    if (binaryProtocol.overflow) {
+      binaryProtocol.frameErrors++;
+    } else if (binaryProtocol.length > 0) {
+      handleBinaryFrame();
+    }
+    binaryProtocol.length = 0;
+    binaryProtocol.overflow = false;
+    
+    // The text-mode request switches the port back; stop reading frames
+    if (!binaryProtocol.active) return;
+  }
+}
+
+void handleBinaryFrame() {
+  uint8_t length = binaryProtocol.length;
+  uint8_t* packet = binaryProtocol.frame;
+  
+  if (!cobsDecode(packet, length) || length < PROTOCOL_HEADER_SIZE + PROTOCOL_CRC_SIZE) {
+    binaryProtocol.frameErrors++;
+    return;
+  }
+  
+  uint8_t seq = packet[0];
+  uint8_t opcode = packet[1];
+  length -= PROTOCOL_CRC_SIZE;
+  uint16_t received = packet[length] | ((uint16_t)packet[length + 1] << 8);
+  if (crc16(packet, length) != received) {
+    binaryProtocol.frameErrors++;
+    sendBinaryError(seq, opcode, PROTOCOL_STATUS_BAD_CRC);
+    return;
+  }
+  binaryProtocol.framesReceived++;
+  
+  // A repeated sequence number is a retry after a lost reply: answer again
+  // without running the command twice
+  if (binaryProtocol.haveLastSeq && seq == binaryProtocol.lastSeq) {
+    sendCobsFrame(binaryProtocol.lastReply, binaryProtocol.lastReplyLength);
+    return;
+  }
+  binaryProtocol.haveLastSeq = true;
+  binaryProtocol.lastSeq = seq;
+  
+  uint8_t* payload = packet + PROTOCOL_HEADER_SIZE;
+  uint8_t payloadLength = length - PROTOCOL_HEADER_SIZE;
+  
+  switch (opcode) {
+    case PROTOCOL_OP_PING:
+      // Echo up to PROTOCOL_PING_ECHO_MAX payload bytes back
+      sendBinaryReply(seq, opcode, PROTOCOL_STATUS_OK, payload,
+                      payloadLength < PROTOCOL_PING_ECHO_MAX ? payloadLength : PROTOCOL_PING_ECHO_MAX);
+      return;
+    
+    case PROTOCOL_OP_STATUS: {
+      noInterrupts();
+      long stepsRemaining = motorState.stepsRemaining;
+      interrupts();
+      long position = getMotorPosition();
+      uint8_t status[11];
+      status[0] = (motorState.isRunning ? 0x01 : 0) | (trafficLight.isRunning ? 0x02 : 0);
+      status[1] = trafficLight.currentState;
+      status[2] = stepsRemaining;
+      status[3] = stepsRemaining >> 8;
+      status[4] = stepsRemaining >> 16;
+      status[5] = stepsRemaining >> 24;
+      status[6] = motionQueueDepth();
+      status[7] = position;
+      status[8] = position >> 8;
+      status[9] = position >> 16;
+      status[10] = position >> 24;
+      sendBinaryReply(seq, opcode, PROTOCOL_STATUS_OK, status, sizeof(status));
+      return;
+    }
+    
+    case PROTOCOL_OP_TEXT_MODE:
+      sendBinaryReply(seq, opcode, PROTOCOL_STATUS_OK, NULL, 0);
+      stopBinaryProtocol();
+      return;
+  }
+  
+  const Command* command = findCommandByOpcode(opcode);
+  if (command == NULL) {
+    sendBinaryReply(seq, opcode, PROTOCOL_STATUS_UNKNOWN_OPCODE, NULL, 0);
+    return;
+  }
+  
+  // The CRC bytes are no longer needed, so the argument text can be
+  // terminated in place
+  for (uint8_t i = 0; i < payloadLength; i++) {
+    if (payload[i] == 0) {
+      sendBinaryReply(seq, opcode, PROTOCOL_STATUS_BAD_ARGUMENT, NULL, 0);
+      return;
+    }
+  }
+  payload[payloadLength] = '\0';
+  traceEvent(TRACE_COMMAND, command - COMMAND_TABLE);
+  unsigned long start = micros();
+  bool accepted = commandFunction(command)((const char*)payload);
+  statsRecordCommand(micros() - start);
+  sendBinaryReply(seq, opcode, accepted ? PROTOCOL_STATUS_OK : PROTOCOL_STATUS_BAD_ARGUMENT, NULL, 0);
+}
+
+uint8_t buildBinaryReply(uint8_t* reply, uint8_t seq, uint8_t opcode, uint8_t status, const uint8_t* payload, uint8_t length) {
+  uint8_t size = 0;
+  reply[size++] = seq;
+  reply[size++] = opcode | PROTOCOL_OP_REPLY;
+  reply[size++] = status;
+  for (uint8_t i = 0; i < length; i++) {
+    reply[size++] = payload[i];
+  }
+  uint16_t crc = crc16(reply, size);
+  reply[size++] = crc;
+  reply[size++] = crc >> 8;
+  return size;
+}
+
+// The answer to the frame's sequence number; kept so a retry gets it again
+void sendBinaryReply(uint8_t seq, uint8_t opcode, uint8_t status, const uint8_t* payload, uint8_t length) {
+  binaryProtocol.lastReplyLength = buildBinaryReply(binaryProtocol.lastReply, seq, opcode, status, payload, length);
+  sendCobsFrame(binaryProtocol.lastReply, binaryProtocol.lastReplyLength);
+}
+
+// For frames that never got a sequence number recorded (bad CRC): the
+// cached reply must stay the one for lastSeq
+void sendBinaryError(uint8_t seq, uint8_t opcode, uint8_t status) {
+  uint8_t reply[PROTOCOL_HEADER_SIZE + 1 + PROTOCOL_CRC_SIZE];
+  sendCobsFrame(reply, buildBinaryReply(reply, seq, opcode, status, NULL, 0));
+}
+
+#endif // BINARY_PROTOCOL_H
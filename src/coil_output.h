@@ -0,0 +1,315 @@
+#ifndef COIL_OUTPUT_H
+#define COIL_OUTPUT_H
+
+#include <Arduino.h>
+#include "hal.h"
+#include "config.h"
+#include "fast_io.h"
+#include "trace.h"
+
+// ========== COIL PIN LAYOUT ==========
+// Each axis's four coil pins (IN1..IN4) may be split over two ports; pins
+// 8-11 of the X axis are PH5, PH6, PB4, PB5. Axes wired to a single port
+// step with one port write.
+constexpr uint8_t coilPin(uint8_t coil, uint8_t in1, uint8_t in2, uint8_t in3, uint8_t in4) {
+  return coil == 0 ? in1 : coil == 1 ? in2 : coil == 2 ? in3 : in4;
+}
+
+constexpr uint8_t findSecondaryCoilPort(uint8_t in1, uint8_t in2, uint8_t in3, uint8_t in4, uint8_t coil = 1) {
+  return coil >= 4 ? pinPort(in1)
+       : pinPort(coilPin(coil, in1, in2, in3, in4)) != pinPort(in1) ? pinPort(coilPin(coil, in1, in2, in3, in4))
+       : findSecondaryCoilPort(in1, in2, in3, in4, coil + 1);
+}
+
+constexpr bool coilPinsFitTwoPorts(uint8_t in1, uint8_t in2, uint8_t in3, uint8_t in4, uint8_t coil = 0) {
+  return coil >= 4 ||
+         ((coilPin(coil, in1, in2, in3, in4) < MEGA_PIN_COUNT) &&
+          (pinPort(coilPin(coil, in1, in2, in3, in4)) == pinPort(in1) ||
+           pinPort(coilPin(coil, in1, in2, in3, in4)) == findSecondaryCoilPort(in1, in2, in3, in4)) &&
+          coilPinsFitTwoPorts(in1, in2, in3, in4, coil + 1));
+}
+
+// Bits on `port` that are driven high by coil `pattern`
+constexpr uint8_t coilPortBits(uint8_t pattern, uint8_t port, uint8_t in1, uint8_t in2, uint8_t in3, uint8_t in4, uint8_t coil = 0) {
+  return coil >= 4 ? 0
+       : (((pattern >> coil) & 1) && pinPort(coilPin(coil, in1, in2, in3, in4)) == port ? pinMask(coilPin(coil, in1, in2, in3, in4)) : 0) |
+         coilPortBits(pattern, port, in1, in2, in3, in4, coil + 1);
+}
+
+struct CoilPortBits {
+  uint8_t primary;
+  uint8_t secondary;
+};
+
+static_assert((MOTOR_STEPS_PER_REVOLUTION & (MOTOR_STEPS_PER_REVOLUTION - 1)) == 0,
+              "MOTOR_STEPS_PER_REVOLUTION must be a power of two");
+
+// ========== DRIVE MODE TABLES ==========
+// The wave and full-step tables are taken from the half-step sequence,
+// whose even entries energise one coil and odd entries two. A table index
+// is a half-step position, so switching modes keeps the rotor where it is.
+constexpr uint8_t driveModePattern(uint8_t mode, uint8_t index) {
+  return mode == DRIVE_WAVE ? MOTOR_STEP_SEQUENCE[index & ~1]
+       : mode == DRIVE_FULL ? MOTOR_STEP_SEQUENCE[index | 1]
+       : MOTOR_STEP_SEQUENCE[index];
+}
+
+// Phase advance per step in microsteps; a phase counts MICROSTEPS_PER_HALF_STEP
+// per half step
+constexpr uint8_t driveModeStride(uint8_t mode) {
+  return mode == DRIVE_MICRO ? 1
+       : mode == DRIVE_HALF ? MICROSTEPS_PER_HALF_STEP
+       : 2 * MICROSTEPS_PER_HALF_STEP;
+}
+
+#define COIL_PHASE_COUNT (MOTOR_STEPS_PER_REVOLUTION * MICROSTEPS_PER_HALF_STEP)
+
+static_assert(COIL_PHASE_COUNT == 64, "COIL_SINE_TABLE has 64 entries");
+
+// round(255 * sin(2 pi i / 64)) with the negative half clipped to zero.
+// Coil IN2 follows sin, IN4 -sin, IN1 cos and IN3 -cos, which puts the
+// full-current points on the wave-drive patterns.
+const uint8_t COIL_SINE_TABLE[COIL_PHASE_COUNT] PROGMEM = {
+  0, 25, 50, 74, 98, 120, 142, 162, 180, 197, 212, 225, 236, 244, 250, 254,
+  255, 254, 250, 244, 236, 225, 212, 197, 180, 162, 142, 120, 98, 74, 50, 25,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+// ========== COIL DRIVE STATE ==========
+// Shared by every axis; only changed while the motor is idle
+struct CoilDriveState {
+  DriveMode mode;
+  uint8_t stride;
+};
+
+static CoilDriveState coilDrive = {DEFAULT_DRIVE_MODE, driveModeStride(DEFAULT_DRIVE_MODE)};
+
+// ========== STEPPER AXIS TEMPLATE ==========
+// One ULN2003 axis. The port masks and the PROGMEM step tables are built
+// from the pins at compile time, so step() is a table read and one write
+// per port. In DRIVE_MICRO an axis whose four pins are all PWM outputs sets
+// the coil duties from COIL_SINE_TABLE instead; other axes keep half-step
+// patterns at the same step size. phase is the electrical angle in
+// microsteps and position counts microsteps since begin(); both are written
+// from the step timer interrupt.
+template <uint8_t In1, uint8_t In2, uint8_t In3, uint8_t In4>
+class StepperAxis {
+public:
+  static_assert(coilPinsFitTwoPorts(In1, In2, In3, In4), "Axis coil pins must be Mega pins on at most two ports");
+  
+  static const uint8_t PRIMARY_PORT = pinPort(In1);
+  static const uint8_t SECONDARY_PORT = findSecondaryCoilPort(In1, In2, In3, In4);
+  static const uint8_t PRIMARY_MASK = coilPortBits(0b1111, PRIMARY_PORT, In1, In2, In3, In4);
+  static const uint8_t SECONDARY_MASK = coilPortBits(0b1111, SECONDARY_PORT, In1, In2, In3, In4);
+  static const bool MICROSTEPPING = PwmChannel<In1>::AVAILABLE && PwmChannel<In2>::AVAILABLE &&
+                                    PwmChannel<In3>::AVAILABLE && PwmChannel<In4>::AVAILABLE;
+  static const CoilPortBits STEP_TABLE[DRIVE_MODE_COUNT][MOTOR_STEPS_PER_REVOLUTION];
+  
+  volatile uint8_t phase;
+  volatile long position;
+  
+  void begin() {
+    pinMode(In1, OUTPUT);
+    pinMode(In2, OUTPUT);
+    pinMode(In3, OUTPUT);
+    pinMode(In4, OUTPUT);
+    phase = 0;
+    position = 0;
+    release();
+  }
+  
+  // direction is +1 or -1
+  void step(int8_t direction) {
+    int8_t delta = direction > 0 ? coilDrive.stride : -coilDrive.stride;
+    phase = (phase + delta) & (COIL_PHASE_COUNT - 1);
+    position += delta;
+    output();
+  }
+  
+  // Coils on at the current phase, IN1 in bit 0. A microstepping axis
+  // reports the nearest half-step pattern.
+  uint8_t pattern() const {
+    return driveModePattern(coilDrive.mode, phase / MICROSTEPS_PER_HALF_STEP);
+  }
+  
+  // Drives the coils for the current phase in the current mode
+  void output() {
+    if (MICROSTEPPING && coilDrive.mode == DRIVE_MICRO) {
+      writeDuties(phase);
+    } else {
+      writePhase(coilDrive.mode, phase / MICROSTEPS_PER_HALF_STEP);
+    }
+  }
+  
+  // Hands the pins to the PWM timers or back to the port registers after a
+  // mode change, leaving the coils off
+  static void applyDriveMode() {
+    bool pwm = MICROSTEPPING && coilDrive.mode == DRIVE_MICRO;
+    PwmChannel<In1>::connect(pwm);
+    PwmChannel<In2>::connect(pwm);
+    PwmChannel<In3>::connect(pwm);
+    PwmChannel<In4>::connect(pwm);
+    release();
+  }
+  
+  static void release() {
+    if (MICROSTEPPING && coilDrive.mode == DRIVE_MICRO) {
+      writeDuty(0, 0, 0, 0);
+    } else {
+      writeOff();
+    }
+  }
+
+private:
+  static void writeDuties(uint8_t angle) {
+    writeDuty(pgm_read_byte(&COIL_SINE_TABLE[(angle + COIL_PHASE_COUNT / 4) & (COIL_PHASE_COUNT - 1)]),
+              pgm_read_byte(&COIL_SINE_TABLE[angle]),
+              pgm_read_byte(&COIL_SINE_TABLE[(angle + 3 * COIL_PHASE_COUNT / 4) & (COIL_PHASE_COUNT - 1)]),
+              pgm_read_byte(&COIL_SINE_TABLE[(angle + COIL_PHASE_COUNT / 2) & (COIL_PHASE_COUNT - 1)]));
+  }
+  
+  static void writeDuty(uint8_t in1, uint8_t in2, uint8_t in3, uint8_t in4) {
+    PwmChannel<In1>::write(in1);
+    PwmChannel<In2>::write(in2);
+    PwmChannel<In3>::write(in3);
+    PwmChannel<In4>::write(in4);
+  }
+
+#if defined(HAL_TARGET_AVR)
+  
+  static void writePhase(uint8_t mode, uint8_t index) {
+    writePorts(pgm_read_byte(&STEP_TABLE[mode][index].primary),
+               pgm_read_byte(&STEP_TABLE[mode][index].secondary));
+  }
+  
+  static void writeOff() {
+    writePorts(0, 0);
+  }
+  
+  static inline void writePorts(uint8_t primary, uint8_t secondary) {
+    uint8_t oldSREG = SREG;
+    cli();
+    writePortBits<PRIMARY_PORT, PRIMARY_MASK>(primary);
+    if (SECONDARY_PORT != PRIMARY_PORT) {
+      writePortBits<SECONDARY_PORT, SECONDARY_MASK>(secondary);
+    }
+    SREG = oldSREG;
+  }
+
+#else
+  
+  // Off target there are no port registers; fall back to the pin API
+  static void writePhase(uint8_t mode, uint8_t index) {
+    writePattern(driveModePattern(mode, index));
+  }
+  
+  static void writeOff() {
+    writePattern(0);
+  }
+  
+  static void writePattern(uint8_t pattern) {
+    digitalWrite(In1, pattern & 0b0001 ? HIGH : LOW);
+    digitalWrite(In2, pattern & 0b0010 ? HIGH : LOW);
+    digitalWrite(In3, pattern & 0b0100 ? HIGH : LOW);
+    digitalWrite(In4, pattern & 0b1000 ? HIGH : LOW);
+  }
+
+#endif
+};
+
+// ========== COIL STEP TABLES ==========
+#define AXIS_STEP_BITS(mode, step) \
+  {coilPortBits(driveModePattern(mode, step), PRIMARY_PORT, In1, In2, In3, In4), \
+   coilPortBits(driveModePattern(mode, step), SECONDARY_PORT, In1, In2, In3, In4)}
+
+#define AXIS_STEP_ROW(mode) \
+  {AXIS_STEP_BITS(mode, 0), AXIS_STEP_BITS(mode, 1), AXIS_STEP_BITS(mode, 2), AXIS_STEP_BITS(mode, 3), \
+   AXIS_STEP_BITS(mode, 4), AXIS_STEP_BITS(mode, 5), AXIS_STEP_BITS(mode, 6), AXIS_STEP_BITS(mode, 7)}
+
+// One row per DriveMode; the DRIVE_MICRO row is used by axes without PWM
+template <uint8_t In1, uint8_t In2, uint8_t In3, uint8_t In4>
+const CoilPortBits StepperAxis<In1, In2, In3, In4>::STEP_TABLE[DRIVE_MODE_COUNT][MOTOR_STEPS_PER_REVOLUTION] PROGMEM = {
+  AXIS_STEP_ROW(DRIVE_WAVE),
+  AXIS_STEP_ROW(DRIVE_FULL),
+  AXIS_STEP_ROW(DRIVE_HALF),
+  AXIS_STEP_ROW(DRIVE_MICRO)
+};
+
+// ========== AXIS WIRING ==========
+// X is the original motor; the others are the extra axes used by
+// coordinated moves
+typedef StepperAxis<MOTOR_IN1_PIN, MOTOR_IN2_PIN, MOTOR_IN3_PIN, MOTOR_IN4_PIN> AxisX;
+typedef StepperAxis<AXIS_Y_IN1_PIN, AXIS_Y_IN2_PIN, AXIS_Y_IN3_PIN, AXIS_Y_IN4_PIN> AxisY;
+#if MOTION_AXIS_COUNT > 2
+typedef StepperAxis<AXIS_Z_IN1_PIN, AXIS_Z_IN2_PIN, AXIS_Z_IN3_PIN, AXIS_Z_IN4_PIN> AxisZ;
+#endif
+#if MOTION_AXIS_COUNT > 3
+typedef StepperAxis<AXIS_A_IN1_PIN, AXIS_A_IN2_PIN, AXIS_A_IN3_PIN, AXIS_A_IN4_PIN> AxisA;
+#endif
+
+static_assert(MOTION_AXIS_COUNT >= 2 && MOTION_AXIS_COUNT <= 4, "MOTION_AXIS_COUNT must be 2 to 4");
+
+// Command letters in axis order
+const char AXIS_NAMES[] PROGMEM = "xyza";
+
+extern AxisX axisX;
+extern AxisY axisY;
+#if MOTION_AXIS_COUNT > 2
+extern AxisZ axisZ;
+#endif
+#if MOTION_AXIS_COUNT > 3
+extern AxisA axisA;
+#endif
+
+// ========== COIL OUTPUT FUNCTION DECLARATIONS ==========
+void initializeCoils();
+void releaseCoils();
+void setCoilDriveMode(DriveMode mode);
+
+// ========== COIL OUTPUT FUNCTION IMPLEMENTATIONS ==========
+
+void initializeCoils() {
+  pwmTimersBegin();
+  axisX.begin();
+  axisY.begin();
+#if MOTION_AXIS_COUNT > 2
+  axisZ.begin();
+#endif
+#if MOTION_AXIS_COUNT > 3
+  axisA.begin();
+#endif
+}
+
+// De-energises every axis
+void releaseCoils() {
+  axisX.release();
+  axisY.release();
+#if MOTION_AXIS_COUNT > 2
+  axisZ.release();
+#endif
+#if MOTION_AXIS_COUNT > 3
+  axisA.release();
+#endif
+  for (uint8_t axis = 0; axis < MOTION_AXIS_COUNT; axis++) {
+    traceEvent(TRACE_COIL, axis << 4);
+  }
+}
+
+// Coils are released across the change; the next step energises them in
+// the new mode
+void setCoilDriveMode(DriveMode mode) {
+  releaseCoils();
+  coilDrive.mode = mode;
+  coilDrive.stride = driveModeStride(mode);
+  axisX.applyDriveMode();
+  axisY.applyDriveMode();
+#if MOTION_AXIS_COUNT > 2
+  axisZ.applyDriveMode();
+#endif
+#if MOTION_AXIS_COUNT > 3
+  axisA.applyDriveMode();
+#endif
+}
+
+#endif // COIL_OUTPUT_H
@@ -3,309 +3,895 @@
 
 #include <Arduino.h>
 #include "config.h"
+#include "console.h"
 #include "motor.h"
 #include "traffic_light.h"
 #include "lcd.h"
+#include "arg_parser.h"
+#include "stats.h"
+#include "config_store.h"
+#include "event_log.h"
+#include "macro_vm.h"
+#include "trace.h"
 
 // ========== COMMAND FUNCTION TYPE ==========
-typedef void (*CommandFunction)(String);
+// Returns false when the command was rejected (bad argument, busy, full
+// queue); the reason goes to the console. The binary protocol, which mutes
+// the console, turns false into PROTOCOL_STATUS_BAD_ARGUMENT.
+typedef bool (*CommandFunction)(const char* args);
 
 // ========== COMMAND STRUCTURE ==========
+enum CommandGroup {
+  COMMAND_GROUP_MOTOR,
+  COMMAND_GROUP_TRAFFIC,
+  COMMAND_GROUP_OTHER
+};
+
+// opcode is the command's fixed number in the binary protocol;
+// COMMAND_OPCODE_NONE keeps a command on the text console only
+#define COMMAND_OPCODE_NONE 0x00
+
 struct Command {
   const char* name;
   CommandFunction function;
+  CommandGroup group;
+  uint8_t opcode;
   const char* description;
 };
 
 // ========== COMMAND FUNCTION DECLARATIONS ==========
-void handleForwardCommand(String args);
-void handleReverseCommand(String args);
-void handleSpeedCommand(String args);
-void handleStopCommand(String args);
-void handleDemoCommand(String args);
-void handleTrafficCommand(String args);
-void handleRedCommand(String args);
-void handleYellowCommand(String args);
-void handleGreenCommand(String args);
-void handleAllOffCommand(String args);
-void handleAllOnCommand(String args);
-void handleFlashCommand(String args);
-void handleEmergencyCommand(String args);
-void handleTimingCommand(String args);
-void handleLoopCommand(String args);
-void handleHelpCommand(String args);
-
-void processCommand(String input);
+bool handleForwardCommand(const char* args);
+bool handleReverseCommand(const char* args);
+bool handleSpeedCommand(const char* args);
+bool handleAccelCommand(const char* args);
+bool handleMaxSpeedCommand(const char* args);
+bool handleStopCommand(const char* args);
+bool handleMoveCommand(const char* args);
+bool handleDriveModeCommand(const char* args);
+bool handleGotoCommand(const char* args);
+bool handleZeroCommand(const char* args);
+bool parseAxisSteps(const char* args, long steps[MOTION_AXIS_COUNT]);
+bool handleDemoCommand(const char* args);
+bool handleTrafficCommand(const char* args);
+bool handleRedCommand(const char* args);
+bool handleYellowCommand(const char* args);
+bool handleGreenCommand(const char* args);
+bool handleAllOffCommand(const char* args);
+bool handleAllOnCommand(const char* args);
+bool handleFlashCommand(const char* args);
+bool handleEmergencyCommand(const char* args);
+bool handleTimingCommand(const char* args);
+bool handleProgramCommand(const char* args);
+bool handleLoopCommand(const char* args);
+bool handleStatsCommand(const char* args);
+bool handleConfigCommand(const char* args);
+bool handleLogCommand(const char* args);
+bool handleMacroCommand(const char* args);
+bool parseMacroName(const char*& cursor, char* name);
+bool handleTraceCommand(const char* args);
+bool parseOnOff(const char*& cursor, bool& on);
+bool handleBenchCommand(const char* args);
+bool handleBinaryCommand(const char* args);
+bool handleHelpCommand(const char* args);
+
+const Command* findCommand(const char* input, const char*& args);
+const Command* findCommandByOpcode(uint8_t opcode);
+CommandFunction commandFunction(const Command* command);
+uint8_t commandOpcode(const Command* command);
+void processCommand(const char* input);
+void printCommandGroup(CommandGroup group);
 void printHelp();
 
+// Implemented in bench.h and binary_protocol.h
+void requestBenchmarks();
+bool benchmarkPending();
+bool benchmarkRunning();
+void startBinaryProtocol();
+
 // ========== COMMAND LOOKUP TABLE ==========
-const Command COMMAND_TABLE[] = {
-  {"f", handleForwardCommand, "'f' + number - Move forward (e.g., f100)"},
-  {"r", handleReverseCommand, "'r' + number - Move reverse (e.g., r100)"},
-  {"s", handleSpeedCommand, "'s' + number - Set speed (1-20, lower = faster)"},
-  {"stop", handleStopCommand, "'stop' - Stop motor"},
-  {"demo", handleDemoCommand, "'demo' - Run motor demonstration"},
-  {"traffic", handleTrafficCommand, "'traffic' - Start/Stop automatic traffic light cycle"},
-  {"red", handleRedCommand, "'red' - Turn on RED light only"},
-  {"yellow", handleYellowCommand, "'yellow' - Turn on YELLOW light only"},
-  {"green", handleGreenCommand, "'green' - Turn on GREEN light only"},
-  {"alloff", handleAllOffCommand, "'alloff' - Turn off all traffic lights"},
-  {"allon", handleAllOnCommand, "'allon' - Turn on all traffic lights"},
-  {"flash", handleFlashCommand, "'flash' - Flash all lights"},
-  {"emergency", handleEmergencyCommand, "'emergency' - Emergency flashing red"},
-  {"timing", handleTimingCommand, "'timing' + r,y,g - Set timing (e.g., timing5000,2000,4000)"},
-  {"loop", handleLoopCommand, "'loop' - Move motor 10,000 steps forward with circulating lights"},
-  {"help", handleHelpCommand, "'help' - Show this help message"}
+// Names are matched as prefixes in table order, so a name must come before
+// any shorter name it starts with ("flash" before "f", "stop" before "s").
+// commandTableIsOrdered() enforces this at compile time. Names, help lines
+// and the table itself are PROGMEM, so none of it is copied into SRAM at
+// startup; entries are read with pgm_read_*() or commandFunction().
+#define COMMAND_TEXT(id, name, help) \
+  constexpr char COMMAND_NAME_##id[] PROGMEM = name; \
+  constexpr char COMMAND_HELP_##id[] PROGMEM = help
+
+COMMAND_TEXT(FLASH, "flash", "'flash' - Flash all lights");
+COMMAND_TEXT(F, "f", "'f' + number - Move forward (e.g., f100)");
+COMMAND_TEXT(RED, "red", "'red' - Turn on RED light only");
+COMMAND_TEXT(R, "r", "'r' + number - Move reverse (e.g., r100)");
+COMMAND_TEXT(STOP, "stop", "'stop' - Stop motor");
+COMMAND_TEXT(STATS, "stats", "'stats' - Show loop, step, command and RAM stats ('stats reset' clears)");
+COMMAND_TEXT(S, "s", "'s' + number - Set speed (1-20, lower = faster)");
+COMMAND_TEXT(ACCEL, "accel", "'accel' + number - Set acceleration in steps/s^2 (e.g., accel800)");
+COMMAND_TEXT(VMAX, "vmax", "'vmax' + number - Set max speed in steps/s (e.g., vmax1000)");
+COMMAND_TEXT(DEMO, "demo", "'demo' - Run motor demonstration");
+COMMAND_TEXT(MACRO, "macro", "'macro' - List macros ('macro run/delete name', 'macro stop', upload: 'macro begin name', 'macro data hex', 'macro end')");
+COMMAND_TEXT(MODE, "mode", "'mode' + wave/full/half/micro - Set coil drive mode");
+COMMAND_TEXT(M, "m", "'m' + axis steps - Coordinated move (e.g., m x100 y-50)");
+COMMAND_TEXT(GOTO, "goto", "'goto' + position - Move to an absolute step position, also while moving (e.g., goto-200); 'goto' alone shows it");
+COMMAND_TEXT(ZERO, "zero", "'zero' - Make the current position step 0");
+COMMAND_TEXT(TRAFFIC, "traffic", "'traffic' - Start/Stop automatic traffic light cycle");
+COMMAND_TEXT(YELLOW, "yellow", "'yellow' - Turn on YELLOW light only");
+COMMAND_TEXT(GREEN, "green", "'green' - Turn on GREEN light only");
+COMMAND_TEXT(ALLOFF, "alloff", "'alloff' - Turn off all traffic lights");
+COMMAND_TEXT(ALLON, "allon", "'allon' - Turn on all traffic lights");
+COMMAND_TEXT(EMERGENCY, "emergency", "'emergency' - Emergency flashing red");
+COMMAND_TEXT(TIMING, "timing", "'timing' + r,y,g - Set timing (e.g., timing5000,2000,4000)");
+COMMAND_TEXT(PROGRAM, "program", "'program' + lamps:ms ... - Load a phase program (e.g., program r/g:8000 r/y:2000 r/r:1000 g/r/w:8000 ...)");
+COMMAND_TEXT(LOOP, "loop", "'loop' - Move motor 10,000 steps forward with circulating lights");
+COMMAND_TEXT(CONFIG, "config", "'config' - Show stored settings ('config save', 'config autostart on/off', 'config fastboot on/off', 'config defaults')");
+COMMAND_TEXT(LOG, "log", "'log' - Show log level, modules and drops ('log level error/warn/info/debug', 'log traffic/motor/macro/config on/off')");
+COMMAND_TEXT(TRACE, "trace", "'trace' - Show the event trace ('trace start', 'trace arm coil/lamp/cmd/lcd', 'trace stop', 'trace dump', 'trace coil/lamp/cmd/lcd on/off')");
+COMMAND_TEXT(BENCH, "bench", "'bench' - Time loop, step, command and LCD hot paths (CSV)");
+COMMAND_TEXT(BINARY, "binary", "'binary' - Switch the port to the framed binary protocol");
+COMMAND_TEXT(HELP, "help", "'help' - Show this help message");
+
+constexpr Command COMMAND_TABLE[] PROGMEM = {
+  {COMMAND_NAME_FLASH, handleFlashCommand, COMMAND_GROUP_TRAFFIC, 0x25, COMMAND_HELP_FLASH},
+  {COMMAND_NAME_F, handleForwardCommand, COMMAND_GROUP_MOTOR, 0x10, COMMAND_HELP_F},
+  {COMMAND_NAME_RED, handleRedCommand, COMMAND_GROUP_TRAFFIC, 0x20, COMMAND_HELP_RED},
+  {COMMAND_NAME_R, handleReverseCommand, COMMAND_GROUP_MOTOR, 0x11, COMMAND_HELP_R},
+  {COMMAND_NAME_STOP, handleStopCommand, COMMAND_GROUP_MOTOR, 0x12, COMMAND_HELP_STOP},
+  {COMMAND_NAME_STATS, handleStatsCommand, COMMAND_GROUP_OTHER, COMMAND_OPCODE_NONE, COMMAND_HELP_STATS},
+  {COMMAND_NAME_S, handleSpeedCommand, COMMAND_GROUP_MOTOR, 0x13, COMMAND_HELP_S},
+  {COMMAND_NAME_ACCEL, handleAccelCommand, COMMAND_GROUP_MOTOR, 0x14, COMMAND_HELP_ACCEL},
+  {COMMAND_NAME_VMAX, handleMaxSpeedCommand, COMMAND_GROUP_MOTOR, 0x15, COMMAND_HELP_VMAX},
+  {COMMAND_NAME_DEMO, handleDemoCommand, COMMAND_GROUP_MOTOR, 0x16, COMMAND_HELP_DEMO},
+  {COMMAND_NAME_MACRO, handleMacroCommand, COMMAND_GROUP_OTHER, COMMAND_OPCODE_NONE, COMMAND_HELP_MACRO},
+  {COMMAND_NAME_MODE, handleDriveModeCommand, COMMAND_GROUP_MOTOR, 0x18, COMMAND_HELP_MODE},
+  {COMMAND_NAME_M, handleMoveCommand, COMMAND_GROUP_MOTOR, 0x17, COMMAND_HELP_M},
+  {COMMAND_NAME_GOTO, handleGotoCommand, COMMAND_GROUP_MOTOR, 0x19, COMMAND_HELP_GOTO},
+  {COMMAND_NAME_ZERO, handleZeroCommand, COMMAND_GROUP_MOTOR, 0x1A, COMMAND_HELP_ZERO},
+  {COMMAND_NAME_TRAFFIC, handleTrafficCommand, COMMAND_GROUP_TRAFFIC, 0x27, COMMAND_HELP_TRAFFIC},
+  {COMMAND_NAME_YELLOW, handleYellowCommand, COMMAND_GROUP_TRAFFIC, 0x21, COMMAND_HELP_YELLOW},
+  {COMMAND_NAME_GREEN, handleGreenCommand, COMMAND_GROUP_TRAFFIC, 0x22, COMMAND_HELP_GREEN},
+  {COMMAND_NAME_ALLOFF, handleAllOffCommand, COMMAND_GROUP_TRAFFIC, 0x23, COMMAND_HELP_ALLOFF},
+  {COMMAND_NAME_ALLON, handleAllOnCommand, COMMAND_GROUP_TRAFFIC, 0x24, COMMAND_HELP_ALLON},
+  {COMMAND_NAME_EMERGENCY, handleEmergencyCommand, COMMAND_GROUP_TRAFFIC, 0x26, COMMAND_HELP_EMERGENCY},
+  {COMMAND_NAME_TIMING, handleTimingCommand, COMMAND_GROUP_TRAFFIC, 0x28, COMMAND_HELP_TIMING},
+  {COMMAND_NAME_PROGRAM, handleProgramCommand, COMMAND_GROUP_TRAFFIC, 0x2A, COMMAND_HELP_PROGRAM},
+  {COMMAND_NAME_LOOP, handleLoopCommand, COMMAND_GROUP_TRAFFIC, 0x29, COMMAND_HELP_LOOP},
+  {COMMAND_NAME_CONFIG, handleConfigCommand, COMMAND_GROUP_OTHER, COMMAND_OPCODE_NONE, COMMAND_HELP_CONFIG},
+  {COMMAND_NAME_LOG, handleLogCommand, COMMAND_GROUP_OTHER, COMMAND_OPCODE_NONE, COMMAND_HELP_LOG},
+  {COMMAND_NAME_TRACE, handleTraceCommand, COMMAND_GROUP_OTHER, COMMAND_OPCODE_NONE, COMMAND_HELP_TRACE},
+  {COMMAND_NAME_BENCH, handleBenchCommand, COMMAND_GROUP_OTHER, COMMAND_OPCODE_NONE, COMMAND_HELP_BENCH},
+  {COMMAND_NAME_BINARY, handleBinaryCommand, COMMAND_GROUP_OTHER, COMMAND_OPCODE_NONE, COMMAND_HELP_BINARY},
+  {COMMAND_NAME_HELP, handleHelpCommand, COMMAND_GROUP_OTHER, COMMAND_OPCODE_NONE, COMMAND_HELP_HELP}
 };
 
 const int COMMAND_COUNT = sizeof(COMMAND_TABLE) / sizeof(Command);
 
+constexpr bool commandNameStartsWith(const char* name, const char* prefix) {
+  return *prefix == '\0' || (*name == *prefix && commandNameStartsWith(name + 1, prefix + 1));
+}
+
+constexpr bool commandShadowsLater(int entry, int later) {
+  return later < COMMAND_COUNT &&
+         (commandNameStartsWith(COMMAND_TABLE[later].name, COMMAND_TABLE[entry].name) ||
+          commandShadowsLater(entry, later + 1));
+}
+
+constexpr bool commandTableIsOrdered(int entry) {
+  return entry >= COMMAND_COUNT ||
+         (!commandShadowsLater(entry, entry + 1) && commandTableIsOrdered(entry + 1));
+}
+
+constexpr bool commandOpcodeUsedLater(int entry, int later) {
+  return later < COMMAND_COUNT &&
+         (COMMAND_TABLE[later].opcode == COMMAND_TABLE[entry].opcode ||
+          commandOpcodeUsedLater(entry, later + 1));
+}
+
+constexpr bool commandOpcodesAreUnique(int entry) {
+  return entry >= COMMAND_COUNT ||
+         ((COMMAND_TABLE[entry].opcode == COMMAND_OPCODE_NONE || !commandOpcodeUsedLater(entry, entry + 1)) &&
+          commandOpcodesAreUnique(entry + 1));
+}
+
+static_assert(commandTableIsOrdered(0), "COMMAND_TABLE: a command name is shadowed by an earlier, shorter prefix");
+static_assert(commandOpcodesAreUnique(0), "COMMAND_TABLE: two commands share a binary opcode");
+
 // ========== COMMAND FUNCTION IMPLEMENTATIONS ==========
 
-void handleForwardCommand(String args) {
-  int steps = args.toInt();
-  if (validateStepCount(steps)) {
-    Serial.println("Moving forward " + String(steps) + " steps");
-    displayCommand("FWD " + String(steps));
-    moveSteps(steps, CLOCKWISE);
+bool handleForwardCommand(const char* args) {
+  long steps;
+  if (parseLongArg(args, steps) && validateStepCount(steps)) {
+    stopMacro(MACRO_USES_MOTOR);
+    if (queueMove(steps, CLOCKWISE)) {
+      printLine(console, F("Moving forward "), steps, F(" steps ("), motionQueueDepth(), F(" queued, "), motionQueueFree(), F(" free)"));
+      displayCommand(F("FWD "), steps);
+      return true;
+    }
+    console.println(F("Motion queue full"));
+    displayError(F("Queue full"));
   } else {
-    Serial.println("Invalid step count");
-    displayError("Invalid steps");
+    console.println(F("Invalid step count"));
+    displayError(F("Invalid steps"));
   }
+  return false;
 }
 
-void handleReverseCommand(String args) {
-  int steps = args.toInt();
-  if (validateStepCount(steps)) {
-    Serial.println("Moving reverse " + String(steps) + " steps");
-    displayCommand("REV " + String(steps));
-    moveSteps(steps, COUNTER_CLOCKWISE);
+bool handleReverseCommand(const char* args) {
+  long steps;
+  if (parseLongArg(args, steps) && validateStepCount(steps)) {
+    stopMacro(MACRO_USES_MOTOR);
+    if (queueMove(steps, COUNTER_CLOCKWISE)) {
+      printLine(console, F("Moving reverse "), steps, F(" steps ("), motionQueueDepth(), F(" queued, "), motionQueueFree(), F(" free)"));
+      displayCommand(F("REV "), steps);
+      return true;
+    }
+    console.println(F("Motion queue full"));
+    displayError(F("Queue full"));
   } else {
-    Serial.println("Invalid step count");
-    displayError("Invalid steps");
+    console.println(F("Invalid step count"));
+    displayError(F("Invalid steps"));
   }
+  return false;
 }
 
-void handleSpeedCommand(String args) {
-  int speed = args.toInt();
-  if (setMotorSpeed(speed)) {
-    Serial.println("Speed set to " + String(speed));
-    displayCommand("SPD " + String(speed));
+bool handleSpeedCommand(const char* args) {
+  long speed;
+  if (parseLongArg(args, speed) && setMotorSpeed(speed)) {
+    printLine(console, F("Speed set to "), speed);
+    configStoreMarkDirty();
+    displayCommand(F("SPD "), speed);
+    return true;
   } else {
-    Serial.println("Speed must be between " + String(MIN_STEP_DELAY) + " and " + String(MAX_STEP_DELAY));
-    displayError("Invalid speed");
+    printLine(console, F("Speed must be between "), MIN_STEP_DELAY, F(" and "), MAX_STEP_DELAY);
+    displayError(F("Invalid speed"));
+    return false;
   }
 }
 
-void handleStopCommand(String args) {
+bool handleAccelCommand(const char* args) {
+  long accel;
+  if (parseLongArg(args, accel) && setMotorAcceleration(accel)) {
+    printLine(console, F("Acceleration set to "), accel, F(" steps/s^2"));
+    configStoreMarkDirty();
+    displayCommand(F("ACC "), accel);
+    return true;
+  } else {
+    printLine(console, F("Acceleration must be between "), MIN_ACCELERATION_SPS2, F(" and "), MAX_ACCELERATION_SPS2);
+    displayError(F("Invalid accel"));
+    return false;
+  }
+}
+
+bool handleMaxSpeedCommand(const char* args) {
+  long speed;
+  if (parseLongArg(args, speed) && setMotorMaxSpeed(speed)) {
+    printLine(console, F("Max speed set to "), speed, F(" steps/s"));
+    configStoreMarkDirty();
+    displayCommand(F("VMAX "), speed);
+    return true;
+  } else {
+    printLine(console, F("Max speed must be between "), MIN_MAX_SPEED_SPS, F(" and "), MAX_MAX_SPEED_SPS);
+    displayError(F("Invalid max speed"));
+    return false;
+  }
+}
+
+bool handleStopCommand(const char* args) {
+  stopMacro(MACRO_USES_MOTOR);
   stopMotor();
-  Serial.println("Motor stopped");
-  displayCommand("STOP");
+  console.println(F("Motor stopped"));
+  displayCommand(F("STOP"));
+  return true;
 }
 
-void handleDemoCommand(String args) {
-  displayCommand("DEMO");
-  runMotorDemo();
+// Parses "x100 y-50": an axis letter from AXIS_NAMES followed by a signed
+// step count, each axis at most once. Axes left out stay at zero.
+bool parseAxisSteps(const char* args, long steps[MOTION_AXIS_COUNT]) {
+  bool seen[MOTION_AXIS_COUNT] = {false};
+  bool any = false;
+  
+  for (;;) {
+    args = skipSpaces(args);
+    if (parseEnd(args)) break;
+    
+    uint8_t axis = 0;
+    while (axis < MOTION_AXIS_COUNT && pgm_read_byte(&AXIS_NAMES[axis]) != tolower(*args)) {
+      axis++;
+    }
+    if (axis == MOTION_AXIS_COUNT) return false;
+    args++;
+    
+    long value;
+    if (seen[axis] || !parseLong(args, value)) return false;
+    steps[axis] = value;
+    seen[axis] = true;
+    any = any || value != 0;
+  }
+  return any;
 }
 
-void handleTrafficCommand(String args) {
+// The non-zero counts of a move as " x100 y-50", for printItems()
+struct AxisSteps {
+  const long* steps;
+};
+
+void printItem(Print& out, const AxisSteps& move) {
+  for (uint8_t i = 0; i < MOTION_AXIS_COUNT; i++) {
+    if (move.steps[i] != 0) {
+      printItems(out, ' ', (char)pgm_read_byte(&AXIS_NAMES[i]), move.steps[i]);
+    }
+  }
+}
+
+bool handleMoveCommand(const char* args) {
+  long steps[MOTION_AXIS_COUNT] = {0};
+  if (!parseAxisSteps(args, steps)) {
+    console.println(F("Invalid move. Use: m x100 y-50"));
+    displayError(F("Invalid move"));
+    return false;
+  }
+  
+  stopMacro(MACRO_USES_MOTOR);
+  if (moveLinear(steps)) {
+    AxisSteps move = {steps};
+    printLine(console, F("Moving"), move);
+    displayCommand(F("MOVE"), move);
+    return true;
+  }
+  displayError(F("Invalid steps"));
+  return false;
+}
+
+// Unlike f and r, a goto does not queue: it takes over the running move
+bool handleGotoCommand(const char* args) {
+  long target;
+  if (parseEnd(args)) {
+    printLine(console, F("Position: "), getMotorPosition(), F(" steps"));
+    return true;
+  } else if (parseLongArg(args, target) && target >= -MAX_POSITION_STEPS && target <= MAX_POSITION_STEPS) {
+    stopMacro(MACRO_USES_MOTOR);
+    if (!moveToPosition(target)) {
+      printLine(console, F("Target is more than "), MAX_MOVE_STEPS, F(" steps away"));
+      displayError(F("Too far"));
+      return false;
+    }
+    printLine(console, F("Going to "), target);
+    displayCommand(F("GOTO "), target);
+    return true;
+  } else {
+    printLine(console, F("Position must be between "), -MAX_POSITION_STEPS, F(" and "), MAX_POSITION_STEPS);
+    displayError(F("Invalid position"));
+    return false;
+  }
+}
+
+bool handleZeroCommand(const char* args) {
+  if (zeroMotorPosition()) {
+    console.println(F("Position set to 0"));
+    displayCommand(F("ZERO"));
+    return true;
+  } else {
+    console.println(F("Stop the motor before zeroing"));
+    displayError(F("Motor running"));
+    return false;
+  }
+}
+
+const char DRIVE_MODE_NAME_WAVE[] PROGMEM = "wave";
+const char DRIVE_MODE_NAME_FULL[] PROGMEM = "full";
+const char DRIVE_MODE_NAME_HALF[] PROGMEM = "half";
+const char DRIVE_MODE_NAME_MICRO[] PROGMEM = "micro";
+const char* const DRIVE_MODE_NAMES[DRIVE_MODE_COUNT] PROGMEM = {
+  DRIVE_MODE_NAME_WAVE, DRIVE_MODE_NAME_FULL, DRIVE_MODE_NAME_HALF, DRIVE_MODE_NAME_MICRO
+};
+
+const __FlashStringHelper* driveModeName(uint8_t mode) {
+  return FPSTR(pgm_read_ptr(&DRIVE_MODE_NAMES[mode]));
+}
+
+bool handleDriveModeCommand(const char* args) {
+  if (parseEnd(args)) {
+    printLine(console, F("Drive mode: "), driveModeName(coilDrive.mode));
+    return true;
+  }
+  
+  for (uint8_t mode = 0; mode < DRIVE_MODE_COUNT; mode++) {
+    const char* cursor = args;
+    if (parseWord(cursor, driveModeName(mode)) && parseEnd(cursor)) {
+      if (setMotorDriveMode((DriveMode)mode)) {
+        printLine(console, F("Drive mode set to "), driveModeName(mode));
+        configStoreMarkDirty();
+        displayCommand(F("MODE "), driveModeName(mode));
+        return true;
+      }
+      console.println(F("Stop the motor before changing drive mode"));
+      displayError(F("Motor busy"));
+      return false;
+    }
+  }
+  console.println(F("Invalid mode. Use: mode wave, mode full, mode half or mode micro"));
+  displayError(F("Invalid mode"));
+  return false;
+}
+
+bool handleDemoCommand(const char* args) {
+  displayCommand(F("DEMO"));
+  console.println(F("Running motor demonstration..."));
+  printLine(console, F("Clockwise "), DEMO_STEPS, F(" steps"));
+  return startMacro(MACRO_STOCK_DEMO);
+}
+
+bool handleTrafficCommand(const char* args) {
+  stopMacro(MACRO_USES_LAMPS);
   toggleTrafficLightCycle();
+  return true;
 }
 
-void handleRedCommand(String args) {
-  trafficLight.isRunning = false;
+bool handleRedCommand(const char* args) {
+  stopMacro(MACRO_USES_LAMPS);
+  stopTrafficSequences();
   setTrafficLightByColor(LIGHT_RED);
-  Serial.println("RED light ON");
+  console.println(F("RED light ON"));
+  return true;
 }
 
-void handleYellowCommand(String args) {
-  trafficLight.isRunning = false;
+bool handleYellowCommand(const char* args) {
+  stopMacro(MACRO_USES_LAMPS);
+  stopTrafficSequences();
   setTrafficLightByColor(LIGHT_YELLOW);
-  Serial.println("YELLOW light ON");
+  console.println(F("YELLOW light ON"));
+  return true;
 }
 
-void handleGreenCommand(String args) {
-  trafficLight.isRunning = false;
+bool handleGreenCommand(const char* args) {
+  stopMacro(MACRO_USES_LAMPS);
+  stopTrafficSequences();
   setTrafficLightByColor(LIGHT_GREEN);
-  Serial.println("GREEN light ON");
+  console.println(F("GREEN light ON"));
+  return true;
 }
 
-void handleAllOffCommand(String args) {
-  trafficLight.isRunning = false;
+bool handleAllOffCommand(const char* args) {
+  stopMacro(MACRO_USES_LAMPS);
+  stopTrafficSequences();
   setTrafficLight(false, false, false);
-  Serial.println("All traffic lights OFF");
+  console.println(F("All traffic lights OFF"));
+  return true;
 }
 
-void handleAllOnCommand(String args) {
-  trafficLight.isRunning = false;
+bool handleAllOnCommand(const char* args) {
+  stopMacro(MACRO_USES_LAMPS);
+  stopTrafficSequences();
   setTrafficLight(true, true, true);
-  Serial.println("All traffic lights ON");
+  console.println(F("All traffic lights ON"));
+  return true;
 }
 
-void handleFlashCommand(String args) {
-  flashAllLights();
+bool handleFlashCommand(const char* args) {
+  console.println(F("Flashing all traffic lights"));
+  return startMacro(MACRO_STOCK_FLASH);
 }
 
-void handleEmergencyCommand(String args) {
-  emergencyFlash();
+bool handleEmergencyCommand(const char* args) {
+  console.println(F("Emergency flashing RED"));
+  return startMacro(MACRO_STOCK_EMERGENCY);
 }
 
-void handleTimingCommand(String args) {
-  if (!parseTimingCommand("timing" + args)) {
-    Serial.println("Failed to set timing");
+// parseTimingCommand() prints what was wrong with the arguments
+bool handleTimingCommand(const char* args) {
+  if (parseTimingCommand(args)) {
+    configStoreMarkDirty();
+    return true;
   }
+  return false;
 }
 
-void handleLoopCommand(String args) {
-  Serial.println("Starting loop sequence: " + String(LOOP_SEQUENCE_STEPS) + " steps forward with circulating lights");
-  
-  displayCommand("LOOP START");
-  delay(2000);
-  
-  disableAutoLCDUpdate = true;
-  
-  trafficLight.isRunning = false;
-  setTrafficLight(false, false, false);
-  
-  unsigned long startTime = millis();
-  unsigned long lastLightChange = millis();
-  LightColor currentLight = LIGHT_RED;
-  LightColor previousLight = LIGHT_GREEN;
-  int lastDisplayedStep = -1;
-  
-  setTrafficLightByColor(currentLight);
-  Serial.println("Starting with RED light");
-  
-  motorState.isRunning = true;
+// With no phases prints the loaded program; "default" goes back to the
+// red/green/yellow cycle of the timing command
+bool handleProgramCommand(const char* args) {
+  if (parseEnd(args)) {
+    printTrafficProgram();
+    return true;
+  }
   
-  extern LiquidCrystal_I2C lcd;
-  lcd.clear();
+  const char* cursor = args;
+  if (parseWord(cursor, F("default")) && parseEnd(cursor)) {
+    loadDefaultTrafficProgram();
+    printTrafficProgram();
+    displayCommand(F("PROGRAM DEFAULT"));
+    return true;
+  }
   
-  for (int step = 0; step < LOOP_SEQUENCE_STEPS; step++) {
-    if (millis() - lastLightChange >= LIGHT_CIRCULATION_DELAY_MS) {
-      currentLight = (LightColor)((currentLight + 1) % 3);
-      lastLightChange = millis();
-      
-      setTrafficLightByColor(currentLight);
-      String lightName = (currentLight == LIGHT_RED) ? "RED" : 
-                        (currentLight == LIGHT_YELLOW) ? "YELLOW" : "GREEN";
-      Serial.println("Switching to " + lightName + " light - Steps completed: " + String(step));
-    }
-    
-    if (currentLight != previousLight || step - lastDisplayedStep >= 1000) {
-      lcd.clear();
-      
-      lcd.setCursor(0, 0);
-      lcd.print("LOOP SEQUENCE ACTIVE");
-      
-      lcd.setCursor(0, 1);
-      if (currentLight == LIGHT_RED) {
-        lcd.print("LIGHT: RED");
-      } else if (currentLight == LIGHT_YELLOW) {
-        lcd.print("LIGHT: YELLOW");
-      } else {
-        lcd.print("LIGHT: GREEN");
+  TrafficProgram program;
+  program.count = 0;
+  while (!parseEnd(args)) {
+    if (program.count == TRAFFIC_MAX_PHASES || !parseTrafficPhase(args, program.phases[program.count])) {
+      printLine(console, F("Invalid program. Use up to "), TRAFFIC_MAX_PHASES, F(" phases like r/g/w:8000 (head A/head B/walk, min "), TRAFFIC_MIN_PHASE_MS, F("ms)"));
+      if (TRAFFIC_INTERSECTIONS > 1) {
+        printLine(console, F("Separate the "), TRAFFIC_INTERSECTIONS, F(" intersections with ',', e.g. r/g,g/r:8000"));
       }
-      
-      lcd.setCursor(0, 2);
-      lcd.print("STEP: ");
-      lcd.print(step);
-      lcd.print(" / ");
-      lcd.print(LOOP_SEQUENCE_STEPS);
-      
-      lcd.setCursor(0, 3);
-      float progress = (float)step / LOOP_SEQUENCE_STEPS * 100;
-      lcd.print("PROGRESS: ");
-      lcd.print(progress, 1);
-      lcd.print("%");
-      
-      previousLight = currentLight;
-      lastDisplayedStep = step;
+      displayError(F("Invalid program"));
+      return false;
     }
-    
-    executeStep(CLOCKWISE);
+    program.count++;
   }
   
-  setTrafficLight(false, false, false);
-  motorState.isRunning = false;
-  stopMotor();
-  
-  disableAutoLCDUpdate = false;
-  
-  lcd.clear();
-  
-  // Center "THANK YOU AZIZ" (14 chars) on 20-char display
-  // Position: (20-14)/2 = 3 spaces from left
-  lcd.setCursor(3, 1);  // Row 1 (middle of 4 rows)
-  lcd.print("THANK YOU AZIZ");
-  delay(30000);
+  loadTrafficProgram(program);
+  printTrafficProgram();
+  displayCommand(F("PROGRAM "), program.count, F(" PHASES"));
+  return true;
+}
+
+bool handleLoopCommand(const char* args) {
+  printLine(console, F("Starting loop sequence: "), LOOP_SEQUENCE_STEPS, F(" steps forward with circulating lights"));
+  displayCommand(F("LOOP START"));
+  return startMacro(MACRO_STOCK_LOOP);
+}
+
+bool handleStatsCommand(const char* args) {
+  if (parseEnd(args)) {
+    printStats();
+  } else if (parseWord(args, F("reset")) && parseEnd(args)) {
+    resetStats();
+    console.println(F("Stats reset"));
+  } else {
+    console.println(F("Usage: stats or stats reset"));
+    return false;
+  }
+  return true;
+}
+
+bool parseOnOff(const char*& cursor, bool& on) {
+  if (parseWordThen(cursor, F("on"), parseEnd)) {
+    on = true;
+  } else if (parseWordThen(cursor, F("off"), parseEnd)) {
+    on = false;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Settings changed by commands are saved on their own after
+// CONFIG_SAVE_DELAY_MS; 'config save' writes them at once
+bool handleConfigCommand(const char* args) {
+  bool on;
+  auto parseOn = [&](const char*& cursor) { return parseOnOff(cursor, on); };
+  if (parseEnd(args)) {
+    printStoredConfig();
+  } else if (parseWordThen(args, F("save"), parseEnd)) {
+    if (configUnsaved()) {
+      saveConfigNow();
+      console.println(F("Saving config"));
+    } else {
+      console.println(F("Config already saved"));
+    }
+  } else if (parseWordThen(args, F("autostart"), parseOn)) {
+    setConfigFlag(CONFIG_FLAG_AUTOSTART, on);
+    printLine(console, F("Traffic cycle auto-start "), on ? F("on") : F("off"));
+  } else if (parseWordThen(args, F("fastboot"), parseOn)) {
+    setConfigFlag(CONFIG_FLAG_FAST_BOOT, on);
+    printLine(console, F("Fast boot "), on ? F("on") : F("off"));
+  } else if (parseWordThen(args, F("defaults"), parseEnd)) {
+    restoreDefaultConfig();
+    console.println(F("Settings back to defaults"));
+  } else {
+    console.println(F("Usage: config, config save, config autostart on|off, config fastboot on|off or config defaults"));
+    return false;
+  }
+  return true;
+}
+
+static bool parseLogLevel(const char*& cursor, uint8_t& level) {
+  for (level = 0; level < LOG_LEVEL_COUNT; level++) {
+    const char* at = cursor;
+    if (parseWord(at, logLevelName(level)) && parseEnd(at)) {
+      cursor = at;
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool parseLogModule(const char*& cursor, uint8_t& module) {
+  for (module = 0; module < LOG_MODULE_COUNT; module++) {
+    const char* at = cursor;
+    if (parseWord(at, logModuleName(module))) {
+      cursor = at;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Level and modules are filters on what is queued; records already in the
+// ring still go out
+bool handleLogCommand(const char* args) {
+  uint8_t level;
+  uint8_t module;
+  bool on;
+  auto parseLevel = [&](const char*& cursor) { return parseLogLevel(cursor, level); };
+  if (parseEnd(args)) {
+    printItems(console, F("Log level: "), logLevelName(eventLog.level), F(", modules:"));
+    for (uint8_t i = 0; i < LOG_MODULE_COUNT; i++) {
+      printItems(console, ' ', logModuleName(i), eventLog.modules & (1 << i) ? F(" on") : F(" off"));
+    }
+    console.println();
+    printLine(console, F("Queued: "), logQueued(), '/', LOG_RING_SIZE - 1, F(", dropped since boot: "), eventLog.totalDropped);
+  } else if (parseWordThen(args, F("level"), parseLevel)) {
+    eventLog.level = level;
+    printLine(console, F("Log level "), logLevelName(level));
+  } else if (parseLogModule(args, module) && parseOnOff(args, on)) {
+    if (on) {
+      eventLog.modules |= 1 << module;
+    } else {
+      eventLog.modules &= ~(1 << module);
+    }
+    printLine(console, F("Logging for "), logModuleName(module), on ? F(" on") : F(" off"));
+  } else {
+    console.println(F("Usage: log, log level error|warn|info|debug or log traffic|motor|macro|config on|off"));
+    return false;
+  }
+  return true;
+}
+
+// Lower-case letters, digits and '_', at most MACRO_NAME_MAX of them
+bool parseMacroName(const char*& cursor, char* name) {
+  const char* p = skipSpaces(cursor);
+  uint8_t length = 0;
+  while (isalnum(*p) || *p == '_') {
+    if (length == MACRO_NAME_MAX) return false;
+    name[length++] = tolower(*p++);
+  }
+  name[length] = '\0';
+  if (length == 0 || !parseEnd(p)) return false;
+  cursor = p;
+  return true;
+}
+
+static int8_t hexDigit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  c = tolower(c);
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+static bool handleMacroData(const char* args) {
+  uint8_t bytes[SERIAL_LINE_MAX / 2];
+  uint8_t count = 0;
+  for (;;) {
+    args = skipSpaces(args);
+    if (parseEnd(args)) break;
+    int8_t high = hexDigit(args[0]);
+    int8_t low = high < 0 ? -1 : hexDigit(args[1]);
+    if (low < 0) {
+      console.println(F("Invalid hex data"));
+      return false;
+    }
+    bytes[count++] = high << 4 | low;
+    args += 2;
+  }
   
-  unsigned long totalTime = millis() - startTime;
-  Serial.println("Loop sequence completed!");
-  Serial.println("Total time: " + String(totalTime/1000.0) + " seconds");
+  if (appendMacroUpload(bytes, count)) {
+    printLine(console, F("Macro "), macroStore.image.header.length, F(" bytes"));
+    return true;
+  }
+  printLine(console, F("No upload open or over "), MACRO_CODE_MAX, F(" bytes"));
+  return false;
 }
 
-void handleHelpCommand(String args) {
+// Programs are uploaded as hex bytes between 'macro begin' and 'macro end'
+// (tools/macro_asm.py writes the lines) and run from flash or EEPROM
+bool handleMacroCommand(const char* args) {
+  char name[MACRO_NAME_MAX + 1];
+  auto parseName = [&](const char*& cursor) { return parseMacroName(cursor, name); };
+  if (parseEnd(args)) {
+    printMacros();
+  } else if (parseWordThen(args, F("run"), parseName)) {
+    uint8_t program = findMacro(name);
+    if (program != MACRO_NONE && startMacro(program)) {
+      printLine(console, F("Running macro "), name);
+      displayCommand(F("MACRO "), name);
+    } else {
+      printLine(console, F("No runnable macro "), name);
+      displayError(F("No macro"));
+      return false;
+    }
+  } else if (parseWordThen(args, F("stop"), parseEnd)) {
+    stopMacro(MACRO_USES_ALL);
+    console.println(F("Macro stopped"));
+  } else if (parseWordThen(args, F("begin"), parseName)) {
+    uint8_t program = findMacro(name);
+    if (program != MACRO_NONE && program < MACRO_STOCK_COUNT) {
+      console.println(F("Stock macros cannot be replaced"));
+      return false;
+    } else if (beginMacroUpload(name)) {
+      printLine(console, F("Uploading macro "), name);
+    } else {
+      console.println(F("Save in progress, try again"));
+      return false;
+    }
+  } else if (parseWord(args, F("data"))) {
+    return handleMacroData(args);
+  } else if (parseWordThen(args, F("end"), parseEnd)) {
+    if (endMacroUpload()) {
+      console.println(F("Saving macro"));
+    } else {
+      console.println(F("Macro rejected: no upload, invalid code or no free slot"));
+      return false;
+    }
+  } else if (parseWordThen(args, F("delete"), parseName)) {
+    if (deleteMacro(findMacro(name))) {
+      printLine(console, F("Deleted macro "), name);
+    } else {
+      printLine(console, F("Cannot delete macro "), name);
+      return false;
+    }
+  } else {
+    console.println(F("Usage: macro, macro run|delete name, macro stop, macro begin name, macro data hex or macro end"));
+    return false;
+  }
+  return true;
+}
+
+static bool parseTraceKind(const char*& cursor, uint8_t& kind) {
+  for (kind = 0; kind < TRACE_KIND_COUNT; kind++) {
+    const char* at = cursor;
+    if (parseWord(at, traceKindName(kind))) {
+      cursor = at;
+      return true;
+    }
+  }
+  return false;
+}
+
+// 'trace dump' output is meant for tools/trace2vcd.py
+bool handleTraceCommand(const char* args) {
+  uint8_t kind;
+  bool on;
+  auto parseArmKind = [&](const char*& cursor) { return parseTraceKind(cursor, kind) && parseEnd(cursor); };
+  if (parseEnd(args)) {
+    printTraceStatus();
+  } else if (parseWordThen(args, F("start"), parseEnd)) {
+    if (startTrace()) {
+      console.println(F("Trace recording"));
+    } else {
+      console.println(F("Trace dump in progress"));
+      return false;
+    }
+  } else if (parseWordThen(args, F("arm"), parseArmKind)) {
+    if (armTrace((TraceKind)kind)) {
+      printLine(console, F("Trace armed on "), traceKindName(kind));
+    } else {
+      console.println(F("Trace dump in progress"));
+      return false;
+    }
+  } else if (parseWordThen(args, F("stop"), parseEnd)) {
+    stopTrace();
+    printLine(console, F("Trace stopped, "), traceRecorder.count, F(" records"));
+  } else if (parseWordThen(args, F("dump"), parseEnd)) {
+    if (!startTraceDump()) {
+      console.println(F("Trace dump in progress"));
+      return false;
+    }
+  } else if (parseTraceKind(args, kind) && parseOnOff(args, on)) {
+    if (on) {
+      traceRecorder.kinds |= 1 << kind;
+    } else {
+      traceRecorder.kinds &= ~(1 << kind);
+    }
+    printLine(console, F("Tracing "), traceKindName(kind), on ? F(" on") : F(" off"));
+  } else {
+    console.println(F("Usage: trace, trace start|stop|dump, trace arm coil|lamp|cmd|lcd or trace coil|lamp|cmd|lcd on|off"));
+    return false;
+  }
+  return true;
+}
+
+// The suite runs loop() itself, which reads the console; a second bench
+// line arriving meanwhile must not start it again from inside
+bool handleBenchCommand(const char* args) {
+  if (benchmarkRunning() || benchmarkPending()) {
+    console.println(F("Benchmarks already running"));
+    return false;
+  }
+  console.println(F("Running benchmarks"));
+  requestBenchmarks();
+  return true;
+}
+
+bool handleBinaryCommand(const char* args) {
+  startBinaryProtocol();
+  return true;
+}
+
+bool handleHelpCommand(const char* args) {
   printHelp();
+  return true;
 }
 
-void processCommand(String input) {
-  input.trim();
-  input.toLowerCase();
-  
-  if (input.length() == 0) return;
-  
-  // Check for commands that start with a letter and have arguments
+CommandFunction commandFunction(const Command* command) {
+  return (CommandFunction)pgm_read_ptr(&command->function);
+}
+
+uint8_t commandOpcode(const Command* command) {
+  return pgm_read_byte(&command->opcode);
+}
+
+static CommandGroup commandGroup(const Command* command) {
+  CommandGroup group;
+  memcpy_P(&group, &command->group, sizeof(group));
+  return group;
+}
+
+// Case-insensitive prefix match in table order; args is set to the rest of
+// the input
+const Command* findCommand(const char* input, const char*& args) {
   for (int i = 0; i < COMMAND_COUNT; i++) {
-    String commandName = String(COMMAND_TABLE[i].name);
+    const char* name = (const char*)pgm_read_ptr(&COMMAND_TABLE[i].name);
+    const char* cursor = input;
     
-    if (commandName.length() == 1 && input.startsWith(commandName)) {
-      // Single letter command with arguments (f100, r50, s5)
-      String args = input.substring(1);
-      COMMAND_TABLE[i].function(args);
-      return;
-    } else if (input.startsWith(commandName)) {
-      // Multi-character command
-      String args = input.substring(commandName.length());
-      COMMAND_TABLE[i].function(args);
-      return;
+    char c;
+    while ((c = pgm_read_byte(name)) != '\0' && tolower(*cursor) == c) {
+      name++;
+      cursor++;
+    }
+    
+    if (c == '\0') {
+      args = cursor;
+      return &COMMAND_TABLE[i];
     }
   }
-  
-  Serial.println("Unknown command: " + input);
-  Serial.println("Type 'help' for available commands");
+  return NULL;
 }
 
-void printHelp() {
-  Serial.println("=== STEPPER MOTOR AND TRAFFIC LIGHT CONTROLLER ===");
-  Serial.println("=== MOTOR COMMANDS ===");
+const Command* findCommandByOpcode(uint8_t opcode) {
+  if (opcode == COMMAND_OPCODE_NONE) return NULL;
+  
   for (int i = 0; i < COMMAND_COUNT; i++) {
-    if (String(COMMAND_TABLE[i].name).startsWith("f") || 
-        String(COMMAND_TABLE[i].name).startsWith("r") || 
-        String(COMMAND_TABLE[i].name).startsWith("s") ||
-        String(COMMAND_TABLE[i].name) == "stop" ||
-        String(COMMAND_TABLE[i].name) == "demo") {
-      Serial.println(COMMAND_TABLE[i].description);
+    if (commandOpcode(&COMMAND_TABLE[i]) == opcode) {
+      return &COMMAND_TABLE[i];
     }
   }
+  return NULL;
+}
+
+void processCommand(const char* input) {
+  input = skipSpaces(input);
+  if (parseEnd(input)) return;
   
-  Serial.println();
-  Serial.println("=== TRAFFIC LIGHT COMMANDS ===");
+  const char* args;
+  const Command* command = findCommand(input, args);
+  if (command != NULL) {
+    traceEvent(TRACE_COMMAND, command - COMMAND_TABLE);
+    commandFunction(command)(args);
+    return;
+  }
+  
+  console.print(F("Unknown command: "));
+  console.println(input);
+  console.println(F("Type 'help' for available commands"));
+}
+
+void printCommandGroup(CommandGroup group) {
   for (int i = 0; i < COMMAND_COUNT; i++) {
-    if (String(COMMAND_TABLE[i].name) != "f" && 
-        String(COMMAND_TABLE[i].name) != "r" && 
-        String(COMMAND_TABLE[i].name) != "s" &&
-        String(COMMAND_TABLE[i].name) != "stop" &&
-        String(COMMAND_TABLE[i].name) != "demo" &&
-        String(COMMAND_TABLE[i].name) != "help") {
-      Serial.println(COMMAND_TABLE[i].description);
+    if (commandGroup(&COMMAND_TABLE[i]) == group) {
+      console.println(FPSTR(pgm_read_ptr(&COMMAND_TABLE[i].description)));
     }
   }
+}
+
+void printHelp() {
+  console.println(F("=== STEPPER MOTOR AND TRAFFIC LIGHT CONTROLLER ==="));
+  console.println(F("=== MOTOR COMMANDS ==="));
+  printCommandGroup(COMMAND_GROUP_MOTOR);
+  
+  console.println();
+  console.println(F("=== TRAFFIC LIGHT COMMANDS ==="));
+  printCommandGroup(COMMAND_GROUP_TRAFFIC);
   
-  Serial.println();
-  Serial.println("=== OTHER COMMANDS ===");
-  Serial.println("'help' - Show this help message");
-  Serial.println();
+  console.println();
+  console.println(F("=== OTHER COMMANDS ==="));
+  printCommandGroup(COMMAND_GROUP_OTHER);
+  console.println();
   printTrafficTiming();
 }
 
@@ -8,23 +8,82 @@
 #define MOTOR_IN3_PIN 10
 #define MOTOR_IN4_PIN 11
 
+// Extra ULN2003 axes for coordinated moves (m command); the motor above is
+// axis X. Y and Z share port A (PA0-PA7), A uses port C (PC7-PC4), so each
+// steps with a single port write.
+#define MOTION_AXIS_COUNT 2  // 2 to 4
+#define AXIS_Y_IN1_PIN 22
+#define AXIS_Y_IN2_PIN 23
+#define AXIS_Y_IN3_PIN 24
+#define AXIS_Y_IN4_PIN 25
+#define AXIS_Z_IN1_PIN 26
+#define AXIS_Z_IN2_PIN 27
+#define AXIS_Z_IN3_PIN 28
+#define AXIS_Z_IN4_PIN 29
+#define AXIS_A_IN1_PIN 30
+#define AXIS_A_IN2_PIN 31
+#define AXIS_A_IN3_PIN 32
+#define AXIS_A_IN4_PIN 33
+
 // Traffic light LED pins
 #define RED_LED_PIN 12
 #define YELLOW_LED_PIN 13
 #define GREEN_LED_PIN 7
 
+// Second signal head and pedestrian lamps, driven by phase programs in
+// lockstep with the lamps above
+#define HEAD_B_RED_PIN 34
+#define HEAD_B_YELLOW_PIN 35
+#define HEAD_B_GREEN_PIN 36
+#define WALK_PIN 37
+#define DONT_WALK_PIN 38
+
+// 74HC595 chain for the lamps when LAMP_SHIFT_REGISTERS > 0: SER on MOSI
+// (51), SRCLK on SCK (52), RCLK on this pin, which is SS and must stay an
+// output for the SPI to remain master
+#define LAMP_LATCH_PIN 53
+
 // I2C LCD configuration
 #define LCD_ADDRESS 0x27
 #define LCD_COLUMNS 20
 #define LCD_ROWS 4
+#define LCD_TWI_FREQUENCY_HZ 100000UL  // PCF8574 maximum
+#define LCD_TWI_QUEUE_SIZE 256  // power of two, at most 256
+#define LCD_TWI_CLEAR_PAD_BYTES ((2000UL * LCD_TWI_FREQUENCY_HZ) / (9UL * 1000000UL) + 1)  // 2 ms of bus time
+#define LCD_FLUSH_BYTES_PER_TICK 128
+#define LCD_REFRESH_INTERVAL_MS 500
+#define LCD_SPLASH_MS 5000
+#define LCD_ERROR_HOLD_MS 2000
 
 // ========== MOTOR CONSTANTS ==========
 #define MOTOR_STEPS_PER_REVOLUTION 8
+#define MICROSTEPS_PER_HALF_STEP 8
+#define DEFAULT_DRIVE_MODE DRIVE_HALF
 #define DEFAULT_STEP_DELAY_MS 2
 #define MIN_STEP_DELAY 1
 #define MAX_STEP_DELAY 20
 #define DEMO_STEPS 512
+#define DEMO_PAUSE_MS 1000
 #define LOOP_SEQUENCE_STEPS 10000
+#define LOOP_INTRO_MS 2000
+#define LOOP_OUTRO_MS 30000
+
+// ========== STEP TIMER CONSTANTS ==========
+// Timer3 runs in CTC mode with a /64 prescaler: 4us per tick at 16 MHz
+#define STEP_TIMER_PRESCALER 64
+#define STEP_TIMER_TICKS_PER_MS (F_CPU / STEP_TIMER_PRESCALER / 1000UL)
+
+// ========== MOTION PLANNER CONSTANTS ==========
+#define DEFAULT_ACCELERATION_SPS2 800
+#define MIN_ACCELERATION_SPS2 50
+#define MAX_ACCELERATION_SPS2 20000
+#define DEFAULT_MAX_SPEED_SPS (1000 / DEFAULT_STEP_DELAY_MS)
+#define MIN_MAX_SPEED_SPS (1000 / MAX_STEP_DELAY)
+#define MAX_MAX_SPEED_SPS 2000
+#define PLANNER_MAX_INTERVAL (0xFFFFUL << 8)
+#define MOTION_QUEUE_SIZE 8  // queued segments behind the running one, power of two
+#define MAX_MOVE_STEPS 100000L  // longest single move, goto distances included
+#define MAX_POSITION_STEPS 1000000L  // goto targets lie within +/- this many steps of zero
 
 // ========== TRAFFIC LIGHT CONSTANTS ==========
 #define DEFAULT_RED_TIME_MS 10000
@@ -36,9 +95,72 @@
 #define FLASH_DELAY_MS 300
 #define EMERGENCY_FLASH_DELAY_MS 500
 #define LIGHT_CIRCULATION_DELAY_MS 1000
+#define TRAFFIC_MAX_PHASES 12
+#define TRAFFIC_MIN_PHASE_MS 100
+
+// ========== LAMP OUTPUT CONSTANTS ==========
+// 0 drives one intersection from the lamp pins above. N > 0 drives N
+// intersections from a chain of N 74HC595s, one per intersection wired in
+// LAMP_* bit order (QA = head A red); the register next to the board is
+// intersection 0.
+#ifndef LAMP_SHIFT_REGISTERS
+#define LAMP_SHIFT_REGISTERS 0
+#endif
+#define TRAFFIC_INTERSECTIONS (LAMP_SHIFT_REGISTERS > 0 ? LAMP_SHIFT_REGISTERS : 1)
 
 // ========== SERIAL CONSTANTS ==========
 #define SERIAL_BAUD_RATE 9600
+#define SERIAL_INPUT_BUFFER_SIZE 128  // power of two, at most 256
+#define SERIAL_LINE_MAX 64
+#define SERIAL_LINE_IDLE_MS 50  // terminal sending without a line ending
+
+// ========== BINARY PROTOCOL CONSTANTS ==========
+#define PROTOCOL_BAUD_RATE 500000  // UBRR 3 with U2X at 16 MHz: no rate error
+#define PROTOCOL_FRAME_MAX 64      // encoded bytes per frame, without the 0x00
+
+// ========== SCHEDULER CONSTANTS ==========
+#define SCHEDULER_MAX_TASKS_PER_PASS 2
+
+// ========== IDLE SLEEP CONSTANTS ==========
+#define IDLE_SLEEP_ENABLED 1
+#define IDLE_MIN_SLEEP_MS 2    // shorter waits are not worth stopping the tick
+#define IDLE_MAX_SLEEP_MS 250  // Timer5 at clk/64 reaches 262 ms
+
+// ========== EVENT LOG CONSTANTS ==========
+#define LOG_RING_SIZE 16          // records, power of two, at most 256
+#define LOG_LINE_MAX 63           // bytes with CRLF; the AVR TX buffer holds 63
+#define LOG_DEFAULT_LEVEL LOG_LEVEL_INFO
+
+// ========== TRACE CONSTANTS ==========
+#define TRACE_RING_SIZE 128       // records of 6 bytes, power of two, at most 128
+#define TRACE_RECORDS_PER_LINE 4  // dump line "T " + 48 hex digits + CRLF
+
+// ========== CONFIG STORE CONSTANTS ==========
+#define CONFIG_EEPROM_SIZE 4096     // ATmega2560
+#define CONFIG_STORE_BASE 0
+#define CONFIG_STORE_SLOTS 16       // saves rotate through the slots to spread wear
+#define CONFIG_SLOT_SIZE 32
+#define CONFIG_SAVE_DELAY_MS 5000   // settings settle this long before a save
+#define CONFIG_BYTE_WRITE_MS 4      // EEPROM byte programming takes 3.4 ms
+
+// ========== MACRO CONSTANTS ==========
+#define MACRO_STORE_BASE 512        // after the config slots
+#define MACRO_STORE_SLOTS 8
+#define MACRO_SLOT_SIZE 128         // header and code
+#define MACRO_NAME_MAX 8
+#define MACRO_LOOP_DEPTH 4
+#define MACRO_OPS_PER_RUN 32        // instructions per scheduler run
+#define MACRO_POLL_MS 10            // AWAIT checks the motor this often
+
+// ========== RUNTIME STATS CONSTANTS ==========
+#define STATS_LOOP_BINS 16  // log2 bins; the last one collects 16 ms and up
+
+// ========== BENCHMARK CONSTANTS ==========
+#define BENCH_LOOP_PASSES 1000
+#define BENCH_STEP_ITERATIONS 1000
+#define BENCH_COMMAND_ROUNDS 50
+#define BENCH_LCD_REDRAWS 20
+#define BENCH_LAMP_LATCHES 1000
 
 // ========== ENUMS ==========
 enum MotorDirection {
@@ -58,16 +180,27 @@ enum LightColor {
   LIGHT_GREEN = 2
 };
 
+// Coil drive modes: one coil on, two coils on, alternating, and sine PWM
+// microstepping on axes whose coil pins are all PWM outputs
+enum DriveMode {
+  DRIVE_WAVE,
+  DRIVE_FULL,
+  DRIVE_HALF,
+  DRIVE_MICRO,
+  DRIVE_MODE_COUNT
+};
+
 // ========== MOTOR STEP SEQUENCE ==========
-const int MOTOR_STEP_SEQUENCE[MOTOR_STEPS_PER_REVOLUTION][4] = {
-  {1, 0, 0, 0},
-  {1, 1, 0, 0},
-  {0, 1, 0, 0},
-  {0, 1, 1, 0},
-  {0, 0, 1, 0},
-  {0, 0, 1, 1},
-  {0, 0, 0, 1},
-  {1, 0, 0, 1}
+// Half-step coil patterns, bit 0 = IN1 ... bit 3 = IN4
+constexpr uint8_t MOTOR_STEP_SEQUENCE[MOTOR_STEPS_PER_REVOLUTION] = {
+  0b0001,
+  0b0011,
+  0b0010,
+  0b0110,
+  0b0100,
+  0b1100,
+  0b1000,
+  0b1001
 };
 
 #endif // CONFIG_H
\ No newline at end of file
@@ -0,0 +1,312 @@
+#ifndef CONFIG_STORE_H
+#define CONFIG_STORE_H
+
+#include <Arduino.h>
+#include <stddef.h>
+#include "hal.h"
+#include "config.h"
+#include "console.h"
+#include "scheduler.h"
+#include "motor.h"
+#include "traffic_light.h"
+#include "event_log.h"
+
+// ========== CONFIG RECORD STRUCTURE ==========
+// The tuning that survives a reset. Records rotate through
+// CONFIG_STORE_SLOTS slots of EEPROM so each save lands on a different set
+// of cells; the valid record with the highest sequence is the current one.
+// A save torn by a brown-out fails its CRC and the previous record stays in
+// force.
+#define CONFIG_RECORD_VERSION 1
+#define CONFIG_SLOT_NONE 0xFF
+
+#define CONFIG_FLAG_AUTOSTART 0x01  // start the traffic cycle at boot
+#define CONFIG_FLAG_FAST_BOOT 0x02  // no splash screen at boot
+
+struct ConfigRecord {
+  uint8_t version;
+  uint8_t flags;
+  uint16_t sequence;
+  uint32_t redTime;
+  uint32_t yellowTime;
+  uint32_t greenTime;
+  uint16_t maxSpeed;
+  uint16_t acceleration;
+  uint8_t stepDelay;
+  uint8_t driveMode;
+  uint16_t crc;  // CRC-16/CCITT of every byte before it
+};
+
+static_assert(sizeof(ConfigRecord) <= CONFIG_SLOT_SIZE, "ConfigRecord does not fit in CONFIG_SLOT_SIZE");
+static_assert(CONFIG_STORE_BASE + CONFIG_STORE_SLOTS * CONFIG_SLOT_SIZE <= CONFIG_EEPROM_SIZE, "config slots run past the end of EEPROM");
+
+// ========== CONFIG STORE STATE STRUCTURE ==========
+// record and slot describe the newest record in EEPROM. A save copies the
+// live settings into pending and writes it into the next slot one byte per
+// scheduler run, skipping bytes that already match, so the main loop never
+// waits on the EEPROM. dirty is set by a change made while a save runs.
+struct ConfigStore {
+  ConfigRecord record;
+  uint8_t slot;
+  uint8_t flags;
+  ConfigRecord pending;
+  uint8_t pendingSlot;
+  uint8_t writeOffset;
+  bool writing;
+  bool dirty;
+  unsigned long loadMicros;
+};
+
+// ========== GLOBAL CONFIG STORE ==========
+extern ConfigStore configStore;
+
+// ========== CONFIG STORE FUNCTION DECLARATIONS ==========
+void loadStoredConfig();
+void applyStoredConfig();
+void captureConfig(ConfigRecord& record);
+bool configUnsaved();
+void configStoreMarkDirty();
+void saveConfigNow();
+void restoreDefaultConfig();
+void setConfigFlag(uint8_t flag, bool on);
+unsigned long runConfigSave();
+void printStoredConfig();
+uint16_t configRecordCrc(const ConfigRecord& record);
+
+// Byte access to the EEPROM; the write is only started on AVR and takes
+// CONFIG_BYTE_WRITE_MS to finish
+uint8_t configEepromRead(uint16_t address);
+void configEepromWrite(uint16_t address, uint8_t value);
+
+// ========== CONFIG STORE FUNCTION IMPLEMENTATIONS ==========
+
+static uint16_t configSlotAddress(uint8_t slot) {
+  return CONFIG_STORE_BASE + (uint16_t)slot * CONFIG_SLOT_SIZE;
+}
+
+uint16_t configRecordCrc(const ConfigRecord& record) {
+  const uint8_t* bytes = (const uint8_t*)&record;
+  uint16_t crc = 0xFFFF;
+  for (uint8_t i = 0; i < offsetof(ConfigRecord, crc); i++) {
+    crc ^= (uint16_t)bytes[i] << 8;
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+static bool readConfigSlot(uint8_t slot, ConfigRecord& record) {
+  uint8_t* bytes = (uint8_t*)&record;
+  uint16_t address = configSlotAddress(slot);
+  for (uint8_t i = 0; i < sizeof(ConfigRecord); i++) {
+    bytes[i] = configEepromRead(address + i);
+  }
+  return record.version == CONFIG_RECORD_VERSION && record.crc == configRecordCrc(record);
+}
+
+// Reads every slot once; sequence numbers wrap, so they are compared by
+// difference like scheduler deadlines
+void loadStoredConfig() {
+  unsigned long start = micros();
+  configStore.slot = CONFIG_SLOT_NONE;
+  configStore.flags = 0;
+  configStore.writing = false;
+  configStore.dirty = false;
+  
+  ConfigRecord record;
+  for (uint8_t slot = 0; slot < CONFIG_STORE_SLOTS; slot++) {
+    if (!readConfigSlot(slot, record)) continue;
+    if (configStore.slot == CONFIG_SLOT_NONE || (int16_t)(record.sequence - configStore.record.sequence) > 0) {
+      configStore.record = record;
+      configStore.slot = slot;
+    }
+  }
+  
+  if (configStore.slot != CONFIG_SLOT_NONE) {
+    configStore.flags = configStore.record.flags;
+  }
+  configStore.loadMicros = micros() - start;
+}
+
+// Goes through the command setters so a record from an older build with
+// out-of-range values cannot bypass their limits
+void applyStoredConfig() {
+  if (configStore.slot == CONFIG_SLOT_NONE) return;
+  
+  const ConfigRecord& record = configStore.record;
+  setMotorSpeed(record.stepDelay);
+  setMotorMaxSpeed(record.maxSpeed);
+  setMotorAcceleration(record.acceleration);
+  if (record.driveMode < DRIVE_MODE_COUNT) {
+    setMotorDriveMode((DriveMode)record.driveMode);
+  }
+  setTrafficTiming(record.redTime, record.yellowTime, record.greenTime);
+  
+  if ((configStore.flags & CONFIG_FLAG_AUTOSTART) && !trafficLight.isRunning) {
+    toggleTrafficLightCycle();
+  }
+}
+
+void captureConfig(ConfigRecord& record) {
+  memset(&record, 0, sizeof(record));
+  record.version = CONFIG_RECORD_VERSION;
+  record.flags = configStore.flags;
+  record.redTime = trafficLight.redTime;
+  record.yellowTime = trafficLight.yellowTime;
+  record.greenTime = trafficLight.greenTime;
+  record.maxSpeed = motorState.maxSpeed;
+  record.acceleration = motorState.acceleration;
+  record.stepDelay = motorState.stepDelay;
+  record.driveMode = coilDrive.mode;
+}
+
+// Whether the live settings differ from the newest record
+bool configUnsaved() {
+  if (configStore.slot == CONFIG_SLOT_NONE) return true;
+  
+  ConfigRecord live;
+  captureConfig(live);
+  live.sequence = configStore.record.sequence;
+  live.crc = configStore.record.crc;
+  return memcmp(&live, &configStore.record, sizeof(ConfigRecord)) != 0;
+}
+
+// Changes settle for CONFIG_SAVE_DELAY_MS before they are written, so a
+// burst of commands costs one slot
+void configStoreMarkDirty() {
+  if (configStore.writing) {
+    configStore.dirty = true;
+  } else {
+    scheduleTask(TASK_CONFIG_SAVE, runConfigSave, CONFIG_SAVE_DELAY_MS);
+  }
+}
+
+void saveConfigNow() {
+  if (configStore.writing) {
+    configStore.dirty = true;
+  } else {
+    scheduleTask(TASK_CONFIG_SAVE, runConfigSave, 0);
+  }
+}
+
+void restoreDefaultConfig() {
+  configStore.flags = 0;
+  setMotorSpeed(DEFAULT_STEP_DELAY_MS);
+  setMotorMaxSpeed(DEFAULT_MAX_SPEED_SPS);
+  setMotorAcceleration(DEFAULT_ACCELERATION_SPS2);
+  setMotorDriveMode(DEFAULT_DRIVE_MODE);
+  setTrafficTiming(DEFAULT_RED_TIME_MS, DEFAULT_YELLOW_TIME_MS, DEFAULT_GREEN_TIME_MS);
+  configStoreMarkDirty();
+}
+
+void setConfigFlag(uint8_t flag, bool on) {
+  if (on) {
+    configStore.flags |= flag;
+  } else {
+    configStore.flags &= ~flag;
+  }
+  configStoreMarkDirty();
+}
+
+// Scheduler task: starts a save when the live settings differ from the
+// newest record, then programs one changed byte per run
+unsigned long runConfigSave() {
+  if (!configStore.writing) {
+    if (!configUnsaved()) return TASK_DONE;
+    
+    ConfigRecord& pending = configStore.pending;
+    captureConfig(pending);
+    if (configStore.slot != CONFIG_SLOT_NONE) {
+      pending.sequence = configStore.record.sequence + 1;
+      configStore.pendingSlot = (configStore.slot + 1) % CONFIG_STORE_SLOTS;
+    } else {
+      pending.sequence = 0;
+      configStore.pendingSlot = 0;
+    }
+    pending.crc = configRecordCrc(pending);
+    configStore.writeOffset = 0;
+    configStore.writing = true;
+    configStore.dirty = false;
+  }
+  
+  const uint8_t* bytes = (const uint8_t*)&configStore.pending;
+  uint16_t address = configSlotAddress(configStore.pendingSlot);
+  while (configStore.writeOffset < sizeof(ConfigRecord)) {
+    uint8_t i = configStore.writeOffset++;
+    if (configEepromRead(address + i) != bytes[i]) {
+      configEepromWrite(address + i, bytes[i]);
+      return CONFIG_BYTE_WRITE_MS;
+    }
+  }
+  
+  configStore.writing = false;
+  ConfigRecord written;
+  if (readConfigSlot(configStore.pendingSlot, written) && written.sequence == configStore.pending.sequence) {
+    configStore.record = written;
+    configStore.slot = configStore.pendingSlot;
+    logEvent(LOG_CONFIG_SAVED, configStore.slot);
+  } else {
+    logEvent(LOG_CONFIG_SAVE_FAILED);
+  }
+  return configStore.dirty ? CONFIG_SAVE_DELAY_MS : TASK_DONE;
+}
+
+void printStoredConfig() {
+  if (configStore.slot == CONFIG_SLOT_NONE) {
+    console.println(F("Config: nothing stored, defaults in use"));
+  } else {
+    const ConfigRecord& record = configStore.record;
+    printLine(console, F("Config: slot "), configStore.slot, F(" of "), CONFIG_STORE_SLOTS, F(", save #"), record.sequence, F(", loaded in "), configStore.loadMicros, F(" us"));
+    printLine(console, F("Stored: s"), record.stepDelay, F(" vmax"), record.maxSpeed, F(" accel"), record.acceleration, F(" timing"), record.redTime, ',', record.yellowTime, ',', record.greenTime);
+  }
+  printLine(console, F("Auto-start: "), configStore.flags & CONFIG_FLAG_AUTOSTART ? F("on") : F("off"), F(", fast boot: "), configStore.flags & CONFIG_FLAG_FAST_BOOT ? F("on") : F("off"));
+  if (configStore.writing || isTaskScheduled(TASK_CONFIG_SAVE)) {
+    console.println(F("Save pending"));
+  } else if (configStore.slot != CONFIG_SLOT_NONE && configUnsaved()) {
+    console.println(F("Unsaved changes ('config save' stores them)"));
+  }
+}
+
+#if defined(HAL_TARGET_AVR)
+
+#include <avr/eeprom.h>
+
+uint8_t configEepromRead(uint16_t address) {
+  return eeprom_read_byte((const uint8_t*)address);
+}
+
+// eeprom_write_byte() only waits for a previous write, which the task's
+// pacing has already let finish
+void configEepromWrite(uint16_t address, uint8_t value) {
+  eeprom_write_byte((uint8_t*)address, value);
+}
+
+#elif defined(HAL_TARGET_SIM)
+
+uint8_t configEepromRead(uint16_t address) {
+  return simEepromRead(address);
+}
+
+void configEepromWrite(uint16_t address, uint8_t value) {
+  simEepromWrite(address, value);
+}
+
+#else
+
+// Erased EEPROM for hosts without a simulated board
+static uint8_t configEepromFake[CONFIG_EEPROM_SIZE];
+
+uint8_t configEepromRead(uint16_t address) {
+  return address < CONFIG_EEPROM_SIZE ? configEepromFake[address] : 0xFF;
+}
+
+void configEepromWrite(uint16_t address, uint8_t value) {
+  if (address < CONFIG_EEPROM_SIZE) {
+    configEepromFake[address] = value;
+  }
+}
+
+#endif
+
+#endif // CONFIG_STORE_H
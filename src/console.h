@@ -0,0 +1,97 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include <Arduino.h>
+
+// ========== CONSOLE OUTPUT CLASS ==========
+// Human-readable replies go through console instead of Serial, so they can
+// be muted while the UART carries binary protocol frames
+class ConsoleOutput : public Print {
+ public:
+  ConsoleOutput() : muted(false) {}
+  
+  virtual size_t write(uint8_t value) {
+    return muted ? 1 : Serial.write(value);
+  }
+  using Print::write;
+  
+  void mute(bool on) { muted = on; }
+  bool isMuted() const { return muted; }
+ 
+ private:
+  bool muted;
+};
+
+// ========== GLOBAL CONSOLE ==========
+extern ConsoleOutput console;
+
+// ========== FORMATTED OUTPUT ==========
+// printLine(console, F("Speed set to "), speed) prints each item with the
+// Print overload for its type, straight to the stream: nothing is built in
+// RAM and nothing touches the heap. Constant text stays in flash behind F(),
+// or FPSTR() for a PROGMEM string that is not a literal; Fixed prints a
+// scaled integer such as tenths of a percent.
+#ifndef FPSTR
+#define FPSTR(pstr) (reinterpret_cast<const __FlashStringHelper*>(pstr))
+#endif
+
+struct Fixed {
+  long value;
+  uint8_t decimals;
+};
+
+inline Fixed fixed(long value, uint8_t decimals) {
+  Fixed number = {value, decimals};
+  return number;
+}
+
+size_t printFixed(Print& out, long value, uint8_t decimals);
+
+inline void printItem(Print& out, const Fixed& number) {
+  printFixed(out, number.value, number.decimals);
+}
+
+template<typename T>
+inline void printItem(Print& out, T value) {
+  out.print(value);
+}
+
+inline void printItems(Print& out) {
+}
+
+template<typename T, typename... Rest>
+void printItems(Print& out, T first, Rest... rest) {
+  printItem(out, first);
+  printItems(out, rest...);
+}
+
+template<typename... Items>
+void printLine(Print& out, Items... items) {
+  printItems(out, items...);
+  out.println();
+}
+
+// value / 10^decimals with every decimal printed, e.g. (-5, 1) is "-0.5"
+size_t printFixed(Print& out, long value, uint8_t decimals) {
+  unsigned long magnitude = value < 0 ? -(unsigned long)value : value;
+  unsigned long scale = 1;
+  for (uint8_t i = 0; i < decimals; i++) {
+    scale *= 10;
+  }
+  
+  size_t length = 0;
+  if (value < 0) {
+    length += out.print('-');
+  }
+  length += out.print(magnitude / scale);
+  if (decimals > 0) {
+    length += out.print('.');
+    unsigned long fraction = magnitude % scale;
+    for (scale /= 10; scale > 0; scale /= 10) {
+      length += out.print((char)('0' + fraction / scale % 10));
+    }
+  }
+  return length;
+}
+
+#endif // CONSOLE_H
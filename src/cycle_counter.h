@@ -0,0 +1,93 @@
+#ifndef CYCLE_COUNTER_H
+#define CYCLE_COUNTER_H
+
+#include <Arduino.h>
+#include "hal.h"
+
+// ========== CYCLE COUNTER FUNCTION DECLARATIONS ==========
+// Free-running counter for timing short code paths. Only runs between
+// cycleCounterStart() and cycleCounterStop(); CYCLE_COUNTER_UNIT names what
+// one count is on the current target.
+void cycleCounterStart();
+void cycleCounterStop();
+uint32_t cycleCounterRead();
+
+// ========== CYCLE COUNTER FUNCTION IMPLEMENTATIONS ==========
+#if defined(HAL_TARGET_AVR)
+
+#include <avr/interrupt.h>
+
+#define CYCLE_COUNTER_UNIT "cycles"
+
+// Timer5 is otherwise unused; it counts CPU clocks and the overflow
+// interrupt extends it to 32 bits
+static volatile uint16_t cycleCounterOverflows;
+
+ISR(TIMER5_OVF_vect) {
+  cycleCounterOverflows++;
+}
+
+void cycleCounterStart() {
+  uint8_t oldSREG = SREG;
+  cli();
+  TCCR5A = 0;
+  TCCR5B = 0;
+  TCNT5 = 0;
+  cycleCounterOverflows = 0;
+  TIFR5 = _BV(TOV5);
+  TIMSK5 = _BV(TOIE5);
+  TCCR5B = _BV(CS50);
+  SREG = oldSREG;
+}
+
+void cycleCounterStop() {
+  TCCR5B = 0;
+  TIMSK5 = 0;
+}
+
+uint32_t cycleCounterRead() {
+  uint8_t oldSREG = SREG;
+  cli();
+  uint16_t low = TCNT5;
+  uint16_t high = cycleCounterOverflows;
+  // An overflow that has not been serviced yet belongs to this reading
+  if ((TIFR5 & _BV(TOV5)) && low < 0x8000) {
+    high++;
+  }
+  SREG = oldSREG;
+  return ((uint32_t)high << 16) | low;
+}
+
+#elif defined(HAL_TARGET_SIM)
+
+#define CYCLE_COUNTER_UNIT "ns"
+
+// Virtual time stands still while firmware code runs, so the simulator
+// measures with the host's monotonic clock instead
+void cycleCounterStart() {
+}
+
+void cycleCounterStop() {
+}
+
+uint32_t cycleCounterRead() {
+  return simHostNanos();
+}
+
+#else
+
+#define CYCLE_COUNTER_UNIT "us"
+
+void cycleCounterStart() {
+}
+
+void cycleCounterStop() {
+}
+
+uint32_t cycleCounterRead() {
+  return micros();
+}
+
+#endif
+
+#endif // CYCLE_COUNTER_H
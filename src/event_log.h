@@ -0,0 +1,291 @@
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "console.h"
+
+// ========== LOG EVENTS ==========
+// Background code (scheduler tasks, the traffic cycle, config saves) reports
+// through logEvent() instead of printing. A record is a few bytes pushed
+// into a ring; logService() turns records into text at the end of a loop()
+// pass and only writes a line when it fits in the UART transmit buffer, so
+// a slow console never holds up the code that logged. Replies to commands
+// still go straight to console.
+enum LogLevel {
+  LOG_LEVEL_ERROR,
+  LOG_LEVEL_WARN,
+  LOG_LEVEL_INFO,
+  LOG_LEVEL_DEBUG,
+  LOG_LEVEL_COUNT
+};
+
+enum LogModule {
+  LOG_MODULE_TRAFFIC,
+  LOG_MODULE_MOTOR,
+  LOG_MODULE_MACRO,
+  LOG_MODULE_CONFIG,
+  LOG_MODULE_COUNT
+};
+
+#define LOG_ALL_MODULES ((1 << LOG_MODULE_COUNT) - 1)
+
+// Arguments of each event are listed with it
+enum LogEvent {
+  LOG_TRAFFIC_PHASE,     // lamps before, lamps after
+  LOG_TRAFFIC_LATE,      // ms late
+  LOG_DEMO_REVERSE,      // steps
+  LOG_LOOP_LIGHT,        // LightColor, steps completed
+  LOG_MACRO_DONE,        // program, ms taken
+  LOG_MACRO_SAVED,       // program
+  LOG_MACRO_SAVE_FAILED, // program
+  LOG_CONFIG_SAVED,      // slot
+  LOG_CONFIG_SAVE_FAILED,
+  LOG_EVENT_COUNT
+};
+
+struct LogEventInfo {
+  uint8_t module;
+  uint8_t level;
+};
+
+const LogEventInfo LOG_EVENT_INFO[LOG_EVENT_COUNT] PROGMEM = {
+  {LOG_MODULE_TRAFFIC, LOG_LEVEL_INFO},   // LOG_TRAFFIC_PHASE
+  {LOG_MODULE_TRAFFIC, LOG_LEVEL_DEBUG},  // LOG_TRAFFIC_LATE
+  {LOG_MODULE_MOTOR, LOG_LEVEL_INFO},     // LOG_DEMO_REVERSE
+  {LOG_MODULE_MACRO, LOG_LEVEL_INFO},     // LOG_LOOP_LIGHT
+  {LOG_MODULE_MACRO, LOG_LEVEL_INFO},     // LOG_MACRO_DONE
+  {LOG_MODULE_MACRO, LOG_LEVEL_INFO},     // LOG_MACRO_SAVED
+  {LOG_MODULE_MACRO, LOG_LEVEL_ERROR},    // LOG_MACRO_SAVE_FAILED
+  {LOG_MODULE_CONFIG, LOG_LEVEL_INFO},    // LOG_CONFIG_SAVED
+  {LOG_MODULE_CONFIG, LOG_LEVEL_ERROR}    // LOG_CONFIG_SAVE_FAILED
+};
+
+const char LOG_LEVEL_NAME_ERROR[] PROGMEM = "error";
+const char LOG_LEVEL_NAME_WARN[] PROGMEM = "warn";
+const char LOG_LEVEL_NAME_INFO[] PROGMEM = "info";
+const char LOG_LEVEL_NAME_DEBUG[] PROGMEM = "debug";
+const char* const LOG_LEVEL_NAMES[LOG_LEVEL_COUNT] PROGMEM = {
+  LOG_LEVEL_NAME_ERROR, LOG_LEVEL_NAME_WARN, LOG_LEVEL_NAME_INFO, LOG_LEVEL_NAME_DEBUG
+};
+
+const char LOG_MODULE_NAME_TRAFFIC[] PROGMEM = "traffic";
+const char LOG_MODULE_NAME_MOTOR[] PROGMEM = "motor";
+const char LOG_MODULE_NAME_MACRO[] PROGMEM = "macro";
+const char LOG_MODULE_NAME_CONFIG[] PROGMEM = "config";
+const char* const LOG_MODULE_NAMES[LOG_MODULE_COUNT] PROGMEM = {
+  LOG_MODULE_NAME_TRAFFIC, LOG_MODULE_NAME_MOTOR, LOG_MODULE_NAME_MACRO, LOG_MODULE_NAME_CONFIG
+};
+
+// ========== EVENT LOG STATE STRUCTURE ==========
+// The ring has one writer (logEvent) and one reader (logService), each
+// moving only its own single-byte index, so neither side masks interrupts.
+// line holds the text of the record being sent until the UART has room
+// for all of it; a line is never split, so direct console output cannot
+// land in the middle of one. dropped counts records lost to a full ring
+// since the last report and totalDropped since boot.
+struct LogRecord {
+  uint8_t event;
+  unsigned long timestamp;
+  long args[2];
+};
+
+struct EventLogState {
+  LogRecord ring[LOG_RING_SIZE];
+  volatile uint8_t head;
+  volatile uint8_t tail;
+  uint8_t level;
+  uint8_t modules;
+  uint16_t dropped;
+  unsigned long totalDropped;
+  char line[LOG_LINE_MAX + 1];
+  uint8_t lineLength;
+};
+
+// ========== GLOBAL EVENT LOG STATE ==========
+extern EventLogState eventLog;
+
+// ========== EVENT LOG FUNCTION DECLARATIONS ==========
+void initializeEventLog();
+bool logEnabled(LogEvent event);
+void logEvent(LogEvent event, long arg0 = 0, long arg1 = 0);
+void logService();
+bool logPending();
+uint8_t logQueued();
+void printLogRecord(Print& out, const LogRecord& record);
+const __FlashStringHelper* logLevelName(uint8_t level);
+const __FlashStringHelper* logModuleName(uint8_t module);
+
+// Implemented in traffic_light.h and macro_vm.h
+void formatTrafficPhase(uint8_t lamps, char* text);
+void printMacroName(Print& out, uint8_t program);
+
+// ========== LOG LINE BUFFER ==========
+// Print target for the text of one record; what does not fit in front of
+// the line ending is cut
+class LogLineBuffer : public Print {
+ public:
+  LogLineBuffer(char* text) : text(text), length(0) {}
+  
+  virtual size_t write(uint8_t value) {
+    if (length >= LOG_LINE_MAX - 2) return 0;
+    text[length++] = value;
+    return 1;
+  }
+  using Print::write;
+  
+  uint8_t endLine() {
+    text[length++] = '\r';
+    text[length++] = '\n';
+    return length;
+  }
+ 
+ private:
+  char* text;
+  uint8_t length;
+};
+
+// ========== EVENT LOG FUNCTION IMPLEMENTATIONS ==========
+
+void initializeEventLog() {
+  eventLog.head = 0;
+  eventLog.tail = 0;
+  eventLog.level = LOG_DEFAULT_LEVEL;
+  eventLog.modules = LOG_ALL_MODULES;
+  eventLog.dropped = 0;
+  eventLog.totalDropped = 0;
+  eventLog.lineLength = 0;
+}
+
+bool logEnabled(LogEvent event) {
+  uint8_t module = pgm_read_byte(&LOG_EVENT_INFO[event].module);
+  uint8_t level = pgm_read_byte(&LOG_EVENT_INFO[event].level);
+  return level <= eventLog.level && (eventLog.modules & (1 << module));
+}
+
+// Filtered here rather than in logService() so disabled events never take
+// a slot
+void logEvent(LogEvent event, long arg0, long arg1) {
+  if (!logEnabled(event)) return;
+  
+  uint8_t head = eventLog.head;
+  uint8_t next = (head + 1) & (LOG_RING_SIZE - 1);
+  if (next == eventLog.tail) {
+    if (eventLog.dropped != 0xFFFF) {
+      eventLog.dropped++;
+    }
+    eventLog.totalDropped++;
+    return;
+  }
+  
+  LogRecord& record = eventLog.ring[head];
+  record.event = event;
+  record.timestamp = millis();
+  record.args[0] = arg0;
+  record.args[1] = arg1;
+  eventLog.head = next;
+}
+
+uint8_t logQueued() {
+  return (eventLog.head - eventLog.tail) & (LOG_RING_SIZE - 1);
+}
+
+bool logPending() {
+  return eventLog.lineLength > 0 || eventLog.head != eventLog.tail || eventLog.dropped > 0;
+}
+
+// Formats the next record into line; the drop count is reported once the
+// records logged before the drops have gone out
+static void logFormatNext() {
+  LogLineBuffer buffer(eventLog.line);
+  if (eventLog.head == eventLog.tail) {
+    printItems(buffer, F("[log] "), eventLog.dropped, F(" records dropped"));
+    eventLog.dropped = 0;
+  } else {
+    const LogRecord& record = eventLog.ring[eventLog.tail];
+    printItems(buffer, '[', fixed(record.timestamp, 3), F("] "));
+    printLogRecord(buffer, record);
+    eventLog.tail = (eventLog.tail + 1) & (LOG_RING_SIZE - 1);
+  }
+  eventLog.lineLength = buffer.endLine();
+}
+
+// Called at the end of each loop() pass: sends whole lines while the UART
+// has room for them and returns as soon as it does not
+void logService() {
+  for (;;) {
+    if (eventLog.lineLength == 0) {
+      if (eventLog.head == eventLog.tail && eventLog.dropped == 0) return;
+      logFormatNext();
+    }
+    
+    // Records logged while the binary protocol owns the port are dropped
+    // here, as the console itself would drop them
+    if (!console.isMuted() && Serial.availableForWrite() < eventLog.lineLength) return;
+    console.write((const uint8_t*)eventLog.line, eventLog.lineLength);
+    eventLog.lineLength = 0;
+  }
+}
+
+const __FlashStringHelper* logLevelName(uint8_t level) {
+  return FPSTR(pgm_read_ptr(&LOG_LEVEL_NAMES[level]));
+}
+
+const __FlashStringHelper* logModuleName(uint8_t module) {
+  return FPSTR(pgm_read_ptr(&LOG_MODULE_NAMES[module]));
+}
+
+void printLogRecord(Print& out, const LogRecord& record) {
+  const long* args = record.args;
+  switch (record.event) {
+    case LOG_TRAFFIC_PHASE: {
+      char from[12];
+      char to[12];
+      formatTrafficPhase(args[0], from);
+      formatTrafficPhase(args[1], to);
+      printItems(out, F("Traffic: "), from, F(" -> "), to);
+      break;
+    }
+    
+    case LOG_TRAFFIC_LATE:
+      printItems(out, F("Traffic phase "), args[0], F(" ms late"));
+      break;
+    
+    case LOG_DEMO_REVERSE:
+      printItems(out, F("Counter-clockwise "), args[0], F(" steps"));
+      break;
+    
+    case LOG_LOOP_LIGHT: {
+      // LightColor order: red, yellow, green
+      const __FlashStringHelper* light = args[0] == 0 ? F("RED") : args[0] == 1 ? F("YELLOW") : F("GREEN");
+      printItems(out, F("Switching to "), light, F(" light - Steps completed: "), args[1]);
+      break;
+    }
+    
+    case LOG_MACRO_DONE:
+      printItems(out, F("Macro "));
+      printMacroName(out, args[0]);
+      printItems(out, F(" completed in "), fixed(args[1] / 10, 2), F(" seconds"));
+      break;
+    
+    case LOG_MACRO_SAVED:
+      printItems(out, F("Macro "));
+      printMacroName(out, args[0]);
+      printItems(out, F(" saved"));
+      break;
+    
+    case LOG_MACRO_SAVE_FAILED:
+      printItems(out, F("Macro save failed: EEPROM readback mismatch"));
+      break;
+    
+    case LOG_CONFIG_SAVED:
+      printItems(out, F("Config saved to slot "), args[0]);
+      break;
+    
+    case LOG_CONFIG_SAVE_FAILED:
+      printItems(out, F("Config save failed: EEPROM readback mismatch"));
+      break;
+  }
+}
+
+#endif // EVENT_LOG_H
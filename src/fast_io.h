@@ -0,0 +1,148 @@
+#ifndef FAST_IO_H
+#define FAST_IO_H
+
+#include <Arduino.h>
+#include "hal.h"
+
+// ========== PORT IDENTIFIERS ==========
+enum PortId {
+  PORT_ID_A = 0,
+  PORT_ID_B = 1,
+  PORT_ID_C = 2,
+  PORT_ID_D = 3,
+  PORT_ID_E = 4,
+  PORT_ID_F = 5,
+  PORT_ID_G = 6,
+  PORT_ID_H = 7,
+  PORT_ID_J = 8,
+  PORT_ID_K = 9,
+  PORT_ID_L = 10
+};
+
+// ========== MEGA 2560 PIN MAP ==========
+// Same mapping as the core's pins_arduino.h, but usable in constant
+// expressions so port masks can be computed by the compiler
+#define MEGA_PIN_COUNT 70
+
+constexpr uint8_t MEGA_PIN_PORT[MEGA_PIN_COUNT] = {
+  PORT_ID_E, PORT_ID_E, PORT_ID_E, PORT_ID_E, PORT_ID_G, PORT_ID_E, PORT_ID_H, PORT_ID_H,  //  0-7
+  PORT_ID_H, PORT_ID_H, PORT_ID_B, PORT_ID_B, PORT_ID_B, PORT_ID_B, PORT_ID_J, PORT_ID_J,  //  8-15
+  PORT_ID_H, PORT_ID_H, PORT_ID_D, PORT_ID_D, PORT_ID_D, PORT_ID_D, PORT_ID_A, PORT_ID_A,  // 16-23
+  PORT_ID_A, PORT_ID_A, PORT_ID_A, PORT_ID_A, PORT_ID_A, PORT_ID_A, PORT_ID_C, PORT_ID_C,  // 24-31
+  PORT_ID_C, PORT_ID_C, PORT_ID_C, PORT_ID_C, PORT_ID_C, PORT_ID_C, PORT_ID_D, PORT_ID_G,  // 32-39
+  PORT_ID_G, PORT_ID_G, PORT_ID_L, PORT_ID_L, PORT_ID_L, PORT_ID_L, PORT_ID_L, PORT_ID_L,  // 40-47
+  PORT_ID_L, PORT_ID_L, PORT_ID_B, PORT_ID_B, PORT_ID_B, PORT_ID_B, PORT_ID_F, PORT_ID_F,  // 48-55
+  PORT_ID_F, PORT_ID_F, PORT_ID_F, PORT_ID_F, PORT_ID_F, PORT_ID_F, PORT_ID_K, PORT_ID_K,  // 56-63
+  PORT_ID_K, PORT_ID_K, PORT_ID_K, PORT_ID_K, PORT_ID_K, PORT_ID_K                         // 64-69
+};
+
+constexpr uint8_t MEGA_PIN_BIT[MEGA_PIN_COUNT] = {
+  0, 1, 4, 5, 5, 3, 3, 4,  //  0-7
+  5, 6, 4, 5, 6, 7, 1, 0,  //  8-15
+  1, 0, 3, 2, 1, 0, 0, 1,  // 16-23
+  2, 3, 4, 5, 6, 7, 7, 6,  // 24-31
+  5, 4, 3, 2, 1, 0, 7, 2,  // 32-39
+  1, 0, 7, 6, 5, 4, 3, 2,  // 40-47
+  1, 0, 3, 2, 1, 0, 0, 1,  // 48-55
+  2, 3, 4, 5, 6, 7, 0, 1,  // 56-63
+  2, 3, 4, 5, 6, 7         // 64-69
+};
+
+constexpr uint8_t pinPort(uint8_t pin) {
+  return MEGA_PIN_PORT[pin];
+}
+
+constexpr uint8_t pinMask(uint8_t pin) {
+  return 1 << MEGA_PIN_BIT[pin];
+}
+
+// ========== PORT REGISTER ACCESS ==========
+#if defined(HAL_TARGET_AVR)
+
+template <uint8_t Port> struct PortRegister;
+
+#define DEFINE_PORT_REGISTER(id, reg) \
+  template <> struct PortRegister<id> { \
+    static volatile uint8_t& out() { return reg; } \
+  }
+
+DEFINE_PORT_REGISTER(PORT_ID_A, PORTA);
+DEFINE_PORT_REGISTER(PORT_ID_B, PORTB);
+DEFINE_PORT_REGISTER(PORT_ID_C, PORTC);
+DEFINE_PORT_REGISTER(PORT_ID_D, PORTD);
+DEFINE_PORT_REGISTER(PORT_ID_E, PORTE);
+DEFINE_PORT_REGISTER(PORT_ID_F, PORTF);
+DEFINE_PORT_REGISTER(PORT_ID_G, PORTG);
+DEFINE_PORT_REGISTER(PORT_ID_H, PORTH);
+DEFINE_PORT_REGISTER(PORT_ID_J, PORTJ);
+DEFINE_PORT_REGISTER(PORT_ID_K, PORTK);
+DEFINE_PORT_REGISTER(PORT_ID_L, PORTL);
+
+// Replace the bits of Mask on Port with bits. Callers must hold interrupts
+// off: ports above 0x5F (H, J, K, L) are not bit-addressable.
+template <uint8_t Port, uint8_t Mask>
+inline void writePortBits(uint8_t bits) {
+  volatile uint8_t& reg = PortRegister<Port>::out();
+  reg = (reg & (uint8_t)~Mask) | bits;
+}
+
+#endif
+
+// ========== PWM COMPARE CHANNELS ==========
+// Timer outputs usable for coil PWM. Timer0 runs millis(), Timer3 is the
+// step timer and Timer5 the cycle counter, which leaves OC1A/B (pins 11,
+// 12), OC2A/B (10, 9) and OC4A/B/C (6, 7, 8). pwmTimersBegin() runs those
+// timers in 8-bit phase-correct mode at clk/1, 31 kHz, above hearing.
+// connect() hands a pin to its compare unit or back to the port register.
+constexpr bool pinHasCoilPwm(uint8_t pin) {
+  return pin >= 6 && pin <= 12;
+}
+
+#if defined(HAL_TARGET_AVR)
+
+template <uint8_t Pin> struct PwmChannel {
+  static const bool AVAILABLE = false;
+  static void write(uint8_t duty) {}
+  static void connect(bool on) {}
+};
+
+#define DEFINE_PWM_CHANNEL(pin, ocr, tccr, com) \
+  template <> struct PwmChannel<pin> { \
+    static const bool AVAILABLE = true; \
+    static void write(uint8_t duty) { ocr = duty; } \
+    static void connect(bool on) { if (on) tccr |= _BV(com); else tccr &= ~_BV(com); } \
+  }
+
+DEFINE_PWM_CHANNEL(6, OCR4A, TCCR4A, COM4A1);
+DEFINE_PWM_CHANNEL(7, OCR4B, TCCR4A, COM4B1);
+DEFINE_PWM_CHANNEL(8, OCR4C, TCCR4A, COM4C1);
+DEFINE_PWM_CHANNEL(9, OCR2B, TCCR2A, COM2B1);
+DEFINE_PWM_CHANNEL(10, OCR2A, TCCR2A, COM2A1);
+DEFINE_PWM_CHANNEL(11, OCR1A, TCCR1A, COM1A1);
+DEFINE_PWM_CHANNEL(12, OCR1B, TCCR1A, COM1B1);
+
+inline void pwmTimersBegin() {
+  TCCR1A = _BV(WGM10);
+  TCCR1B = _BV(CS10);
+  TCCR2A = _BV(WGM20);
+  TCCR2B = _BV(CS20);
+  TCCR4A = _BV(WGM40);
+  TCCR4B = _BV(CS40);
+}
+
+#else
+
+// Off target the duty goes through analogWrite(); connect() has nothing to
+// switch because the next write sets the pin either way
+template <uint8_t Pin> struct PwmChannel {
+  static const bool AVAILABLE = pinHasCoilPwm(Pin);
+  static void write(uint8_t duty) { analogWrite(Pin, duty); }
+  static void connect(bool on) {}
+};
+
+inline void pwmTimersBegin() {
+}
+
+#endif
+
+#endif // FAST_IO_H
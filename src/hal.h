@@ -0,0 +1,21 @@
+#ifndef HAL_H
+#define HAL_H
+
+#include <Arduino.h>
+
+// ========== HARDWARE ABSTRACTION ==========
+// Application modules touch the board only through the Arduino pin, time
+// and Serial API. The peripherals the core does not cover, the step timer
+// (step_timer.h) and the TWI bus behind the LCD (lcd_async.h), plus the
+// direct port writes (fast_io.h, coil_output.h) pick an implementation here:
+//   HAL_TARGET_AVR - Mega 2560 registers and interrupt vectors
+//   HAL_TARGET_SIM - the simulated board of the native build (lib/ArduinoSim)
+//   neither        - inert stand-ins so the logic compiles on any host
+#if defined(__AVR_ATmega2560__)
+#define HAL_TARGET_AVR
+#elif defined(ARDUINO_SIM)
+#define HAL_TARGET_SIM
+#include <ArduinoSim.h>
+#endif
+
+#endif // HAL_H
@@ -0,0 +1,150 @@
+#ifndef IDLE_SLEEP_H
+#define IDLE_SLEEP_H
+
+#include <Arduino.h>
+#include "hal.h"
+#include "config.h"
+#include "scheduler.h"
+#include "serial_input.h"
+#include "lcd.h"
+#include "bench.h"
+#include "stats.h"
+#include "trace.h"
+
+// ========== IDLE SLEEP FUNCTION DECLARATIONS ==========
+// loop() ends with idleSleep(). When nothing is left to do on this pass it
+// sleeps until the earliest deadline: the next scheduler task (traffic
+// phase, LCD refresh, motor and light sequences) or the end of a partial
+// serial line. Any interrupt wakes it early: UART RX, a motor step, the TWI
+// bus. The time asleep is added to the millis()/micros() timebase on the
+// way out, so it does not sleep while the trace recorder needs micros() in
+// the step interrupt.
+void idleSleep();
+bool idleNextDeadline(unsigned long& deadline);
+
+// Sleeps for at most maxMicros and returns the microseconds actually slept;
+// returns 0 without sleeping if a byte is already waiting on Serial
+unsigned long idleSleepFor(unsigned long maxMicros);
+
+// ========== IDLE SLEEP FUNCTION IMPLEMENTATIONS ==========
+
+bool idleNextDeadline(unsigned long& deadline) {
+  bool found = getNextTaskDeadline(deadline);
+  
+  if ((serialInput.count > 0 && serialInput.pendingLines == 0) || serialInput.discarding) {
+    unsigned long lineEnd = serialInput.lastByteTime + SERIAL_LINE_IDLE_MS;
+    if (!found || (long)(lineEnd - deadline) < 0) {
+      deadline = lineEnd;
+      found = true;
+    }
+  }
+  return found;
+}
+
+void idleSleep() {
+  if (!IDLE_SLEEP_ENABLED) return;
+  if (benchmarkPending() || benchmarkRunning() || lcdFrame.pending || serialInput.pendingLines > 0) return;
+  if (traceCapturing()) return;
+  
+  unsigned long budget = IDLE_MAX_SLEEP_MS;
+  unsigned long deadline;
+  if (idleNextDeadline(deadline)) {
+    long remaining = (long)(deadline - millis());
+    if (remaining < IDLE_MIN_SLEEP_MS) return;
+    if ((unsigned long)remaining < budget) {
+      budget = remaining;
+    }
+  }
+  
+  statsRecordSleep(idleSleepFor(budget * 1000UL));
+}
+
+#if defined(HAL_TARGET_AVR)
+
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+// The core's Timer0 overflow counters behind millis() and micros()
+extern volatile unsigned long timer0_millis;
+extern volatile unsigned long timer0_overflow_count;
+
+// Timer5 wakes the CPU. It shares Timer0's prescaler at clk/64, so one
+// Timer5 tick is one Timer0 tick (4 us) and the longest sleep is 262 ms.
+// Timer5 also backs the cycle counter, which idleSleep() leaves alone.
+EMPTY_INTERRUPT(TIMER5_COMPA_vect);
+
+#define IDLE_TIMER0_TICK_US 4
+#define IDLE_TIMER0_OVERFLOW_US 1024
+
+unsigned long idleSleepFor(unsigned long maxMicros) {
+  static uint16_t millisRemainder = 0;
+  unsigned long maxTicks = maxMicros / IDLE_TIMER0_TICK_US;
+  uint16_t ticks = maxTicks > 0xFFFF ? 0xFFFF : maxTicks;
+  
+  cli();
+  // A pending Timer0 overflow would be counted twice below
+  if (Serial.available() > 0 || (TIFR0 & _BV(TOV0)) || ticks == 0) {
+    sei();
+    return 0;
+  }
+  
+  // Stop the 1 ms tick so it does not wake the CPU every millisecond
+  TIMSK0 &= ~_BV(TOIE0);
+  uint8_t timer0Start = TCNT0;
+  
+  TCCR5A = 0;
+  TCCR5B = 0;
+  TCNT5 = 0;
+  OCR5A = ticks - 1;
+  TIFR5 = _BV(OCF5A);
+  TIMSK5 = _BV(OCIE5A);
+  TCCR5B = _BV(WGM52) | _BV(CS51) | _BV(CS50);
+  
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  sleep_enable();
+  sei();
+  sleep_cpu();  // the instruction after sei() always runs, so no wakeup is lost
+  sleep_disable();
+  
+  cli();
+  uint16_t elapsed = TCNT5;
+  if (TIFR5 & _BV(OCF5A)) {
+    elapsed += ticks;  // CTC restarted the count on the match
+  }
+  TCCR5B = 0;
+  TIMSK5 = 0;
+  
+  // Timer0 kept counting; its overflow flag stands for one of the
+  // overflows and the ISR counts that one when the tick is re-enabled
+  unsigned long overflows = ((unsigned long)timer0Start + elapsed) >> 8;
+  if (overflows > 0) {
+    overflows--;
+    unsigned long overflowMicros = overflows * IDLE_TIMER0_OVERFLOW_US + millisRemainder;
+    timer0_overflow_count += overflows;
+    timer0_millis += overflowMicros / 1000;
+    millisRemainder = overflowMicros % 1000;
+  }
+  TIMSK0 |= _BV(TOIE0);
+  sei();
+  
+  return (unsigned long)elapsed * IDLE_TIMER0_TICK_US;
+}
+
+#elif defined(HAL_TARGET_SIM)
+
+// The simulator skips the virtual clock ahead; the step timer still fires
+// on the way, like the interrupts that would wake the real board
+unsigned long idleSleepFor(unsigned long maxMicros) {
+  if (Serial.available() > 0) return 0;
+  return simSleep(maxMicros);
+}
+
+#else
+
+unsigned long idleSleepFor(unsigned long maxMicros) {
+  return 0;
+}
+
+#endif
+
+#endif // IDLE_SLEEP_H
@@ -0,0 +1,146 @@
+#ifndef LAMP_OUTPUT_H
+#define LAMP_OUTPUT_H
+
+#include <Arduino.h>
+#include "hal.h"
+#include "config.h"
+#include "fast_io.h"
+
+// ========== LAMP MASKS ==========
+// One bit per lamp of an intersection, in TRAFFIC_LAMP_PINS order and in
+// the output order (QA first) of its 74HC595. Head A is the original
+// red/yellow/green set.
+#define LAMP_A_RED 0x01
+#define LAMP_A_YELLOW 0x02
+#define LAMP_A_GREEN 0x04
+#define LAMP_B_RED 0x08
+#define LAMP_B_YELLOW 0x10
+#define LAMP_B_GREEN 0x20
+#define LAMP_WALK 0x40
+#define LAMP_DONT_WALK 0x80
+#define TRAFFIC_LAMP_COUNT 8
+
+const uint8_t TRAFFIC_LAMP_PINS[TRAFFIC_LAMP_COUNT] = {
+  RED_LED_PIN, YELLOW_LED_PIN, GREEN_LED_PIN,
+  HEAD_B_RED_PIN, HEAD_B_YELLOW_PIN, HEAD_B_GREEN_PIN,
+  WALK_PIN, DONT_WALK_PIN
+};
+
+// Phase programs hold a lamp byte per intersection for every phase
+static_assert(LAMP_SHIFT_REGISTERS <= 16, "LAMP_SHIFT_REGISTERS must be 0 to 16");
+
+// ========== LAMP OUTPUT STATE ==========
+// shadow holds every intersection's lamps; writers change it and
+// lampOutputLatch() puts all of it on the outputs at once. With shift
+// registers that is one SPI burst and one latch pulse however many
+// intersections changed.
+struct LampOutputState {
+  uint8_t shadow[TRAFFIC_INTERSECTIONS];
+  unsigned long latches;
+};
+
+static LampOutputState lampOutput;
+
+// ========== LAMP OUTPUT FUNCTION DECLARATIONS ==========
+void lampOutputBegin();
+void lampOutputSet(uint8_t intersection, uint8_t lamps);
+uint8_t lampOutputGet(uint8_t intersection);
+void lampOutputLatch();
+
+// ========== LAMP OUTPUT FUNCTION IMPLEMENTATIONS ==========
+
+void lampOutputSet(uint8_t intersection, uint8_t lamps) {
+  lampOutput.shadow[intersection] = lamps;
+}
+
+uint8_t lampOutputGet(uint8_t intersection) {
+  return lampOutput.shadow[intersection];
+}
+
+#if LAMP_SHIFT_REGISTERS == 0
+
+void lampOutputBegin() {
+  for (uint8_t lamp = 0; lamp < TRAFFIC_LAMP_COUNT; lamp++) {
+    pinMode(TRAFFIC_LAMP_PINS[lamp], OUTPUT);
+  }
+  lampOutputSet(0, 0);
+  lampOutputLatch();
+}
+
+void lampOutputLatch() {
+  uint8_t lamps = lampOutput.shadow[0];
+  for (uint8_t lamp = 0; lamp < TRAFFIC_LAMP_COUNT; lamp++) {
+    digitalWrite(TRAFFIC_LAMP_PINS[lamp], (lamps >> lamp) & 1 ? HIGH : LOW);
+  }
+  lampOutput.latches++;
+}
+
+#elif defined(HAL_TARGET_AVR)
+
+// The chain hangs off MOSI (SER) and SCK (SRCLK); the latch pin is SS, which
+// must be an output anyway for the SPI to stay master
+void lampOutputBegin() {
+  pinMode(LAMP_LATCH_PIN, OUTPUT);
+  digitalWrite(LAMP_LATCH_PIN, LOW);
+  pinMode(MOSI, OUTPUT);
+  pinMode(SCK, OUTPUT);
+  // Mode 0, MSB first, clk/2: 8 MHz
+  SPCR = _BV(SPE) | _BV(MSTR);
+  SPSR = _BV(SPI2X);
+  
+  memset(lampOutput.shadow, 0, sizeof(lampOutput.shadow));
+  lampOutputLatch();
+}
+
+// 16 CPU clocks per register on the wire plus the loop, about 1.4 us each.
+// Intersection 0 goes out last so it lands in the register next to the
+// board. The rising edge on RCLK moves every register to its outputs in
+// the same instant.
+void lampOutputLatch() {
+  for (uint8_t i = TRAFFIC_INTERSECTIONS; i-- > 0;) {
+    SPDR = lampOutput.shadow[i];
+    while (!(SPSR & _BV(SPIF))) {
+    }
+  }
+  
+  uint8_t oldSREG = SREG;
+  cli();
+  writePortBits<pinPort(LAMP_LATCH_PIN), pinMask(LAMP_LATCH_PIN)>(pinMask(LAMP_LATCH_PIN));
+  writePortBits<pinPort(LAMP_LATCH_PIN), pinMask(LAMP_LATCH_PIN)>(0);
+  SREG = oldSREG;
+  lampOutput.latches++;
+}
+
+#elif defined(HAL_TARGET_SIM)
+
+void lampOutputBegin() {
+  pinMode(LAMP_LATCH_PIN, OUTPUT);
+  digitalWrite(LAMP_LATCH_PIN, LOW);
+  simShiftRegisterAttach(LAMP_LATCH_PIN, LAMP_SHIFT_REGISTERS, F_CPU / 2);
+  
+  memset(lampOutput.shadow, 0, sizeof(lampOutput.shadow));
+  lampOutputLatch();
+}
+
+void lampOutputLatch() {
+  for (uint8_t i = TRAFFIC_INTERSECTIONS; i-- > 0;) {
+    simSpiTransfer(lampOutput.shadow[i]);
+  }
+  digitalWrite(LAMP_LATCH_PIN, HIGH);
+  digitalWrite(LAMP_LATCH_PIN, LOW);
+  lampOutput.latches++;
+}
+
+#else
+
+void lampOutputBegin() {
+  memset(lampOutput.shadow, 0, sizeof(lampOutput.shadow));
+}
+
+void lampOutputLatch() {
+  lampOutput.latches++;
+}
+
+#endif
+
+#endif // LAMP_OUTPUT_H
@@ -2,27 +2,74 @@
 #define LCD_H
 
 #include <Arduino.h>
-#include <LiquidCrystal_I2C.h>
 #include "config.h"
+#include "console.h"
+#include "lcd_async.h"
+#include "scheduler.h"
+#include "trace.h"
+
+// ========== LCD FRAMEBUFFER STRUCTURE ==========
+// Screens draw into frame; lcdFlush() sends only the cells that differ from
+// glass, which mirrors what the display currently shows. A flush queues at
+// most LCD_FLUSH_BYTES_PER_TICK bytes and leaves pending set for the rest.
+struct LcdFrameBuffer {
+  char frame[LCD_ROWS][LCD_COLUMNS];
+  char glass[LCD_ROWS][LCD_COLUMNS];
+  bool pending;
+  unsigned int lastFlushBytes;
+  unsigned long totalBytes;
+};
+
+// ========== LCD FRAME PRINTER ==========
+// Print target that writes into one row of the framebuffer, so screens use
+// the same heap-free formatting as the console (printItems in console.h)
+class LcdFramePrinter : public Print {
+ public:
+  LcdFramePrinter(uint8_t col, uint8_t row) : col(col), row(row) {}
+  
+  virtual size_t write(uint8_t value);
+  using Print::write;
+  
+  uint8_t column() const { return col; }
+ 
+ private:
+  uint8_t col;
+  uint8_t row;
+};
 
 // ========== LCD GLOBAL INSTANCE ==========
-extern LiquidCrystal_I2C lcd;
+extern LcdI2CAsync lcd;
+extern LcdFrameBuffer lcdFrame;
 extern MotorState motorState;
 extern TrafficLightState_t trafficLight;
 extern bool disableAutoLCDUpdate;
 
 // ========== LCD FUNCTION DECLARATIONS ==========
-void initializeLCD();
+void initializeLCD(bool splash);
+void lcdClearFrame();
+void lcdPutChar(uint8_t col, uint8_t row, char c);
+uint8_t lcdPrintAt(uint8_t col, uint8_t row, const char* text);
+uint8_t lcdPrintAt(uint8_t col, uint8_t row, const __FlashStringHelper* text);
+uint8_t lcdPrintNumberAt(uint8_t col, uint8_t row, long value);
+void lcdFlush();
+void lcdService();
 void updateLCDStatus();
-void displayCommand(String command);
-void displayError(String error);
+unsigned long refreshLCDStatus();
+void holdLCDScreen(unsigned long ms);
+template<typename... Items> void displayCommand(Items... items);
+template<typename... Items> void displayError(Items... items);
 
 // ========== LCD FUNCTION IMPLEMENTATIONS ==========
 
-void initializeLCD() {
+// Without the splash the status screen comes up on the first scheduler pass
+void initializeLCD(bool splash) {
   lcd.init();
   lcd.backlight();
   lcd.clear();
+  memset(lcdFrame.glass, ' ', sizeof(lcdFrame.glass));
+  lcdFrame.pending = false;
+  lcdFrame.lastFlushBytes = 0;
+  lcdFrame.totalBytes = 0;
   
   // Create custom heart character
   byte heart[8] = {
@@ -37,69 +84,182 @@ void initializeLCD() {
   };
   lcd.createChar(0, heart);
   
-  // Center "HI ABDALAZIZ" (12 chars) on 20-char display
+  lcdClearFrame();
+  if (!splash) {
+    holdLCDScreen(0);
+    return;
+  }
+  
+  // Center F("HI ABDALAZIZ") (12 chars) on 20-char display
   // Position: (20-12)/2 = 4 spaces from left
-  lcd.setCursor(4, 1);  // Row 1 (middle of 4 rows)
-  lcd.print("HI ABDALAZIZ");
+  lcdPrintAt(4, 1, F("HI ABDALAZIZ"));  // Row 1 (middle of 4 rows)
   
   // Center heart symbol on row 3
   // Position: (20-1)/2 = 9.5, so position 9
-  lcd.setCursor(9, 2);  // Row 2 (0-indexed, so row 3)
-  lcd.write(byte(0));   // Display custom heart character
+  lcdPutChar(9, 2, 0);  // Row 2 (0-indexed, so row 3), custom heart character
   
-  delay(5000);
-  lcd.clear();
-  updateLCDStatus();
+  lcdFlush();
+  holdLCDScreen(LCD_SPLASH_MS);
+}
+
+void lcdClearFrame() {
+  memset(lcdFrame.frame, ' ', sizeof(lcdFrame.frame));
+}
+
+void lcdPutChar(uint8_t col, uint8_t row, char c) {
+  if (col < LCD_COLUMNS && row < LCD_ROWS) {
+    lcdFrame.frame[row][col] = c;
+  }
+}
+
+// Returns the column after the text so callers can keep appending
+uint8_t lcdPrintAt(uint8_t col, uint8_t row, const char* text) {
+  while (*text != '\0' && col < LCD_COLUMNS) {
+    lcdPutChar(col++, row, *text++);
+  }
+  return col;
+}
+
+uint8_t lcdPrintAt(uint8_t col, uint8_t row, const __FlashStringHelper* text) {
+  LcdFramePrinter printer(col, row);
+  printer.print(text);
+  return printer.column();
+}
+
+size_t LcdFramePrinter::write(uint8_t value) {
+  lcdPutChar(col, row, value);
+  if (col < LCD_COLUMNS) {
+    col++;
+  }
+  return 1;
+}
+
+uint8_t lcdPrintNumberAt(uint8_t col, uint8_t row, long value) {
+  char digits[12];
+  uint8_t length = 0;
+  unsigned long magnitude = value < 0 ? -(unsigned long)value : value;
+  
+  do {
+    digits[length++] = '0' + magnitude % 10;
+    magnitude /= 10;
+  } while (magnitude > 0);
+  
+  if (value < 0) {
+    lcdPutChar(col++, row, '-');
+  }
+  while (length > 0) {
+    lcdPutChar(col++, row, digits[--length]);
+  }
+  return col;
+}
+
+void lcdFlush() {
+  unsigned long queuedBefore = lcd.bytesQueued();
+  unsigned int budget = LCD_FLUSH_BYTES_PER_TICK;
+  
+  lcdFrame.pending = false;
+  for (uint8_t row = 0; row < LCD_ROWS && !lcdFrame.pending; row++) {
+    // The display auto-increments its address after each character, so a
+    // cursor command is only needed at the start of each changed run
+    uint8_t cursorCol = LCD_COLUMNS;
+    for (uint8_t col = 0; col < LCD_COLUMNS; col++) {
+      char c = lcdFrame.frame[row][col];
+      if (c == lcdFrame.glass[row][col]) continue;
+      
+      // Worst case for one cell: cursor command plus character, 4 bytes each
+      if (budget < 8 || lcd.queueSpace() < 8) {
+        lcdFrame.pending = true;
+        break;
+      }
+      
+      if (cursorCol != col) {
+        lcd.setCursor(col, row);
+        budget -= 4;
+      }
+      lcd.write((uint8_t)c);
+      budget -= 4;
+      lcdFrame.glass[row][col] = c;
+      cursorCol = col + 1;
+    }
+  }
+  
+  lcdFrame.lastFlushBytes = lcd.bytesQueued() - queuedBefore;
+  lcdFrame.totalBytes += lcdFrame.lastFlushBytes;
+  if (lcdFrame.lastFlushBytes > 0) {
+    traceEvent(TRACE_LCD_FLUSH, lcdFrame.lastFlushBytes < 255 ? lcdFrame.lastFlushBytes : 255);
+  }
+}
+
+// Finishes a flush that ran out of budget; called every loop() pass
+void lcdService() {
+  if (lcdFrame.pending) {
+    lcdFlush();
+  }
 }
 
 void updateLCDStatus() {
-  lcd.clear();
+  lcdClearFrame();
   
-  lcd.setCursor(0, 0);
-  lcd.print("MOTOR STATUS:");
+  lcdPrintAt(0, 0, F("MOTOR STATUS:"));
   
-  lcd.setCursor(0, 1);
+  uint8_t col;
   if (motorState.isRunning) {
-    lcd.print("RUNNING - SPEED: ");
-    lcd.print(motorState.stepDelay);
+    col = lcdPrintAt(0, 1, F("RUNNING - SPS: "));
   } else {
-    lcd.print("READY - SPEED: ");
-    lcd.print(motorState.stepDelay);
+    col = lcdPrintAt(0, 1, F("READY - SPS: "));
   }
+  lcdPrintNumberAt(col, 1, motorState.maxSpeed);
   
-  lcd.setCursor(0, 2);
-  lcd.print("TRAFFIC LIGHT:");
+  lcdPrintAt(0, 2, F("TRAFFIC LIGHT:"));
   
-  lcd.setCursor(0, 3);
   if (trafficLight.isRunning) {
     switch (trafficLight.currentState) {
       case TRAFFIC_RED:
-        lcd.print("RED LIGHT ON");
+        lcdPrintAt(0, 3, F("RED LIGHT ON"));
         break;
       case TRAFFIC_YELLOW:
-        lcd.print("YELLOW LIGHT ON");
+        lcdPrintAt(0, 3, F("YELLOW LIGHT ON"));
         break;
       case TRAFFIC_GREEN:
-        lcd.print("GREEN LIGHT ON");
+        lcdPrintAt(0, 3, F("GREEN LIGHT ON"));
         break;
     }
   } else {
-    lcd.print("ALL LIGHTS OFF");
+    lcdPrintAt(0, 3, F("ALL LIGHTS OFF"));
   }
+  
+  lcdFlush();
 }
 
-void displayCommand(String command) {
-  lcd.clear();
-  lcd.setCursor(0, 1);
-  lcd.print("CMD: " + command);
+// Scheduler task: periodic status screen
+unsigned long refreshLCDStatus() {
+  if (!disableAutoLCDUpdate) {
+    updateLCDStatus();
+  }
+  return LCD_REFRESH_INTERVAL_MS;
 }
 
-void displayError(String error) {
-  lcd.clear();
-  lcd.setCursor(0, 1);
-  lcd.print("ERROR: " + error);
-  delay(2000);
-  updateLCDStatus();
+// Keeps the current screen up by pushing back the next status refresh
+void holdLCDScreen(unsigned long ms) {
+  scheduleTask(TASK_LCD_REFRESH, refreshLCDStatus, ms);
+}
+
+// Items as for printLine(), e.g. displayCommand(F("FWD "), steps)
+template<typename... Items>
+void displayCommand(Items... items) {
+  lcdClearFrame();
+  LcdFramePrinter printer(0, 1);
+  printItems(printer, F("CMD: "), items...);
+  lcdFlush();
+}
+
+template<typename... Items>
+void displayError(Items... items) {
+  lcdClearFrame();
+  LcdFramePrinter printer(0, 1);
+  printItems(printer, F("ERROR: "), items...);
+  lcdFlush();
+  holdLCDScreen(LCD_ERROR_HOLD_MS);
 }
 
-#endif // LCD_H
\ No newline at end of file
+#endif // LCD_H
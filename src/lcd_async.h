@@ -0,0 +1,261 @@
+#ifndef LCD_ASYNC_H
+#define LCD_ASYNC_H
+
+#include <Arduino.h>
+#include "hal.h"
+#include "config.h"
+
+// ========== PCF8574 BACKPACK BITS ==========
+#define LCD_PIN_RS 0x01
+#define LCD_PIN_EN 0x04
+#define LCD_PIN_BACKLIGHT 0x08
+
+// ========== HD44780 COMMANDS ==========
+#define LCD_CMD_CLEAR 0x01
+#define LCD_CMD_ENTRY_MODE 0x06       // increment, no shift
+#define LCD_CMD_DISPLAY_ON 0x0C       // display on, cursor off, blink off
+#define LCD_CMD_FUNCTION_SET 0x28     // 4-bit bus, 2 lines, 5x8 font
+#define LCD_CMD_SET_CGRAM 0x40
+#define LCD_CMD_SET_DDRAM 0x80
+
+// ========== TWI QUEUE STRUCTURE ==========
+// Expander bytes waiting for the bus. The main loop only moves head and the
+// TWI interrupt only moves tail, so single-byte indices need no locking.
+struct LcdTwiQueue {
+  uint8_t buffer[LCD_TWI_QUEUE_SIZE];
+  volatile uint8_t head;
+  volatile uint8_t tail;
+  volatile bool busy;
+  volatile unsigned int errors;
+};
+
+static LcdTwiQueue lcdTwiQueue;
+
+// ========== ASYNC LCD CLASS ==========
+// Drop-in replacement for LiquidCrystal_I2C: every call encodes the HD44780
+// nibbles into the queue and returns; the TWI interrupt drains it in the
+// background, one transaction per burst.
+class LcdI2CAsync : public Print {
+ public:
+  LcdI2CAsync(uint8_t address, uint8_t columns, uint8_t rows);
+  
+  void init();
+  void backlight();
+  void noBacklight();
+  void clear();
+  void setCursor(uint8_t col, uint8_t row);
+  void createChar(uint8_t location, uint8_t charmap[]);
+  virtual size_t write(uint8_t value);
+  using Print::write;
+  
+  void waitIdle();
+  unsigned int queueSpace() const;
+  unsigned long bytesQueued() const { return queuedBytes; }
+  unsigned int busErrors() const { return lcdTwiQueue.errors; }
+ 
+ private:
+  void sendByte(uint8_t value, uint8_t mode);
+  void sendNibble(uint8_t nibble, uint8_t mode);
+  void enqueue(uint8_t value);
+  void pad(uint8_t count);
+  
+  uint8_t address;
+  uint8_t columns;
+  uint8_t rows;
+  uint8_t backlightFlag;
+  unsigned long queuedBytes;
+};
+
+// ========== TWI BUS FUNCTION DECLARATIONS ==========
+void lcdTwiBegin(uint8_t address);
+void lcdTwiKick();
+
+// ========== TWI BUS FUNCTION IMPLEMENTATIONS ==========
+static uint8_t lcdTwiAddress;
+
+#if defined(HAL_TARGET_AVR)
+
+#include <avr/interrupt.h>
+#include <util/twi.h>
+
+void lcdTwiBegin(uint8_t address) {
+  lcdTwiAddress = address;
+  digitalWrite(SDA, HIGH);
+  digitalWrite(SCL, HIGH);
+  TWSR = 0;
+  TWBR = ((F_CPU / LCD_TWI_FREQUENCY_HZ) - 16) / 2;
+  TWCR = _BV(TWEN);
+}
+
+void lcdTwiKick() {
+  // A STOP from the previous transaction may still be on the bus
+  while (TWCR & _BV(TWSTO)) {
+  }
+  lcdTwiQueue.busy = true;
+  TWCR = _BV(TWINT) | _BV(TWSTA) | _BV(TWEN) | _BV(TWIE);
+}
+
+ISR(TWI_vect) {
+  switch (TW_STATUS) {
+    case TW_START:
+    case TW_REP_START:
+      TWDR = (lcdTwiAddress << 1) | TW_WRITE;
+      TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWIE);
+      break;
+    
+    case TW_MT_SLA_ACK:
+    case TW_MT_DATA_ACK:
+      if (lcdTwiQueue.tail != lcdTwiQueue.head) {
+        TWDR = lcdTwiQueue.buffer[lcdTwiQueue.tail];
+        lcdTwiQueue.tail = (lcdTwiQueue.tail + 1) & (LCD_TWI_QUEUE_SIZE - 1);
+        TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWIE);
+      } else {
+        TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWSTO);
+        lcdTwiQueue.busy = false;
+      }
+      break;
+    
+    default:
+      // NACK or lost arbitration: drop what is queued rather than stall the
+      // producer on a missing or wedged display
+      lcdTwiQueue.errors++;
+      lcdTwiQueue.tail = lcdTwiQueue.head;
+      TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWSTO);
+      lcdTwiQueue.busy = false;
+      break;
+  }
+}
+
+#else
+
+// Off target the bytes are consumed immediately; the simulator feeds them to
+// its model of the backpack and display
+void lcdTwiBegin(uint8_t address) {
+  lcdTwiAddress = address;
+}
+
+void lcdTwiKick() {
+  while (lcdTwiQueue.tail != lcdTwiQueue.head) {
+#if defined(HAL_TARGET_SIM)
+    simTwiTransmit(lcdTwiAddress, lcdTwiQueue.buffer[lcdTwiQueue.tail]);
+#endif
+    lcdTwiQueue.tail = (lcdTwiQueue.tail + 1) & (LCD_TWI_QUEUE_SIZE - 1);
+  }
+  lcdTwiQueue.busy = false;
+}
+
+#endif
+
+// ========== ASYNC LCD IMPLEMENTATION ==========
+
+LcdI2CAsync::LcdI2CAsync(uint8_t address, uint8_t columns, uint8_t rows)
+  : address(address), columns(columns), rows(rows), backlightFlag(0), queuedBytes(0) {
+}
+
+void LcdI2CAsync::init() {
+  lcdTwiQueue.head = 0;
+  lcdTwiQueue.tail = 0;
+  lcdTwiQueue.busy = false;
+  lcdTwiQueue.errors = 0;
+  lcdTwiBegin(address);
+  
+  // HD44780 power-on reset into 4-bit mode (datasheet figure 24); runs once
+  // from setup() so blocking on the waits is acceptable
+  delay(50);
+  for (uint8_t i = 0; i < 3; i++) {
+    sendNibble(0x03, 0);
+    waitIdle();
+    delay(5);
+  }
+  sendNibble(0x02, 0);
+  sendByte(LCD_CMD_FUNCTION_SET, 0);
+  sendByte(LCD_CMD_DISPLAY_ON, 0);
+  clear();
+  sendByte(LCD_CMD_ENTRY_MODE, 0);
+  waitIdle();
+}
+
+void LcdI2CAsync::backlight() {
+  backlightFlag = LCD_PIN_BACKLIGHT;
+  enqueue(backlightFlag);
+}
+
+void LcdI2CAsync::noBacklight() {
+  backlightFlag = 0;
+  enqueue(backlightFlag);
+}
+
+void LcdI2CAsync::clear() {
+  sendByte(LCD_CMD_CLEAR, 0);
+  pad(LCD_TWI_CLEAR_PAD_BYTES);
+}
+
+void LcdI2CAsync::setCursor(uint8_t col, uint8_t row) {
+  static const uint8_t rowOffsets[4] = {0x00, 0x40, 0x14, 0x54};
+  if (row >= rows) {
+    row = rows - 1;
+  }
+  if (col >= columns) {
+    col = columns - 1;
+  }
+  sendByte(LCD_CMD_SET_DDRAM | (col + rowOffsets[row]), 0);
+}
+
+void LcdI2CAsync::createChar(uint8_t location, uint8_t charmap[]) {
+  sendByte(LCD_CMD_SET_CGRAM | ((location & 0x07) << 3), 0);
+  for (uint8_t i = 0; i < 8; i++) {
+    sendByte(charmap[i], LCD_PIN_RS);
+  }
+}
+
+size_t LcdI2CAsync::write(uint8_t value) {
+  sendByte(value, LCD_PIN_RS);
+  return 1;
+}
+
+void LcdI2CAsync::waitIdle() {
+  while (lcdTwiQueue.busy || lcdTwiQueue.tail != lcdTwiQueue.head) {
+  }
+}
+
+unsigned int LcdI2CAsync::queueSpace() const {
+  return (LCD_TWI_QUEUE_SIZE - 1) - ((lcdTwiQueue.head - lcdTwiQueue.tail) & (LCD_TWI_QUEUE_SIZE - 1));
+}
+
+void LcdI2CAsync::sendByte(uint8_t value, uint8_t mode) {
+  sendNibble(value >> 4, mode);
+  sendNibble(value & 0x0F, mode);
+}
+
+// The HD44780 latches on the falling edge of EN, so each nibble is sent
+// with EN high and then again with EN low
+void LcdI2CAsync::sendNibble(uint8_t nibble, uint8_t mode) {
+  uint8_t value = (nibble << 4) | mode | backlightFlag;
+  enqueue(value | LCD_PIN_EN);
+  enqueue(value);
+}
+
+// Bytes with EN low are ignored by the controller; they hold the bus for
+// slow instructions such as clear
+void LcdI2CAsync::pad(uint8_t count) {
+  while (count-- > 0) {
+    enqueue(backlightFlag);
+  }
+}
+
+void LcdI2CAsync::enqueue(uint8_t value) {
+  // lcdFlush() checks queueSpace() first; only setup-time bursts wait here
+  while (queueSpace() == 0) {
+  }
+  lcdTwiQueue.buffer[lcdTwiQueue.head] = value;
+  lcdTwiQueue.head = (lcdTwiQueue.head + 1) & (LCD_TWI_QUEUE_SIZE - 1);
+  queuedBytes++;
+  
+  // The interrupt clears busy only after it has seen an empty queue, so
+  // either it picks up this byte or we start a new transaction here
+  if (!lcdTwiQueue.busy) {
+    lcdTwiKick();
+  }
+}
+
+#endif // LCD_ASYNC_H
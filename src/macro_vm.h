@@ -0,0 +1,776 @@
+#ifndef MACRO_VM_H
+#define MACRO_VM_H
+
+#include <Arduino.h>
+#include <stddef.h>
+#include "config.h"
+#include "console.h"
+#include "scheduler.h"
+#include "motor.h"
+#include "traffic_light.h"
+#include "lcd.h"
+#include "event_log.h"
+#include "config_store.h"
+
+// ========== MACRO OPCODES ==========
+// A macro is a byte string of instructions, each an opcode followed by its
+// operands; multi-byte operands are little endian. The VM runs as a
+// scheduler task: a wait returns to the main loop, so nothing blocks.
+//   END                  last byte of every program
+//   LAMPS mask           set every intersection's lamps (LAMP_* bits)
+//   WAIT ms16            pause
+//   MOVE steps32         start a move of axis X, negative is reverse
+//   GOTO position32      start a move of axis X to an absolute position
+//   AWAIT ms16           wait for the motor to stop, at most ms (0: no limit)
+//   REPEAT count         run the body up to NEXT count times; with count 0
+//                        while the motor moves
+//   NEXT                 end of a REPEAT body
+//   LCD_CLEAR            blank the screen
+//   LCD_AT col row       move the LCD cursor
+//   LCD_TEXT len chars   print len characters at the cursor
+//   LCD_STEPS            print the steps done by the current move
+//   LCD_PERCENT total32  print steps done as a percentage of total
+//   EVENT event arg16    log event with arg and the steps done
+// A REPEAT 0 loop is left as soon as the motor has stopped when the program
+// resumes from a wait, even in the middle of its body.
+enum MacroOpcode {
+  MACRO_END,
+  MACRO_LAMPS,
+  MACRO_WAIT,
+  MACRO_MOVE,
+  MACRO_GOTO,
+  MACRO_AWAIT,
+  MACRO_REPEAT,
+  MACRO_NEXT,
+  MACRO_LCD_CLEAR,
+  MACRO_LCD_AT,
+  MACRO_LCD_TEXT,
+  MACRO_LCD_STEPS,
+  MACRO_LCD_PERCENT,
+  MACRO_EVENT,
+  MACRO_OPCODE_COUNT
+};
+
+// Operand bytes per opcode; LCD_TEXT adds its length byte's count
+const uint8_t MACRO_OPERAND_BYTES[MACRO_OPCODE_COUNT] PROGMEM = {
+  0, 1, 2, 4, 4, 2, 1, 0, 0, 2, 1, 0, 4, 3
+};
+
+#define MACRO_U16(value) (uint8_t)(value), (uint8_t)((value) >> 8)
+#define MACRO_U32(value) MACRO_U16((uint32_t)(value)), MACRO_U16((uint32_t)(value) >> 16)
+
+// What a program drives, found by scanning it before it starts. A command
+// that takes over one of these stops the program.
+#define MACRO_USES_MOTOR 0x01
+#define MACRO_USES_LAMPS 0x02
+#define MACRO_USES_LCD 0x04
+#define MACRO_USES_ALL 0xFF
+
+// ========== STOCK PROGRAMS ==========
+// The built-in sequences. Programs are numbered stock first, then the
+// EEPROM slots.
+const uint8_t MACRO_CODE_FLASH[] PROGMEM = {
+  MACRO_REPEAT, FLASH_CYCLES,
+    MACRO_LAMPS, LAMP_A_RED | LAMP_A_YELLOW | LAMP_A_GREEN,
+    MACRO_WAIT, MACRO_U16(FLASH_DELAY_MS),
+    MACRO_LAMPS, 0,
+    MACRO_WAIT, MACRO_U16(FLASH_DELAY_MS),
+  MACRO_NEXT,
+  MACRO_END
+};
+
+const uint8_t MACRO_CODE_EMERGENCY[] PROGMEM = {
+  MACRO_REPEAT, EMERGENCY_FLASH_CYCLES,
+    MACRO_LAMPS, LAMP_A_RED,
+    MACRO_WAIT, MACRO_U16(EMERGENCY_FLASH_DELAY_MS),
+    MACRO_LAMPS, 0,
+    MACRO_WAIT, MACRO_U16(EMERGENCY_FLASH_DELAY_MS),
+  MACRO_NEXT,
+  MACRO_END
+};
+
+const uint8_t MACRO_CODE_DEMO[] PROGMEM = {
+  MACRO_MOVE, MACRO_U32(DEMO_STEPS),
+  MACRO_AWAIT, MACRO_U16(0),
+  MACRO_WAIT, MACRO_U16(DEMO_PAUSE_MS),
+  MACRO_EVENT, LOG_DEMO_REVERSE, MACRO_U16(DEMO_STEPS),
+  MACRO_MOVE, MACRO_U32(-DEMO_STEPS),
+  MACRO_AWAIT, MACRO_U16(0),
+  MACRO_END
+};
+
+// One light of the loop sequence: lamp, log line and LCD rows 1 to 3
+#define MACRO_LOOP_LIGHT(lamp, color, ...) \
+  MACRO_LAMPS, lamp, \
+  MACRO_EVENT, LOG_LOOP_LIGHT, MACRO_U16(color), \
+  MACRO_LCD_AT, 7, 1, MACRO_LCD_TEXT, 6, __VA_ARGS__, \
+  MACRO_LCD_AT, 6, 2, MACRO_LCD_STEPS, \
+  MACRO_LCD_AT, 10, 3, MACRO_LCD_PERCENT, MACRO_U32(LOOP_SEQUENCE_STEPS), \
+  MACRO_AWAIT, MACRO_U16(LIGHT_CIRCULATION_DELAY_MS)
+
+const uint8_t MACRO_CODE_LOOP[] PROGMEM = {
+  MACRO_WAIT, MACRO_U16(LOOP_INTRO_MS),
+  MACRO_MOVE, MACRO_U32(LOOP_SEQUENCE_STEPS),
+  MACRO_LCD_CLEAR,
+  MACRO_LCD_AT, 0, 0, MACRO_LCD_TEXT, 20, 'L', 'O', 'O', 'P', ' ', 'S', 'E', 'Q', 'U', 'E', 'N', 'C', 'E', ' ', 'A', 'C', 'T', 'I', 'V', 'E',
+  MACRO_LCD_AT, 0, 1, MACRO_LCD_TEXT, 7, 'L', 'I', 'G', 'H', 'T', ':', ' ',
+  MACRO_LCD_AT, 0, 2, MACRO_LCD_TEXT, 6, 'S', 'T', 'E', 'P', ':', ' ',
+  MACRO_LCD_AT, 0, 3, MACRO_LCD_TEXT, 10, 'P', 'R', 'O', 'G', 'R', 'E', 'S', 'S', ':', ' ',
+  MACRO_REPEAT, 0,
+    MACRO_LOOP_LIGHT(LAMP_A_RED, LIGHT_RED, 'R', 'E', 'D', ' ', ' ', ' '),
+    MACRO_LOOP_LIGHT(LAMP_A_YELLOW, LIGHT_YELLOW, 'Y', 'E', 'L', 'L', 'O', 'W'),
+    MACRO_LOOP_LIGHT(LAMP_A_GREEN, LIGHT_GREEN, 'G', 'R', 'E', 'E', 'N', ' '),
+  MACRO_NEXT,
+  MACRO_LAMPS, 0,
+  // Center "THANK YOU AZIZ" (14 chars) on row 1 of the 20-char display
+  MACRO_LCD_CLEAR,
+  MACRO_LCD_AT, 3, 1, MACRO_LCD_TEXT, 14, 'T', 'H', 'A', 'N', 'K', ' ', 'Y', 'O', 'U', ' ', 'A', 'Z', 'I', 'Z',
+  MACRO_WAIT, MACRO_U16(LOOP_OUTRO_MS),
+  MACRO_END
+};
+
+struct MacroStock {
+  const char* name;
+  const uint8_t* code;
+  uint16_t length;
+};
+
+const char MACRO_NAME_FLASH[] PROGMEM = "flash";
+const char MACRO_NAME_EMERGENCY[] PROGMEM = "emergency";
+const char MACRO_NAME_DEMO[] PROGMEM = "demo";
+const char MACRO_NAME_LOOP[] PROGMEM = "loop";
+
+enum MacroStockProgram {
+  MACRO_STOCK_FLASH,
+  MACRO_STOCK_EMERGENCY,
+  MACRO_STOCK_DEMO,
+  MACRO_STOCK_LOOP,
+  MACRO_STOCK_COUNT
+};
+
+const MacroStock MACRO_STOCK[MACRO_STOCK_COUNT] PROGMEM = {
+  {MACRO_NAME_FLASH, MACRO_CODE_FLASH, sizeof(MACRO_CODE_FLASH)},
+  {MACRO_NAME_EMERGENCY, MACRO_CODE_EMERGENCY, sizeof(MACRO_CODE_EMERGENCY)},
+  {MACRO_NAME_DEMO, MACRO_CODE_DEMO, sizeof(MACRO_CODE_DEMO)},
+  {MACRO_NAME_LOOP, MACRO_CODE_LOOP, sizeof(MACRO_CODE_LOOP)}
+};
+
+// ========== STORED PROGRAM LAYOUT ==========
+// Each EEPROM slot holds a header and the code. crc is CRC-16/CCITT-FALSE
+// over the name, the length and the code, so a save torn by a reset leaves
+// an empty slot. A name shorter than MACRO_NAME_MAX is padded with zeros;
+// a zero first byte marks a deleted slot.
+struct MacroHeader {
+  uint16_t crc;
+  uint8_t length;
+  char name[MACRO_NAME_MAX];
+};
+
+#define MACRO_CODE_MAX (MACRO_SLOT_SIZE - sizeof(MacroHeader))
+
+static_assert(MACRO_CODE_MAX <= 255, "MacroHeader::length cannot count MACRO_CODE_MAX bytes");
+static_assert(CONFIG_STORE_BASE + CONFIG_STORE_SLOTS * CONFIG_SLOT_SIZE <= MACRO_STORE_BASE, "macro slots overlap the config slots");
+static_assert(MACRO_STORE_BASE + MACRO_STORE_SLOTS * MACRO_SLOT_SIZE <= CONFIG_EEPROM_SIZE, "macro slots run past the end of EEPROM");
+
+#define MACRO_NONE 0xFF
+
+// ========== MACRO STATE STRUCTURES ==========
+// Where the running program's bytes are read from
+enum MacroMemory {
+  MACRO_IN_FLASH,
+  MACRO_IN_EEPROM,
+  MACRO_IN_RAM
+};
+
+struct MacroCode {
+  MacroMemory memory;
+  uintptr_t base;
+  uint16_t length;
+};
+
+struct MacroLoop {
+  uint16_t start;
+  uint8_t remaining;  // 0 for a loop that runs while the motor moves
+};
+
+// awaitLimit and awaitStart bound an AWAIT; lcdDirty means the frame has
+// changed since the last flush, which happens whenever the program yields
+struct MacroVm {
+  uint8_t program;
+  MacroCode code;
+  uint16_t pc;
+  uint8_t resources;
+  uint8_t depth;
+  MacroLoop loops[MACRO_LOOP_DEPTH];
+  bool awaiting;
+  uint16_t awaitLimit;
+  unsigned long awaitStart;
+  uint8_t lcdCol;
+  uint8_t lcdRow;
+  bool lcdDirty;
+  unsigned long startTime;
+};
+
+// An upload collects code in image until 'macro end', then the save task
+// copies image to EEPROM one byte per run like the config store does
+struct MacroImage {
+  MacroHeader header;
+  uint8_t code[MACRO_CODE_MAX];
+};
+
+struct MacroStore {
+  MacroImage image;
+  bool uploading;
+  bool writing;
+  uint8_t slot;
+  uint8_t writeOffset;
+};
+
+static MacroVm macroVm;
+static MacroStore macroStore;
+
+// ========== MACRO FUNCTION DECLARATIONS ==========
+void initializeMacros();
+bool startMacro(uint8_t program);
+void stopMacro(uint8_t resources);
+bool macroRunning();
+unsigned long runMacroTask();
+uint8_t findMacro(const char* name);
+bool macroCode(uint8_t program, MacroCode& code);
+bool verifyMacro(const MacroCode& code, uint8_t& resources);
+void printMacroName(Print& out, uint8_t program);
+void printMacros();
+bool beginMacroUpload(const char* name);
+bool appendMacroUpload(const uint8_t* bytes, uint8_t count);
+bool endMacroUpload();
+bool deleteMacro(uint8_t program);
+unsigned long runMacroSave();
+
+// Implemented in binary_protocol.h
+uint16_t crc16Update(uint16_t crc, uint8_t value);
+
+// ========== MACRO FUNCTION IMPLEMENTATIONS ==========
+
+void initializeMacros() {
+  macroVm.program = MACRO_NONE;
+  macroStore.uploading = false;
+  macroStore.writing = false;
+}
+
+static uint16_t macroSlotAddress(uint8_t slot) {
+  return MACRO_STORE_BASE + (uint16_t)slot * MACRO_SLOT_SIZE;
+}
+
+static uint8_t macroRead(const MacroCode& code, uint16_t offset) {
+  switch (code.memory) {
+    case MACRO_IN_FLASH:
+      return pgm_read_byte((const uint8_t*)code.base + offset);
+    case MACRO_IN_EEPROM:
+      return configEepromRead(code.base + offset);
+    default:
+      return ((const uint8_t*)code.base)[offset];
+  }
+}
+
+static uint16_t macroRead16(const MacroCode& code, uint16_t offset) {
+  return macroRead(code, offset) | (uint16_t)macroRead(code, offset + 1) << 8;
+}
+
+static long macroRead32(const MacroCode& code, uint16_t offset) {
+  return (int32_t)(macroRead16(code, offset) | (uint32_t)macroRead16(code, offset + 2) << 16);
+}
+
+// Size of the instruction at offset, which must hold a valid opcode
+static uint16_t macroInstructionLength(const MacroCode& code, uint16_t offset) {
+  uint8_t opcode = macroRead(code, offset);
+  uint16_t length = 1 + pgm_read_byte(&MACRO_OPERAND_BYTES[opcode]);
+  if (opcode == MACRO_LCD_TEXT) {
+    length += macroRead(code, offset + 1);
+  }
+  return length;
+}
+
+static void readMacroHeader(uint8_t slot, MacroHeader& header) {
+  uint8_t* bytes = (uint8_t*)&header;
+  uint16_t address = macroSlotAddress(slot);
+  for (uint8_t i = 0; i < sizeof(MacroHeader); i++) {
+    bytes[i] = configEepromRead(address + i);
+  }
+}
+
+static uint16_t macroHeaderCrc(const MacroHeader& header, const MacroCode& code) {
+  uint16_t crc = 0xFFFF;
+  for (uint8_t i = 0; i < MACRO_NAME_MAX; i++) {
+    crc = crc16Update(crc, header.name[i]);
+  }
+  crc = crc16Update(crc, header.length);
+  for (uint16_t i = 0; i < header.length; i++) {
+    crc = crc16Update(crc, macroRead(code, i));
+  }
+  return crc;
+}
+
+// Reads the header of a slot and checks it against the code behind it
+static bool readStoredMacro(uint8_t slot, MacroHeader& header, MacroCode& code) {
+  readMacroHeader(slot, header);
+  if (header.name[0] == 0 || (uint8_t)header.name[0] == 0xFF || header.length > MACRO_CODE_MAX) return false;
+  
+  code.memory = MACRO_IN_EEPROM;
+  code.base = macroSlotAddress(slot) + sizeof(MacroHeader);
+  code.length = header.length;
+  return header.crc == macroHeaderCrc(header, code);
+}
+
+bool macroCode(uint8_t program, MacroCode& code) {
+  if (program < MACRO_STOCK_COUNT) {
+    code.memory = MACRO_IN_FLASH;
+    code.base = (uintptr_t)pgm_read_ptr(&MACRO_STOCK[program].code);
+    code.length = pgm_read_word(&MACRO_STOCK[program].length);
+    return true;
+  }
+  
+  uint8_t slot = program - MACRO_STOCK_COUNT;
+  if (slot >= MACRO_STORE_SLOTS || (macroStore.writing && macroStore.slot == slot)) return false;
+  MacroHeader header;
+  return readStoredMacro(slot, header, code);
+}
+
+// Checks that every instruction is whole and its operands in range, that
+// loops nest at most MACRO_LOOP_DEPTH deep and close, and that END comes
+// last, so the VM itself never has to check
+bool verifyMacro(const MacroCode& code, uint8_t& resources) {
+  uint16_t pc = 0;
+  uint8_t depth = 0;
+  resources = 0;
+  
+  while (pc < code.length) {
+    uint8_t opcode = macroRead(code, pc);
+    if (opcode >= MACRO_OPCODE_COUNT) return false;
+    if (opcode == MACRO_LCD_TEXT && pc + 1 >= code.length) return false;
+    uint16_t length = macroInstructionLength(code, pc);
+    if (pc + length > code.length) return false;
+    
+    switch (opcode) {
+      case MACRO_END:
+        return depth == 0 && pc + 1 == code.length;
+      
+      case MACRO_MOVE: {
+        long steps = macroRead32(code, pc + 1);
+        if (!validateStepCount(steps < 0 ? -steps : steps)) return false;
+        resources |= MACRO_USES_MOTOR;
+        break;
+      }
+      
+      case MACRO_GOTO: {
+        long position = macroRead32(code, pc + 1);
+        if (position < -MAX_POSITION_STEPS || position > MAX_POSITION_STEPS) return false;
+        resources |= MACRO_USES_MOTOR;
+        break;
+      }
+      
+      case MACRO_LAMPS:
+        resources |= MACRO_USES_LAMPS;
+        break;
+      
+      case MACRO_REPEAT:
+        if (++depth > MACRO_LOOP_DEPTH) return false;
+        break;
+      
+      case MACRO_NEXT:
+        if (depth == 0) return false;
+        depth--;
+        break;
+      
+      case MACRO_LCD_AT:
+        if (macroRead(code, pc + 1) >= LCD_COLUMNS || macroRead(code, pc + 2) >= LCD_ROWS) return false;
+        resources |= MACRO_USES_LCD;
+        break;
+      
+      case MACRO_LCD_PERCENT:
+        if (macroRead32(code, pc + 1) <= 0) return false;
+        resources |= MACRO_USES_LCD;
+        break;
+      
+      case MACRO_LCD_CLEAR:
+      case MACRO_LCD_TEXT:
+      case MACRO_LCD_STEPS:
+        resources |= MACRO_USES_LCD;
+        break;
+      
+      case MACRO_EVENT:
+        if (macroRead(code, pc + 1) >= LOG_EVENT_COUNT) return false;
+        break;
+    }
+    pc += length;
+  }
+  return false;
+}
+
+// Replaces any running program. Lamp programs stop the traffic cycle; LCD
+// programs keep the status screen away until they end.
+bool startMacro(uint8_t program) {
+  MacroCode code;
+  uint8_t resources;
+  if (!macroCode(program, code) || !verifyMacro(code, resources)) return false;
+  
+  stopMacro(MACRO_USES_ALL);
+  if (resources & MACRO_USES_LAMPS) {
+    stopTrafficSequences();
+  }
+  if (resources & MACRO_USES_LCD) {
+    disableAutoLCDUpdate = true;
+  }
+  
+  macroVm.program = program;
+  macroVm.code = code;
+  macroVm.pc = 0;
+  macroVm.resources = resources;
+  macroVm.depth = 0;
+  macroVm.awaiting = false;
+  macroVm.lcdCol = 0;
+  macroVm.lcdRow = 0;
+  macroVm.lcdDirty = false;
+  macroVm.startTime = millis();
+  scheduleTask(TASK_MACRO, runMacroTask, 0);
+  return true;
+}
+
+// Ends the program. One that finished releases the motor coils if it
+// moved the motor; one stopped early also stops the motor and lamps it was
+// driving.
+static void endMacro(bool finished) {
+  cancelTask(TASK_MACRO);
+  uint8_t resources = macroVm.resources;
+  macroVm.program = MACRO_NONE;
+  
+  if ((resources & MACRO_USES_MOTOR) && (!finished || !motorState.isRunning)) {
+    stopMotor();
+  }
+  if ((resources & MACRO_USES_LAMPS) && !finished) {
+    setTrafficLamps(0);
+  }
+  if (resources & MACRO_USES_LCD) {
+    disableAutoLCDUpdate = false;
+    if (finished) {
+      holdLCDScreen(0);
+    }
+  }
+}
+
+// Stops the running program if it drives any of resources
+void stopMacro(uint8_t resources) {
+  if (macroVm.program != MACRO_NONE && (macroVm.resources & resources)) {
+    endMacro(false);
+  }
+}
+
+bool macroRunning() {
+  return macroVm.program != MACRO_NONE;
+}
+
+// Moves pc past the NEXT that closes the innermost loop and drops the loop
+static void leaveMacroLoop() {
+  uint8_t nesting = 0;
+  for (;;) {
+    uint8_t opcode = macroRead(macroVm.code, macroVm.pc);
+    macroVm.pc += macroInstructionLength(macroVm.code, macroVm.pc);
+    if (opcode == MACRO_REPEAT) {
+      nesting++;
+    } else if (opcode == MACRO_NEXT && nesting-- == 0) {
+      break;
+    }
+  }
+  macroVm.depth--;
+}
+
+static void macroLcdPrinted(const LcdFramePrinter& printer) {
+  macroVm.lcdCol = printer.column();
+  macroVm.lcdDirty = true;
+}
+
+// Scheduler task: runs instructions until one waits, returning the time
+// to the next run, or until MACRO_OPS_PER_RUN have run so a program
+// without waits still shares the loop
+unsigned long runMacroTask() {
+  if (macroVm.awaiting) {
+    if (motorState.isRunning && (macroVm.awaitLimit == 0 || millis() - macroVm.awaitStart < macroVm.awaitLimit)) {
+      return MACRO_POLL_MS;
+    }
+    macroVm.awaiting = false;
+  }
+  if (macroVm.depth > 0 && macroVm.loops[macroVm.depth - 1].remaining == 0 && !motorState.isRunning) {
+    leaveMacroLoop();
+  }
+  
+  const MacroCode& code = macroVm.code;
+  unsigned long wait = 0;
+  for (uint8_t n = 0; n < MACRO_OPS_PER_RUN && wait == 0; n++) {
+    uint16_t pc = macroVm.pc;
+    uint8_t opcode = macroRead(code, pc);
+    macroVm.pc += macroInstructionLength(code, pc);
+    
+    switch (opcode) {
+      case MACRO_END:
+        if (macroVm.lcdDirty) {
+          lcdFlush();
+        }
+        logEvent(LOG_MACRO_DONE, macroVm.program, millis() - macroVm.startTime);
+        endMacro(true);
+        return TASK_DONE;
+      
+      case MACRO_LAMPS:
+        setTrafficLamps(macroRead(code, pc + 1));
+        break;
+      
+      case MACRO_WAIT:
+        wait = macroRead16(code, pc + 1);
+        break;
+      
+      case MACRO_MOVE: {
+        long steps = macroRead32(code, pc + 1);
+        moveSteps(steps < 0 ? -steps : steps, steps < 0 ? COUNTER_CLOCKWISE : CLOCKWISE);
+        break;
+      }
+      
+      case MACRO_GOTO:
+        moveToPosition(macroRead32(code, pc + 1));
+        break;
+      
+      case MACRO_AWAIT:
+        if (motorState.isRunning) {
+          macroVm.awaiting = true;
+          macroVm.awaitLimit = macroRead16(code, pc + 1);
+          macroVm.awaitStart = millis();
+          wait = MACRO_POLL_MS;
+        }
+        break;
+      
+      case MACRO_REPEAT: {
+        uint8_t count = macroRead(code, pc + 1);
+        if (count == 0 && !motorState.isRunning) {
+          macroVm.depth++;
+          leaveMacroLoop();
+        } else {
+          macroVm.loops[macroVm.depth].start = macroVm.pc;
+          macroVm.loops[macroVm.depth].remaining = count;
+          macroVm.depth++;
+        }
+        break;
+      }
+      
+      case MACRO_NEXT: {
+        MacroLoop& loop = macroVm.loops[macroVm.depth - 1];
+        bool again = loop.remaining == 0 ? motorState.isRunning : --loop.remaining > 0;
+        if (again) {
+          macroVm.pc = loop.start;
+        } else {
+          macroVm.depth--;
+        }
+        break;
+      }
+      
+      case MACRO_LCD_CLEAR:
+        lcdClearFrame();
+        macroVm.lcdDirty = true;
+        break;
+      
+      case MACRO_LCD_AT:
+        macroVm.lcdCol = macroRead(code, pc + 1);
+        macroVm.lcdRow = macroRead(code, pc + 2);
+        break;
+      
+      case MACRO_LCD_TEXT: {
+        LcdFramePrinter printer(macroVm.lcdCol, macroVm.lcdRow);
+        uint8_t length = macroRead(code, pc + 1);
+        for (uint8_t i = 0; i < length; i++) {
+          printer.write(macroRead(code, pc + 2 + i));
+        }
+        macroLcdPrinted(printer);
+        break;
+      }
+      
+      case MACRO_LCD_STEPS: {
+        LcdFramePrinter printer(macroVm.lcdCol, macroVm.lcdRow);
+        printer.print(getMotorStepsCompleted());
+        macroLcdPrinted(printer);
+        break;
+      }
+      
+      case MACRO_LCD_PERCENT: {
+        // Tenths of a percent
+        long progress = getMotorStepsCompleted() * 1000L / macroRead32(code, pc + 1);
+        LcdFramePrinter printer(macroVm.lcdCol, macroVm.lcdRow);
+        printItems(printer, fixed(progress, 1), '%');
+        macroLcdPrinted(printer);
+        break;
+      }
+      
+      case MACRO_EVENT:
+        logEvent((LogEvent)macroRead(code, pc + 1), macroRead16(code, pc + 2), getMotorStepsCompleted());
+        break;
+    }
+  }
+  
+  if (macroVm.lcdDirty) {
+    lcdFlush();
+    macroVm.lcdDirty = false;
+  }
+  return wait;
+}
+
+// Stored names are matched exactly; names are lower case, stock names
+// cannot be reused
+uint8_t findMacro(const char* name) {
+  for (uint8_t i = 0; i < MACRO_STOCK_COUNT; i++) {
+    if (strcmp_P(name, (const char*)pgm_read_ptr(&MACRO_STOCK[i].name)) == 0) return i;
+  }
+  
+  for (uint8_t slot = 0; slot < MACRO_STORE_SLOTS; slot++) {
+    MacroHeader header;
+    MacroCode code;
+    if (readStoredMacro(slot, header, code) && strncmp(name, header.name, MACRO_NAME_MAX) == 0 &&
+        strlen(name) <= MACRO_NAME_MAX) {
+      return MACRO_STOCK_COUNT + slot;
+    }
+  }
+  return MACRO_NONE;
+}
+
+void printMacroName(Print& out, uint8_t program) {
+  if (program < MACRO_STOCK_COUNT) {
+    out.print(FPSTR(pgm_read_ptr(&MACRO_STOCK[program].name)));
+    return;
+  }
+  
+  MacroHeader header;
+  readMacroHeader(program - MACRO_STOCK_COUNT, header);
+  for (uint8_t i = 0; i < MACRO_NAME_MAX && header.name[i] != '\0'; i++) {
+    out.print(header.name[i]);
+  }
+}
+
+void printMacros() {
+  console.print(F("Stock:"));
+  for (uint8_t i = 0; i < MACRO_STOCK_COUNT; i++) {
+    console.print(' ');
+    printMacroName(console, i);
+  }
+  console.println();
+  
+  uint8_t used = 0;
+  for (uint8_t slot = 0; slot < MACRO_STORE_SLOTS; slot++) {
+    MacroHeader header;
+    MacroCode code;
+    if (readStoredMacro(slot, header, code)) {
+      console.print(used++ == 0 ? F("Stored: ") : F(", "));
+      printMacroName(console, MACRO_STOCK_COUNT + slot);
+      printItems(console, F(" ("), header.length, F(" bytes)"));
+    }
+  }
+  if (used > 0) {
+    console.println();
+  }
+  printLine(console, MACRO_STORE_SLOTS - used, F(" of "), MACRO_STORE_SLOTS, F(" slots free, "), MACRO_CODE_MAX, F(" bytes each"));
+  
+  if (macroVm.program != MACRO_NONE) {
+    console.print(F("Running: "));
+    printMacroName(console, macroVm.program);
+    printLine(console, F(" at byte "), macroVm.pc);
+  }
+  if (macroStore.writing) {
+    console.println(F("Save in progress"));
+  }
+}
+
+bool beginMacroUpload(const char* name) {
+  if (macroStore.writing) return false;
+  
+  MacroHeader& header = macroStore.image.header;
+  memset(header.name, 0, MACRO_NAME_MAX);
+  strncpy(header.name, name, MACRO_NAME_MAX);
+  header.length = 0;
+  macroStore.uploading = true;
+  return true;
+}
+
+bool appendMacroUpload(const uint8_t* bytes, uint8_t count) {
+  MacroHeader& header = macroStore.image.header;
+  if (!macroStore.uploading || header.length + count > MACRO_CODE_MAX) return false;
+  
+  memcpy(macroStore.image.code + header.length, bytes, count);
+  header.length += count;
+  return true;
+}
+
+// Verifies the upload and starts saving it, over a program of the same
+// name or into the first free slot
+bool endMacroUpload() {
+  if (!macroStore.uploading) return false;
+  macroStore.uploading = false;
+  
+  MacroImage& image = macroStore.image;
+  MacroCode code = {MACRO_IN_RAM, (uintptr_t)image.code, image.header.length};
+  uint8_t resources;
+  if (!verifyMacro(code, resources)) return false;
+  
+  char name[MACRO_NAME_MAX + 1];
+  memcpy(name, image.header.name, MACRO_NAME_MAX);
+  name[MACRO_NAME_MAX] = '\0';
+  uint8_t program = findMacro(name);
+  uint8_t slot = program != MACRO_NONE ? program - MACRO_STOCK_COUNT : 0;
+  if (program == MACRO_NONE) {
+    MacroHeader header;
+    MacroCode stored;
+    while (slot < MACRO_STORE_SLOTS && readStoredMacro(slot, header, stored)) {
+      slot++;
+    }
+    if (slot == MACRO_STORE_SLOTS) return false;
+  }
+  
+  if (program != MACRO_NONE && macroVm.program == program) {
+    endMacro(false);
+  }
+  image.header.crc = macroHeaderCrc(image.header, code);
+  macroStore.slot = slot;
+  macroStore.writeOffset = 0;
+  macroStore.writing = true;
+  scheduleTask(TASK_MACRO_SAVE, runMacroSave, 0);
+  return true;
+}
+
+// Clearing the first name byte is a single EEPROM write
+bool deleteMacro(uint8_t program) {
+  if (program < MACRO_STOCK_COUNT || program == MACRO_NONE || macroStore.writing || configStore.writing) return false;
+  
+  if (macroVm.program == program) {
+    endMacro(false);
+  }
+  configEepromWrite(macroSlotAddress(program - MACRO_STOCK_COUNT) + offsetof(MacroHeader, name), 0);
+  return true;
+}
+
+// Scheduler task: programs one changed byte of the image per run, waiting
+// out a config save so the two never queue EEPROM writes behind each other
+unsigned long runMacroSave() {
+  if (configStore.writing) return CONFIG_BYTE_WRITE_MS;
+  
+  const uint8_t* bytes = (const uint8_t*)&macroStore.image;
+  uint16_t address = macroSlotAddress(macroStore.slot);
+  uint8_t size = sizeof(MacroHeader) + macroStore.image.header.length;
+  while (macroStore.writeOffset < size) {
+    uint8_t i = macroStore.writeOffset++;
+    if (configEepromRead(address + i) != bytes[i]) {
+      configEepromWrite(address + i, bytes[i]);
+      return CONFIG_BYTE_WRITE_MS;
+    }
+  }
+  
+  macroStore.writing = false;
+  MacroHeader header;
+  MacroCode code;
+  bool saved = readStoredMacro(macroStore.slot, header, code);
+  logEvent(saved ? LOG_MACRO_SAVED : LOG_MACRO_SAVE_FAILED, MACRO_STOCK_COUNT + macroStore.slot);
+  return TASK_DONE;
+}
+
+#endif // MACRO_VM_H
@@ -7,53 +7,104 @@
  */
 
 #include <Arduino.h>
-#include <LiquidCrystal_I2C.h>
 #include "config.h"
+#include "console.h"
 #include "motor.h"
 #include "traffic_light.h"
 #include "commands.h"
 #include "lcd.h"
+#include "serial_input.h"
+#include "bench.h"
+#include "stats.h"
+#include "binary_protocol.h"
+#include "idle_sleep.h"
+#include "config_store.h"
+#include "event_log.h"
+#include "macro_vm.h"
+#include "trace.h"
 
 // ========== GLOBAL STATE INSTANCES ==========
 MotorState motorState;
+AxisX axisX;
+AxisY axisY;
+#if MOTION_AXIS_COUNT > 2
+AxisZ axisZ;
+#endif
+#if MOTION_AXIS_COUNT > 3
+AxisA axisA;
+#endif
 TrafficLightState_t trafficLight;
-LiquidCrystal_I2C lcd(LCD_ADDRESS, LCD_COLUMNS, LCD_ROWS);
+LcdI2CAsync lcd(LCD_ADDRESS, LCD_COLUMNS, LCD_ROWS);
+LcdFrameBuffer lcdFrame;
 bool disableAutoLCDUpdate = false;
+SerialInputState serialInput;
+Scheduler scheduler;
+RuntimeStats runtimeStats;
+ConsoleOutput console;
+ConfigStore configStore;
+EventLogState eventLog;
+TraceState traceRecorder;
+
+// Under pio test the suites for the board bring their own setup() and loop()
+// and call into the firmware directly; the native suites drive these
+#if !defined(PIO_UNIT_TESTING) || defined(ARDUINO_SIM)
 
 /**
  * @brief Initialize the system
- * @details Sets up serial communication, motor, and traffic light systems
+ * @details Sets up serial communication, motor, and traffic light systems.
+ *          The settings stored in EEPROM are applied before the LCD comes
+ *          up, so an auto-started traffic cycle lights the lamps within
+ *          milliseconds of reset; fast boot also leaves out the splash.
  */
 void setup() {
+  statsPaintStack();
+  initializeEventLog();
+  initializeTrace();
   Serial.begin(SERIAL_BAUD_RATE);
+  initializeSerialInput();
+  initializeScheduler();
+  initializeMacros();
   
-  initializeLCD();
+  loadStoredConfig();
   initializeMotor();
   initializeTrafficLight();
+  applyStoredConfig();
+  initializeLCD(!(configStore.flags & CONFIG_FLAG_FAST_BOOT));
   
-  Serial.println("=== STEPPER MOTOR AND TRAFFIC LIGHT CONTROLLER ===");
-  Serial.println("System initialized successfully!");
-  Serial.println("Type 'help' for available commands");
-  Serial.println();
+  console.println(F("=== STEPPER MOTOR AND TRAFFIC LIGHT CONTROLLER ==="));
+  console.println(F("System initialized successfully!"));
+  console.println(F("Type 'help' for available commands"));
+  console.println();
+  printStoredConfig();
   printTrafficTiming();
+  resetStats();
 }
 
 /**
  * @brief Main program loop
- * @details Handles traffic light cycle and processes serial commands
+ * @details Processes serial commands (text or binary frames), then runs due scheduler tasks (traffic
+ *          cycle, LCD refresh, light and motor sequences). Nothing here
+ *          blocks, so each pass is bounded. Records the tasks logged are
+ *          written out as the UART has room for them, as are the lines of a
+ *          trace dump. A requested benchmark run starts here, outside
+ *          any command handler. With nothing left to do the pass ends in
+ *          idle sleep until the next deadline.
  */
 void loop() {
-  runTrafficLightCycle();
-  
-  static unsigned long lastLCDUpdate = 0;
-  if (!disableAutoLCDUpdate && millis() - lastLCDUpdate > 500) {
-    updateLCDStatus();
-    lastLCDUpdate = millis();
+  statsRecordLoopPass();
+  if (benchmarkPending()) {
+    runBenchmarks();
   }
-  
-  if (Serial.available()) {
-    String input = Serial.readString();
-    processCommand(input);
+  if (binaryProtocolActive()) {
+    pollBinaryProtocol();
+  } else {
+    pollSerialInput();
   }
+  runScheduler();
+  lcdService();
+  logService();
+  traceService();
+  idleSleep();
 }
 
+#endif // !PIO_UNIT_TESTING || ARDUINO_SIM
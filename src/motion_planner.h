@@ -0,0 +1,110 @@
+#ifndef MOTION_PLANNER_H
+#define MOTION_PLANNER_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// ========== MOTION PROFILE STRUCTURE ==========
+// Intervals are step timer ticks in 24.8 fixed point. rampStep is the index
+// on the acceleration ramp, which is also the number of steps needed to stop.
+struct MotionProfile {
+  uint32_t firstInterval;
+  uint32_t minInterval;
+  volatile uint32_t interval;
+  volatile long rampStep;
+};
+
+// ========== MOTION PLANNER FUNCTION DECLARATIONS ==========
+void plannerConfigure(MotionProfile& profile, unsigned int acceleration, unsigned int maxSpeed);
+void plannerSetMaxSpeed(MotionProfile& profile, unsigned int maxSpeed);
+uint16_t plannerStart(MotionProfile& profile);
+uint16_t plannerNextInterval(MotionProfile& profile, long stepsToGo);
+uint16_t plannerTicks(uint32_t interval);
+
+// ========== MOTION PLANNER FUNCTION IMPLEMENTATIONS ==========
+
+static uint32_t plannerSqrt(uint32_t value) {
+  uint32_t root = 0;
+  uint32_t bit = 1UL << 30;
+  while (bit > value) {
+    bit >>= 2;
+  }
+  while (bit != 0) {
+    if (value >= root + bit) {
+      value -= root + bit;
+      root = (root >> 1) + bit;
+    } else {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+  return root;
+}
+
+void plannerConfigure(MotionProfile& profile, unsigned int acceleration, unsigned int maxSpeed) {
+  // Austin: c0 = 0.676 * f * sqrt(2 / a). Scaling a by 256 keeps three more
+  // bits of the square root; the constant is folded at compile time.
+  const uint32_t c0Numerator = (uint32_t)(0.676 * 1.41421356 * STEP_TIMER_TICKS_PER_MS * 1000.0 * 256.0 * 16.0);
+  uint32_t firstInterval = c0Numerator / plannerSqrt((uint32_t)acceleration << 8);
+  if (firstInterval > PLANNER_MAX_INTERVAL) {
+    firstInterval = PLANNER_MAX_INTERVAL;
+  }
+  
+  noInterrupts();
+  profile.firstInterval = firstInterval;
+  interrupts();
+  plannerSetMaxSpeed(profile, maxSpeed);
+}
+
+void plannerSetMaxSpeed(MotionProfile& profile, unsigned int maxSpeed) {
+  uint32_t minInterval = (STEP_TIMER_TICKS_PER_MS * 1000UL << 8) / maxSpeed;
+  
+  noInterrupts();
+  profile.minInterval = minInterval;
+  interrupts();
+}
+
+uint16_t plannerStart(MotionProfile& profile) {
+  profile.rampStep = 0;
+  profile.interval = profile.firstInterval > profile.minInterval ? profile.firstInterval : profile.minInterval;
+  return plannerTicks(profile.interval);
+}
+
+uint16_t plannerNextInterval(MotionProfile& profile, long stepsToGo) {
+  uint32_t interval = profile.interval;
+  long rampStep = profile.rampStep;
+  
+  bool mustStop = stepsToGo <= rampStep;
+  
+  if (mustStop || interval < profile.minInterval) {
+    // Decelerate: run the Austin recurrence backwards down the ramp
+    if (rampStep > 0) {
+      interval += (2 * interval) / (4 * rampStep - 1);
+      rampStep--;
+    }
+    if (!mustStop && interval > profile.minInterval) {
+      interval = profile.minInterval;
+    }
+  } else if (interval > profile.minInterval) {
+    // Accelerate: c(n) = c(n-1) - 2 * c(n-1) / (4n + 1)
+    rampStep++;
+    interval -= (2 * interval) / (4 * rampStep + 1);
+    if (interval < profile.minInterval) {
+      interval = profile.minInterval;
+    }
+  }
+  
+  profile.interval = interval;
+  profile.rampStep = rampStep;
+  return plannerTicks(interval);
+}
+
+uint16_t plannerTicks(uint32_t interval) {
+  uint32_t ticks = (interval + 128) >> 8;
+  if (ticks > 0xFFFF) {
+    return 0xFFFF;
+  }
+  return ticks < 1 ? 1 : ticks;
+}
+
+#endif // MOTION_PLANNER_H
@@ -3,103 +3,426 @@
 
 #include <Arduino.h>
 #include "config.h"
+#include "console.h"
+#include "coil_output.h"
+#include "step_timer.h"
+#include "motion_planner.h"
+#include "scheduler.h"
+#include "stats.h"
+#include "event_log.h"
+#include "trace.h"
 
 // ========== MOTOR STATE STRUCTURE ==========
+// Fields marked volatile are advanced by the step timer interrupt
 struct MotorState {
-  int currentStep;
   int stepDelay;
-  bool isRunning;
+  unsigned int maxSpeed;
+  unsigned int acceleration;
+  MotionProfile profile;
+  volatile bool isRunning;
+  volatile MotorDirection direction;
+  volatile long stepsRemaining;
+  volatile long stepsCompleted;
+};
+
+// ========== MOTION QUEUE STRUCTURE ==========
+// Segments waiting behind the one the step interrupt is running. The main
+// loop only adds at head and the interrupt only takes from tail.
+// stepsAhead counts the queued steps that continue the running direction
+// without a reversal, so the planner can carry speed across junctions;
+// chainOpen is cleared once a reversal is queued and nothing after it counts.
+struct MotionSegment {
+  long steps;
+  MotorDirection direction;
+};
+
+struct MotionQueue {
+  MotionSegment segments[MOTION_QUEUE_SIZE];
+  volatile uint8_t head;
+  volatile uint8_t tail;
+  volatile long stepsAhead;
+  volatile bool chainOpen;
+};
+
+// ========== LINEAR MOVE STRUCTURE ==========
+// Bresenham state for a coordinated move. The axis with the most steps
+// (majorSteps) steps on every timer tick and sets the planner's step count;
+// each other axis adds its own count to error per tick and steps when error
+// reaches majorSteps, so every axis finishes on the same tick.
+struct LinearMove {
+  volatile bool active;
+  long steps[MOTION_AXIS_COUNT];
+  int8_t direction[MOTION_AXIS_COUNT];
+  long error[MOTION_AXIS_COUNT];
+  long majorSteps;
 };
 
 // ========== GLOBAL MOTOR STATE ==========
 extern MotorState motorState;
 
+static MotionQueue motionQueue;
+static LinearMove linearMove;
+
 // ========== MOTOR FUNCTION DECLARATIONS ==========
 void initializeMotor();
 void executeStep(MotorDirection direction);
-void moveSteps(int steps, MotorDirection direction);
+void moveSteps(long steps, MotorDirection direction);
+bool queueMove(long steps, MotorDirection direction);
+bool moveLinear(const long steps[MOTION_AXIS_COUNT]);
+bool moveToPosition(long target);
+long getMotorPosition();
+bool zeroMotorPosition();
+uint8_t motionQueueDepth();
+uint8_t motionQueueFree();
+long getMotorStepsCompleted();
 void stopMotor();
-void runMotorDemo();
-bool setMotorSpeed(int speed);
-bool validateStepCount(int steps);
+bool setMotorSpeed(long speed);
+bool setMotorMaxSpeed(long stepsPerSecond);
+bool setMotorAcceleration(long stepsPerSecond2);
+bool setMotorDriveMode(DriveMode mode);
+bool validateStepCount(long steps);
 
 // ========== MOTOR FUNCTION IMPLEMENTATIONS ==========
 
+static void clearMotionQueue() {
+  motionQueue.head = 0;
+  motionQueue.tail = 0;
+  motionQueue.stepsAhead = 0;
+  motionQueue.chainOpen = true;
+}
+
 void initializeMotor() {
-  pinMode(MOTOR_IN1_PIN, OUTPUT);
-  pinMode(MOTOR_IN2_PIN, OUTPUT);
-  pinMode(MOTOR_IN3_PIN, OUTPUT);
-  pinMode(MOTOR_IN4_PIN, OUTPUT);
+  initializeCoils();
   
-  motorState.currentStep = 0;
   motorState.stepDelay = DEFAULT_STEP_DELAY_MS;
+  motorState.maxSpeed = DEFAULT_MAX_SPEED_SPS;
+  motorState.acceleration = DEFAULT_ACCELERATION_SPS2;
+  plannerConfigure(motorState.profile, motorState.acceleration, motorState.maxSpeed);
   motorState.isRunning = false;
+  motorState.direction = CLOCKWISE;
+  motorState.stepsRemaining = 0;
+  motorState.stepsCompleted = 0;
+  linearMove.active = false;
+  clearMotionQueue();
   
   stopMotor();
 }
 
 void executeStep(MotorDirection direction) {
-  if (direction == CLOCKWISE) {
-    motorState.currentStep = (motorState.currentStep + 1) % MOTOR_STEPS_PER_REVOLUTION;
-  } else {
-    motorState.currentStep = (motorState.currentStep - 1 + MOTOR_STEPS_PER_REVOLUTION) % MOTOR_STEPS_PER_REVOLUTION;
+  axisX.step(direction == CLOCKWISE ? 1 : -1);
+  traceEvent(TRACE_COIL, axisX.pattern());
+}
+
+template <class Axis>
+static inline void linearMoveStepAxis(Axis& axis, uint8_t index) {
+  long error = linearMove.error[index] + linearMove.steps[index];
+  if (error >= linearMove.majorSteps) {
+    error -= linearMove.majorSteps;
+    axis.step(linearMove.direction[index]);
+    traceEvent(TRACE_COIL, index << 4 | axis.pattern());
+  }
+  linearMove.error[index] = error;
+}
+
+// One major-axis tick of a coordinated move; unrolled at compile time so
+// each axis costs an add, a compare and at most one step
+static void linearMoveStep() {
+  linearMoveStepAxis(axisX, 0);
+  linearMoveStepAxis(axisY, 1);
+#if MOTION_AXIS_COUNT > 2
+  linearMoveStepAxis(axisZ, 2);
+#endif
+#if MOTION_AXIS_COUNT > 3
+  linearMoveStepAxis(axisA, 3);
+#endif
+}
+
+// Recounts stepsAhead from the queue after the direction has changed
+static void scanMotionChain() {
+  long ahead = 0;
+  uint8_t i = motionQueue.tail;
+  motionQueue.chainOpen = true;
+  while (i != motionQueue.head) {
+    if (motionQueue.segments[i].direction != motorState.direction) {
+      motionQueue.chainOpen = false;
+      break;
+    }
+    ahead += motionQueue.segments[i].steps;
+    i = (i + 1) & (MOTION_QUEUE_SIZE - 1);
   }
+  motionQueue.stepsAhead = ahead;
+}
+
+// Called from the step interrupt when a segment runs out. A segment in the
+// same direction continues at the current speed because its steps were
+// already part of the deceleration distance; a reversal has slowed to rest
+// and restarts the ramp, as does the first segment after a coordinated
+// move. Sets the interval to the next step either way.
+static bool takeNextSegment() {
+  if (motionQueue.tail == motionQueue.head) return false;
   
-  digitalWrite(MOTOR_IN1_PIN, MOTOR_STEP_SEQUENCE[motorState.currentStep][0]);
-  digitalWrite(MOTOR_IN2_PIN, MOTOR_STEP_SEQUENCE[motorState.currentStep][1]);
-  digitalWrite(MOTOR_IN3_PIN, MOTOR_STEP_SEQUENCE[motorState.currentStep][2]);
-  digitalWrite(MOTOR_IN4_PIN, MOTOR_STEP_SEQUENCE[motorState.currentStep][3]);
+  const MotionSegment& next = motionQueue.segments[motionQueue.tail];
+  motionQueue.tail = (motionQueue.tail + 1) & (MOTION_QUEUE_SIZE - 1);
+  motorState.stepsRemaining = next.steps;
   
-  delay(motorState.stepDelay);
+  if (next.direction == motorState.direction && !linearMove.active) {
+    motionQueue.stepsAhead -= next.steps;
+    stepTimerSetInterval(plannerNextInterval(motorState.profile, motorState.stepsRemaining + motionQueue.stepsAhead));
+  } else {
+    linearMove.active = false;
+    motorState.direction = next.direction;
+    scanMotionChain();
+    stepTimerSetInterval(plannerStart(motorState.profile));
+  }
+  return true;
 }
 
-void moveSteps(int steps, MotorDirection direction) {
-  if (!validateStepCount(steps)) {
-    Serial.println("Error: Invalid step count");
+void onStepTimerTick() {
+  statsRecordStepLatency(stepTimerLatency());
+  
+  if (motorState.stepsRemaining <= 0) {
+    stepTimerStop();
+    linearMove.active = false;
+    motorState.isRunning = false;
     return;
   }
   
+  if (linearMove.active) {
+    linearMoveStep();
+  } else {
+    executeStep(motorState.direction);
+  }
+  motorState.stepsRemaining--;
+  motorState.stepsCompleted++;
+  
+  if (motorState.stepsRemaining > 0) {
+    stepTimerSetInterval(plannerNextInterval(motorState.profile, motorState.stepsRemaining + motionQueue.stepsAhead));
+  } else if (!takeNextSegment()) {
+    stepTimerStop();
+    linearMove.active = false;
+    motorState.isRunning = false;
+  }
+}
+
+// Replaces whatever is running or queued; the step timer interrupt does
+// the stepping
+static void startMove(long steps, MotorDirection direction) {
+  stepTimerStop();
+  noInterrupts();
+  clearMotionQueue();
+  linearMove.active = false;
+  motorState.direction = direction;
+  motorState.stepsRemaining = steps;
+  motorState.stepsCompleted = 0;
   motorState.isRunning = true;
+  interrupts();
   
-  for (int i = 0; i < steps; i++) {
-    executeStep(direction);
+  stepTimerStart(plannerStart(motorState.profile));
+}
+
+void moveSteps(long steps, MotorDirection direction) {
+  if (!validateStepCount(steps)) {
+    console.println(F("Error: Invalid step count"));
+    return;
+  }
+  startMove(steps, direction);
+}
+
+// Appends a move behind the running one, or starts it when the motor is
+// idle. Returns false when the queue is full.
+bool queueMove(long steps, MotorDirection direction) {
+  if (!validateStepCount(steps)) {
+    console.println(F("Error: Invalid step count"));
+    return false;
   }
   
-  motorState.isRunning = false;
+  noInterrupts();
+  if (!motorState.isRunning) {
+    interrupts();
+    moveSteps(steps, direction);
+    return true;
+  }
+  
+  uint8_t next = (motionQueue.head + 1) & (MOTION_QUEUE_SIZE - 1);
+  if (next == motionQueue.tail) {
+    interrupts();
+    return false;
+  }
+  motionQueue.segments[motionQueue.head].steps = steps;
+  motionQueue.segments[motionQueue.head].direction = direction;
+  motionQueue.head = next;
+  if (motionQueue.chainOpen && !linearMove.active && direction == motorState.direction) {
+    motionQueue.stepsAhead += steps;
+  } else {
+    motionQueue.chainOpen = false;
+  }
+  interrupts();
+  return true;
 }
 
-void stopMotor() {
-  digitalWrite(MOTOR_IN1_PIN, LOW);
-  digitalWrite(MOTOR_IN2_PIN, LOW);
-  digitalWrite(MOTOR_IN3_PIN, LOW);
-  digitalWrite(MOTOR_IN4_PIN, LOW);
-  motorState.isRunning = false;
+// Starts a coordinated move of steps[i] on axis i (negative is reverse),
+// replacing whatever is running or queued. The longest axis sets the pace.
+bool moveLinear(const long steps[MOTION_AXIS_COUNT]) {
+  long majorSteps = 0;
+  for (uint8_t i = 0; i < MOTION_AXIS_COUNT; i++) {
+    long count = steps[i] < 0 ? -steps[i] : steps[i];
+    if (count > majorSteps) {
+      majorSteps = count;
+    }
+  }
+  if (!validateStepCount(majorSteps)) {
+    console.println(F("Error: Invalid step count"));
+    return false;
+  }
+  
+  stepTimerStop();
+  noInterrupts();
+  clearMotionQueue();
+  for (uint8_t i = 0; i < MOTION_AXIS_COUNT; i++) {
+    linearMove.steps[i] = steps[i] < 0 ? -steps[i] : steps[i];
+    linearMove.direction[i] = steps[i] < 0 ? -1 : 1;
+    // Starting half way rounds each minor axis step to the nearest tick
+    linearMove.error[i] = majorSteps / 2;
+  }
+  linearMove.majorSteps = majorSteps;
+  linearMove.active = true;
+  motorState.stepsRemaining = majorSteps;
+  motorState.stepsCompleted = 0;
+  motorState.isRunning = true;
+  interrupts();
+  
+  stepTimerStart(plannerStart(motorState.profile));
+  return true;
 }
 
-void runMotorDemo() {
-  Serial.println("Running motor demonstration...");
+// Moves axis X to target, counted in steps of the current drive mode from
+// the zero point. A single-axis move in progress is retargeted in place:
+// a target still ahead by at least the stopping distance becomes the new
+// end of the ramp, so the motor speeds up or slows down toward it; one
+// nearer or behind is reached by slowing to rest past it and coming back.
+// A coordinated move is replaced. Returns false, leaving the motor as it
+// was, for a target out of range or more than MAX_MOVE_STEPS away.
+bool moveToPosition(long target) {
+  if (target < -MAX_POSITION_STEPS || target > MAX_POSITION_STEPS) return false;
   
-  Serial.println("Clockwise " + String(DEMO_STEPS) + " steps");
-  moveSteps(DEMO_STEPS, CLOCKWISE);
-  delay(1000);
+  uint8_t stride = coilDrive.stride;
+  noInterrupts();
+  // Whole steps only: a position left between steps by a micro-stepped
+  // move is approached from its side and not crossed
+  long steps = (target * stride - axisX.position) / stride;
+  if (steps != 0 && !validateStepCount(steps > 0 ? steps : -steps)) {
+    interrupts();
+    return false;
+  }
+  if (!motorState.isRunning || linearMove.active) {
+    interrupts();
+    if (steps != 0) {
+      startMove(steps > 0 ? steps : -steps, steps > 0 ? CLOCKWISE : COUNTER_CLOCKWISE);
+    }
+    return true;
+  }
   
-  Serial.println("Counter-clockwise " + String(DEMO_STEPS) + " steps");
-  moveSteps(DEMO_STEPS, COUNTER_CLOCKWISE);
+  long ahead = motorState.direction == CLOCKWISE ? steps : -steps;
+  long stopping = motorState.profile.rampStep;
+  clearMotionQueue();
+  if (ahead >= stopping) {
+    motorState.stepsRemaining = ahead;
+  } else {
+    motorState.stepsRemaining = stopping;
+    motionQueue.segments[0].steps = stopping - ahead;
+    motionQueue.segments[0].direction = motorState.direction == CLOCKWISE ? COUNTER_CLOCKWISE : CLOCKWISE;
+    motionQueue.head = 1;
+    motionQueue.chainOpen = false;
+  }
+  interrupts();
+  return true;
+}
+
+// Position of axis X in steps of the current drive mode
+long getMotorPosition() {
+  noInterrupts();
+  long position = axisX.position;
+  interrupts();
+  return position / coilDrive.stride;
+}
+
+// Only while idle, so a running goto keeps the target it was given
+bool zeroMotorPosition() {
+  if (motorState.isRunning) return false;
+  noInterrupts();
+  axisX.position = 0;
+  interrupts();
+  return true;
+}
+
+uint8_t motionQueueDepth() {
+  noInterrupts();
+  uint8_t depth = (motionQueue.head - motionQueue.tail) & (MOTION_QUEUE_SIZE - 1);
+  interrupts();
+  return depth;
+}
+
+// One slot always stays empty to tell a full ring from an empty one
+uint8_t motionQueueFree() {
+  return MOTION_QUEUE_SIZE - 1 - motionQueueDepth();
+}
+
+long getMotorStepsCompleted() {
+  noInterrupts();
+  long steps = motorState.stepsCompleted;
+  interrupts();
+  return steps;
+}
+
+void stopMotor() {
+  stepTimerStop();
+  noInterrupts();
+  clearMotionQueue();
+  linearMove.active = false;
+  motorState.stepsRemaining = 0;
+  interrupts();
   
-  stopMotor();
-  Serial.println("Motor demo complete!");
+  releaseCoils();
+  motorState.isRunning = false;
 }
 
-bool setMotorSpeed(int speed) {
+bool setMotorSpeed(long speed) {
   if (speed >= MIN_STEP_DELAY && speed <= MAX_STEP_DELAY) {
     motorState.stepDelay = speed;
+    motorState.maxSpeed = 1000 / speed;
+    plannerSetMaxSpeed(motorState.profile, motorState.maxSpeed);
     return true;
   }
   return false;
 }
 
-bool validateStepCount(int steps) {
-  return steps > 0 && steps <= 100000;
+bool setMotorMaxSpeed(long stepsPerSecond) {
+  if (stepsPerSecond >= MIN_MAX_SPEED_SPS && stepsPerSecond <= MAX_MAX_SPEED_SPS) {
+    motorState.maxSpeed = stepsPerSecond;
+    plannerSetMaxSpeed(motorState.profile, motorState.maxSpeed);
+    return true;
+  }
+  return false;
+}
+
+bool setMotorAcceleration(long stepsPerSecond2) {
+  if (stepsPerSecond2 >= MIN_ACCELERATION_SPS2 && stepsPerSecond2 <= MAX_ACCELERATION_SPS2) {
+    motorState.acceleration = stepsPerSecond2;
+    plannerConfigure(motorState.profile, motorState.acceleration, motorState.maxSpeed);
+    return true;
+  }
+  return false;
+}
+
+// Only while idle: the step interrupt reads the stride and tables
+bool setMotorDriveMode(DriveMode mode) {
+  if (motorState.isRunning) return false;
+  setCoilDriveMode(mode);
+  return true;
+}
+
+bool validateStepCount(long steps) {
+  return steps > 0 && steps <= MAX_MOVE_STEPS;
 }
 
 #endif // MOTOR_H
\ No newline at end of file
@@ -0,0 +1,153 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// ========== TASK IDENTIFIERS ==========
+// One slot per resumable activity; scheduling a task that is already queued
+// moves its deadline
+enum TaskId {
+  TASK_TRAFFIC_CYCLE,
+  TASK_LCD_REFRESH,
+  TASK_MACRO,
+  TASK_CONFIG_SAVE,
+  TASK_MACRO_SAVE,
+  TASK_COUNT
+};
+
+// A task returns the number of milliseconds until it wants to run again,
+// or TASK_DONE to leave the queue
+typedef unsigned long (*TaskFunction)();
+
+#define TASK_DONE 0xFFFFFFFFUL
+#define TASK_NOT_QUEUED 0xFF
+
+// ========== SCHEDULER STATE STRUCTURE ==========
+// Binary min-heap of task ids ordered by deadline
+struct Scheduler {
+  TaskFunction functions[TASK_COUNT];
+  unsigned long deadlines[TASK_COUNT];
+  uint8_t heap[TASK_COUNT];
+  uint8_t heapIndex[TASK_COUNT];
+  uint8_t size;
+};
+
+// ========== GLOBAL SCHEDULER STATE ==========
+extern Scheduler scheduler;
+
+// ========== SCHEDULER FUNCTION DECLARATIONS ==========
+void initializeScheduler();
+void scheduleTask(TaskId id, TaskFunction function, unsigned long delayMs);
+void cancelTask(TaskId id);
+bool isTaskScheduled(TaskId id);
+bool getNextTaskDeadline(unsigned long& deadline);
+void runScheduler();
+
+// ========== SCHEDULER FUNCTION IMPLEMENTATIONS ==========
+
+// millis() wraps every 49 days, so deadlines are compared by difference
+static bool deadlineBefore(unsigned long a, unsigned long b) {
+  return (long)(a - b) < 0;
+}
+
+static void schedulerSwap(uint8_t i, uint8_t j) {
+  uint8_t a = scheduler.heap[i];
+  uint8_t b = scheduler.heap[j];
+  scheduler.heap[i] = b;
+  scheduler.heap[j] = a;
+  scheduler.heapIndex[b] = i;
+  scheduler.heapIndex[a] = j;
+}
+
+static void schedulerSiftUp(uint8_t i) {
+  while (i > 0) {
+    uint8_t parent = (i - 1) / 2;
+    if (!deadlineBefore(scheduler.deadlines[scheduler.heap[i]], scheduler.deadlines[scheduler.heap[parent]])) break;
+    schedulerSwap(i, parent);
+    i = parent;
+  }
+}
+
+static void schedulerSiftDown(uint8_t i) {
+  for (;;) {
+    uint8_t smallest = i;
+    uint8_t left = 2 * i + 1;
+    uint8_t right = left + 1;
+    if (left < scheduler.size &&
+        deadlineBefore(scheduler.deadlines[scheduler.heap[left]], scheduler.deadlines[scheduler.heap[smallest]])) {
+      smallest = left;
+    }
+    if (right < scheduler.size &&
+        deadlineBefore(scheduler.deadlines[scheduler.heap[right]], scheduler.deadlines[scheduler.heap[smallest]])) {
+      smallest = right;
+    }
+    if (smallest == i) break;
+    schedulerSwap(i, smallest);
+    i = smallest;
+  }
+}
+
+void initializeScheduler() {
+  scheduler.size = 0;
+  for (uint8_t id = 0; id < TASK_COUNT; id++) {
+    scheduler.functions[id] = NULL;
+    scheduler.heapIndex[id] = TASK_NOT_QUEUED;
+  }
+}
+
+void scheduleTask(TaskId id, TaskFunction function, unsigned long delayMs) {
+  scheduler.functions[id] = function;
+  scheduler.deadlines[id] = millis() + delayMs;
+  
+  uint8_t i = scheduler.heapIndex[id];
+  if (i == TASK_NOT_QUEUED) {
+    i = scheduler.size++;
+    scheduler.heap[i] = id;
+    scheduler.heapIndex[id] = i;
+  }
+  schedulerSiftUp(i);
+  schedulerSiftDown(scheduler.heapIndex[id]);
+}
+
+void cancelTask(TaskId id) {
+  uint8_t i = scheduler.heapIndex[id];
+  if (i == TASK_NOT_QUEUED) return;
+  
+  uint8_t last = --scheduler.size;
+  if (i != last) {
+    schedulerSwap(i, last);
+  }
+  scheduler.heapIndex[id] = TASK_NOT_QUEUED;
+  if (i != last) {
+    schedulerSiftUp(i);
+    schedulerSiftDown(i);
+  }
+}
+
+bool isTaskScheduled(TaskId id) {
+  return scheduler.heapIndex[id] != TASK_NOT_QUEUED;
+}
+
+bool getNextTaskDeadline(unsigned long& deadline) {
+  if (scheduler.size == 0) return false;
+  deadline = scheduler.deadlines[scheduler.heap[0]];
+  return true;
+}
+
+// Runs at most SCHEDULER_MAX_TASKS_PER_PASS due tasks so one loop() pass
+// stays short even when several deadlines coincide
+void runScheduler() {
+  for (uint8_t n = 0; n < SCHEDULER_MAX_TASKS_PER_PASS && scheduler.size > 0; n++) {
+    TaskId id = (TaskId)scheduler.heap[0];
+    if (deadlineBefore(millis(), scheduler.deadlines[id])) return;
+    
+    cancelTask(id);
+    unsigned long nextRun = scheduler.functions[id]();
+    if (nextRun != TASK_DONE && !isTaskScheduled(id)) {
+      scheduleTask(id, scheduler.functions[id], nextRun);
+    }
+  }
+}
+
+#endif // SCHEDULER_H
@@ -0,0 +1,125 @@
+#ifndef SERIAL_INPUT_H
+#define SERIAL_INPUT_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "console.h"
+#include "stats.h"
+
+// ========== SERIAL INPUT STATE STRUCTURE ==========
+// Bytes from Serial are collected in a ring until a newline completes a
+// command, so loop() never waits on the Stream timeout
+struct SerialInputState {
+  char buffer[SERIAL_INPUT_BUFFER_SIZE];
+  uint8_t head;
+  uint8_t tail;
+  uint8_t count;
+  uint8_t pendingLines;
+  bool discarding;
+  unsigned long lastByteTime;
+};
+
+// ========== GLOBAL SERIAL INPUT STATE ==========
+extern SerialInputState serialInput;
+
+// ========== SERIAL INPUT FUNCTION DECLARATIONS ==========
+void initializeSerialInput();
+void pollSerialInput();
+bool readSerialLine(char* line, uint8_t size);
+
+void processCommand(const char* input);
+
+// ========== SERIAL INPUT FUNCTION IMPLEMENTATIONS ==========
+
+void initializeSerialInput() {
+  serialInput.head = 0;
+  serialInput.tail = 0;
+  serialInput.count = 0;
+  serialInput.pendingLines = 0;
+  serialInput.discarding = false;
+  serialInput.lastByteTime = 0;
+}
+
+void pollSerialInput() {
+  while (Serial.available() > 0 && serialInput.count < SERIAL_INPUT_BUFFER_SIZE) {
+    char c = Serial.read();
+    serialInput.lastByteTime = millis();
+    if (c == '\r') {
+      c = '\n';
+    }
+    
+    if (serialInput.discarding) {
+      // Skip the rest of a line that did not fit in the buffer
+      if (c == '\n') {
+        serialInput.discarding = false;
+        console.println(F("Command too long"));
+      }
+      continue;
+    }
+    
+    serialInput.buffer[serialInput.head] = c;
+    serialInput.head = (serialInput.head + 1) & (SERIAL_INPUT_BUFFER_SIZE - 1);
+    serialInput.count++;
+    if (c == '\n') {
+      serialInput.pendingLines++;
+    }
+  }
+  
+  if (serialInput.count == SERIAL_INPUT_BUFFER_SIZE && serialInput.pendingLines == 0) {
+    // A single partial line fills the ring: drop it. lastByteTime stays,
+    // so the idle timeout below measures from the last byte received.
+    serialInput.head = 0;
+    serialInput.tail = 0;
+    serialInput.count = 0;
+    serialInput.discarding = true;
+  } else if (serialInput.count > 0 && serialInput.pendingLines == 0 &&
+             millis() - serialInput.lastByteTime >= SERIAL_LINE_IDLE_MS) {
+    // No line ending arrived; treat the pause as the end of the command
+    serialInput.buffer[serialInput.head] = '\n';
+    serialInput.head = (serialInput.head + 1) & (SERIAL_INPUT_BUFFER_SIZE - 1);
+    serialInput.count++;
+    serialInput.pendingLines++;
+  } else if (serialInput.discarding && millis() - serialInput.lastByteTime >= SERIAL_LINE_IDLE_MS) {
+    serialInput.discarding = false;
+    console.println(F("Command too long"));
+  }
+  
+  static char line[SERIAL_LINE_MAX];
+  while (readSerialLine(line, sizeof(line))) {
+    unsigned long start = micros();
+    processCommand(line);
+    statsRecordCommand(micros() - start);
+  }
+}
+
+bool readSerialLine(char* line, uint8_t size) {
+  if (serialInput.pendingLines == 0) {
+    return false;
+  }
+  
+  uint8_t length = 0;
+  bool truncated = false;
+  for (;;) {
+    char c = serialInput.buffer[serialInput.tail];
+    serialInput.tail = (serialInput.tail + 1) & (SERIAL_INPUT_BUFFER_SIZE - 1);
+    serialInput.count--;
+    if (c == '\n') {
+      break;
+    }
+    if (length < size - 1) {
+      line[length++] = c;
+    } else {
+      truncated = true;
+    }
+  }
+  serialInput.pendingLines--;
+  
+  if (truncated) {
+    console.println(F("Command too long"));
+    length = 0;
+  }
+  line[length] = '\0';
+  return true;
+}
+
+#endif // SERIAL_INPUT_H
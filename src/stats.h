@@ -0,0 +1,228 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "console.h"
+#include "hal.h"
+
+// ========== RUNTIME STATS STRUCTURE ==========
+// Counters are cheap enough to update on every pass and every step.
+// loopPeriodBins[b] counts loop() periods of b significant bits in
+// microseconds (bin 0 is 0 us, bin 3 is 4-7 us, the last bin is open ended);
+// bins stop at 0xFFFF instead of wrapping. Time spent in idle sleep is
+// left out of the loop period and summed in sleepMillis since resetMillis.
+struct RuntimeStats {
+  uint16_t loopPeriodBins[STATS_LOOP_BINS];
+  unsigned long lastLoopMicros;
+  unsigned long maxLoopMicros;
+  volatile uint16_t maxStepLatencyTicks;
+  unsigned long maxPhaseLatenessMs;
+  unsigned long maxCommandMicros;
+  unsigned int minFreeRam;
+  unsigned int maxHeapUsed;
+  unsigned long resetMillis;
+  unsigned long sleepMillis;
+  unsigned int sleepRemainderMicros;
+};
+
+// ========== GLOBAL RUNTIME STATS ==========
+extern RuntimeStats runtimeStats;
+
+// ========== STATS FUNCTION DECLARATIONS ==========
+void resetStats();
+void statsPaintStack();
+unsigned int statsFreeRam();
+unsigned int statsStackHeadroom();
+unsigned int statsHeapUsed();
+void statsRecordLoopPass();
+void statsRecordStepLatency(uint16_t ticks);
+void statsRecordPhaseLateness(unsigned long ms);
+void statsRecordCommand(unsigned long us);
+void statsRecordSleep(unsigned long us);
+void printStats();
+
+// ========== STATS FUNCTION IMPLEMENTATIONS ==========
+
+void resetStats() {
+  memset(runtimeStats.loopPeriodBins, 0, sizeof(runtimeStats.loopPeriodBins));
+  runtimeStats.lastLoopMicros = micros();
+  runtimeStats.maxLoopMicros = 0;
+  noInterrupts();
+  runtimeStats.maxStepLatencyTicks = 0;
+  interrupts();
+  runtimeStats.maxPhaseLatenessMs = 0;
+  runtimeStats.maxCommandMicros = 0;
+  runtimeStats.minFreeRam = statsFreeRam();
+  runtimeStats.maxHeapUsed = statsHeapUsed();
+  runtimeStats.resetMillis = millis();
+  runtimeStats.sleepMillis = 0;
+  runtimeStats.sleepRemainderMicros = 0;
+}
+
+#if defined(HAL_TARGET_AVR)
+
+#define STATS_STACK_CANARY 0xA5
+
+extern uint8_t __data_start;
+extern uint8_t __data_end;
+extern uint8_t __bss_start;
+extern uint8_t __bss_end;
+extern uint8_t __heap_start;
+extern void* __brkval;
+
+static uint8_t* statsHeapEnd() {
+  return __brkval != NULL ? (uint8_t*)__brkval : &__heap_start;
+}
+
+// Fills the gap between heap and stack with a canary so the deepest the
+// stack has reached can be found later. Call first thing in setup().
+void statsPaintStack() {
+  uint8_t* top = (uint8_t*)SP - 16;
+  for (uint8_t* p = statsHeapEnd(); p < top; p++) {
+    *p = STATS_STACK_CANARY;
+  }
+}
+
+unsigned int statsFreeRam() {
+  return (uint8_t*)SP - statsHeapEnd();
+}
+
+// malloc() has never run while this is 0
+unsigned int statsHeapUsed() {
+  return statsHeapEnd() - &__heap_start;
+}
+
+// Canary bytes left untouched above the heap
+unsigned int statsStackHeadroom() {
+  uint8_t* p = statsHeapEnd();
+  uint8_t* top = (uint8_t*)SP;
+  while (p < top && *p == STATS_STACK_CANARY) {
+    p++;
+  }
+  return p - statsHeapEnd();
+}
+
+#else
+
+// No meaningful SRAM figures off target
+void statsPaintStack() {
+}
+
+unsigned int statsFreeRam() {
+  return 0;
+}
+
+unsigned int statsStackHeadroom() {
+  return 0;
+}
+
+unsigned int statsHeapUsed() {
+  return 0;
+}
+
+#endif
+
+void statsRecordLoopPass() {
+  unsigned long now = micros();
+  unsigned long period = now - runtimeStats.lastLoopMicros;
+  runtimeStats.lastLoopMicros = now;
+  
+  uint8_t bin = 0;
+  for (unsigned long rest = period; rest != 0 && bin < STATS_LOOP_BINS - 1; rest >>= 1) {
+    bin++;
+  }
+  if (runtimeStats.loopPeriodBins[bin] != 0xFFFF) {
+    runtimeStats.loopPeriodBins[bin]++;
+  }
+  if (period > runtimeStats.maxLoopMicros) {
+    runtimeStats.maxLoopMicros = period;
+  }
+  
+  unsigned int freeRam = statsFreeRam();
+  if (freeRam < runtimeStats.minFreeRam) {
+    runtimeStats.minFreeRam = freeRam;
+  }
+  unsigned int heapUsed = statsHeapUsed();
+  if (heapUsed > runtimeStats.maxHeapUsed) {
+    runtimeStats.maxHeapUsed = heapUsed;
+  }
+}
+
+void statsRecordSleep(unsigned long us) {
+  runtimeStats.lastLoopMicros += us;
+  us += runtimeStats.sleepRemainderMicros;
+  runtimeStats.sleepMillis += us / 1000;
+  runtimeStats.sleepRemainderMicros = us % 1000;
+}
+
+// Called from the step interrupt with the ticks since the compare match
+void statsRecordStepLatency(uint16_t ticks) {
+  if (ticks > runtimeStats.maxStepLatencyTicks) {
+    runtimeStats.maxStepLatencyTicks = ticks;
+  }
+}
+
+void statsRecordPhaseLateness(unsigned long ms) {
+  if (ms > runtimeStats.maxPhaseLatenessMs) {
+    runtimeStats.maxPhaseLatenessMs = ms;
+  }
+}
+
+void statsRecordCommand(unsigned long us) {
+  if (us > runtimeStats.maxCommandMicros) {
+    runtimeStats.maxCommandMicros = us;
+  }
+}
+
+void printStats() {
+  console.println(F("=== RUNTIME STATS ==="));
+  console.println(F("Loop period histogram (us: passes):"));
+  for (uint8_t bin = 0; bin < STATS_LOOP_BINS; bin++) {
+    uint16_t count = runtimeStats.loopPeriodBins[bin];
+    if (count == 0) continue;
+    
+    unsigned long low = bin == 0 ? 0 : 1UL << (bin - 1);
+    console.print(F("  "));
+    console.print(low);
+    if (bin == STATS_LOOP_BINS - 1) {
+      console.print('+');
+    } else if (bin > 1) {
+      console.print('-');
+      console.print((1UL << bin) - 1);
+    }
+    console.print(F(": "));
+    console.println(count);
+  }
+  printLine(console, F("Loop period max: "), runtimeStats.maxLoopMicros, F(" us"));
+  
+  noInterrupts();
+  uint16_t stepLatency = runtimeStats.maxStepLatencyTicks;
+  interrupts();
+  printLine(console, F("Step latency max: "), stepLatency * 1000UL / STEP_TIMER_TICKS_PER_MS, F(" us"));
+  printLine(console, F("Traffic phase late max: "), runtimeStats.maxPhaseLatenessMs, F(" ms"));
+  printLine(console, F("Command time max: "), runtimeStats.maxCommandMicros, F(" us"));
+  
+  // Scaled down as needed so the per-mille product fits in 32 bits
+  unsigned long total = millis() - runtimeStats.resetMillis;
+  unsigned long asleep = runtimeStats.sleepMillis;
+  printItems(console, F("Asleep: "), total, F(" ms window, "));
+  while (asleep > 4000000UL) {
+    asleep >>= 1;
+    total >>= 1;
+  }
+  unsigned long permille = total > 0 ? asleep * 1000 / total : 0;
+  printLine(console, fixed(permille, 1), '%');
+
+#if defined(HAL_TARGET_AVR)
+  printLine(console, F("RAM: .data "), (unsigned int)(&__data_end - &__data_start),
+            F(" + .bss "), (unsigned int)(&__bss_end - &__bss_start),
+            F(" bytes, heap peak "), runtimeStats.maxHeapUsed, F(" bytes"));
+  printLine(console, F("Free RAM: "), statsFreeRam(), F(" bytes (min "), runtimeStats.minFreeRam, ')');
+  printLine(console, F("Stack headroom min: "), statsStackHeadroom(), F(" bytes"));
+#else
+  console.println(F("Free RAM: n/a on this target"));
+#endif
+}
+
+#endif // STATS_H
@@ -0,0 +1,145 @@
+#ifndef STEP_TIMER_H
+#define STEP_TIMER_H
+
+#include <Arduino.h>
+#include "hal.h"
+#include "config.h"
+
+// ========== STEP TIMER FUNCTION DECLARATIONS ==========
+void stepTimerStart(uint16_t ticks);
+void stepTimerSetInterval(uint16_t ticks);
+void stepTimerStop();
+bool stepTimerIsRunning();
+uint16_t stepTimerLatency();
+
+// Called once per compare match; implemented by the motor module
+void onStepTimerTick();
+
+// ========== STEP TIMER FUNCTION IMPLEMENTATIONS ==========
+#if defined(HAL_TARGET_AVR)
+
+#include <avr/interrupt.h>
+
+ISR(TIMER3_COMPA_vect) {
+  onStepTimerTick();
+}
+
+void stepTimerStart(uint16_t ticks) {
+  uint8_t oldSREG = SREG;
+  cli();
+  TCCR3A = 0;
+  TCCR3B = 0;
+  TCNT3 = 0;
+  OCR3A = ticks - 1;
+  TIFR3 = _BV(OCF3A);
+  TIMSK3 |= _BV(OCIE3A);
+  // CTC on OCR3A, clk/64
+  TCCR3B = _BV(WGM32) | _BV(CS31) | _BV(CS30);
+  SREG = oldSREG;
+}
+
+void stepTimerSetInterval(uint16_t ticks) {
+  uint8_t oldSREG = SREG;
+  cli();
+  OCR3A = ticks - 1;
+  if (TCNT3 >= OCR3A) {
+    TCNT3 = 0;
+  }
+  SREG = oldSREG;
+}
+
+void stepTimerStop() {
+  uint8_t oldSREG = SREG;
+  cli();
+  TCCR3B = 0;
+  TIMSK3 &= ~_BV(OCIE3A);
+  SREG = oldSREG;
+}
+
+bool stepTimerIsRunning() {
+  return TCCR3B != 0;
+}
+
+// CTC clears the counter on the compare match, so inside the interrupt the
+// count is how long the interrupt took to start
+uint16_t stepTimerLatency() {
+  return TCNT3;
+}
+
+#else
+
+// Host builds have no Timer3. The fake timer counts ticks handed to
+// stepTimerAdvance() and fires onStepTimerTick() on every compare match,
+// so the stepping engine can be driven deterministically off target. In the
+// simulator the virtual clock supplies the ticks.
+struct FakeStepTimer {
+  bool running;
+  uint16_t interval;
+  uint16_t count;
+};
+
+static FakeStepTimer fakeStepTimer = {false, 0, 0};
+
+void stepTimerAdvance(unsigned long ticks);
+
+#if defined(HAL_TARGET_SIM)
+// Converts virtual clock time into timer ticks, keeping the remainder so
+// short loop() passes add up exactly
+static void stepTimerClockAdvanced(unsigned long elapsedMicros) {
+  static unsigned long remainder = 0;
+  unsigned long long scaled = remainder + (unsigned long long)elapsedMicros * (F_CPU / STEP_TIMER_PRESCALER);
+  remainder = scaled % 1000000UL;
+  stepTimerAdvance(scaled / 1000000UL);
+}
+#endif
+
+void stepTimerStart(uint16_t ticks) {
+#if defined(HAL_TARGET_SIM)
+  simAttachTimer(stepTimerClockAdvanced);
+#endif
+  fakeStepTimer.interval = ticks;
+  fakeStepTimer.count = 0;
+  fakeStepTimer.running = true;
+}
+
+void stepTimerSetInterval(uint16_t ticks) {
+  fakeStepTimer.interval = ticks;
+  if (fakeStepTimer.count >= ticks) {
+    fakeStepTimer.count = 0;
+  }
+}
+
+void stepTimerStop() {
+  fakeStepTimer.running = false;
+}
+
+bool stepTimerIsRunning() {
+  return fakeStepTimer.running;
+}
+
+// The fake timer calls onStepTimerTick() exactly on the match
+uint16_t stepTimerLatency() {
+  return 0;
+}
+
+void stepTimerAdvance(unsigned long ticks) {
+  while (ticks > 0 && fakeStepTimer.running) {
+    unsigned long untilMatch = fakeStepTimer.interval - fakeStepTimer.count;
+    if (ticks < untilMatch) {
+      fakeStepTimer.count += ticks;
+      return;
+    }
+    ticks -= untilMatch;
+    fakeStepTimer.count = 0;
+#if defined(HAL_TARGET_SIM)
+    // The match came the remaining ticks before the end of the advance
+    simRunInterruptAt(simMicros() - ticks * STEP_TIMER_PRESCALER / (F_CPU / 1000000UL), onStepTimerTick);
+#else
+    onStepTimerTick();
+#endif
+  }
+}
+
+#endif
+
+#endif // STEP_TIMER_H
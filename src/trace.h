@@ -0,0 +1,300 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <Arduino.h>
+#include "hal.h"
+#include "config.h"
+#include "console.h"
+#include "event_log.h"
+
+// ========== TRACE EVENTS ==========
+// The trace recorder keeps the last TRACE_RING_SIZE output changes with
+// their micros() timestamp, for timing analysis off the board
+// (tools/trace2vcd.py turns a dump into a VCD file). Recording costs a few
+// instructions per event and nothing when stopped. While it records or is
+// armed, idleSleep() stays awake: micros() is not kept up to date while the
+// Timer0 tick is off, so a step-interrupt timestamp taken in sleep would be
+// wrong. Values by kind:
+//   TRACE_COIL       axis << 4 | coil pattern (IN1 is bit 0)
+//   TRACE_LAMPS      LAMP_* mask of intersection 0
+//   TRACE_COMMAND    COMMAND_TABLE index of a dispatched command
+//   TRACE_LCD_FLUSH  bytes queued for the display, at most 255
+enum TraceKind {
+  TRACE_COIL,
+  TRACE_LAMPS,
+  TRACE_COMMAND,
+  TRACE_LCD_FLUSH,
+  TRACE_KIND_COUNT
+};
+
+#define TRACE_ALL_KINDS ((1 << TRACE_KIND_COUNT) - 1)
+
+const char TRACE_KIND_NAME_COIL[] PROGMEM = "coil";
+const char TRACE_KIND_NAME_LAMPS[] PROGMEM = "lamp";
+const char TRACE_KIND_NAME_COMMAND[] PROGMEM = "cmd";
+const char TRACE_KIND_NAME_LCD_FLUSH[] PROGMEM = "lcd";
+const char* const TRACE_KIND_NAMES[TRACE_KIND_COUNT] PROGMEM = {
+  TRACE_KIND_NAME_COIL, TRACE_KIND_NAME_LAMPS, TRACE_KIND_NAME_COMMAND, TRACE_KIND_NAME_LCD_FLUSH
+};
+
+// STOPPED keeps what was recorded. RECORDING runs until stopped, dropping
+// the oldest records; ARMED waits for an event of the trigger kind and
+// then records ONE_SHOT until the ring is full.
+enum TraceMode {
+  TRACE_STOPPED,
+  TRACE_RECORDING,
+  TRACE_ARMED,
+  TRACE_ONE_SHOT
+};
+
+enum TraceDumpStage {
+  TRACE_DUMP_IDLE,
+  TRACE_DUMP_HEADER,
+  TRACE_DUMP_RECORDS,
+  TRACE_DUMP_END
+};
+
+static_assert((TRACE_RING_SIZE & (TRACE_RING_SIZE - 1)) == 0 && TRACE_RING_SIZE <= 128,
+              "TRACE_RING_SIZE must be a power of two, at most 128");
+static_assert(2 + TRACE_RECORDS_PER_LINE * 12 + 2 <= LOG_LINE_MAX, "trace dump lines must fit LOG_LINE_MAX");
+
+// ========== TRACE STATE STRUCTURE ==========
+// The ring is written from the step timer interrupt as well as the main
+// loop, so writers mask interrupts for the few instructions they take.
+// count saturates at TRACE_RING_SIZE; overwritten counts records lost to
+// a RECORDING ring since it was started. A dump sends one line from line
+// whenever the UART has room for it, like the event log.
+struct TraceRecord {
+  uint32_t time;
+  uint8_t kind;
+  uint8_t value;
+};
+
+struct TraceState {
+  TraceRecord ring[TRACE_RING_SIZE];
+  volatile uint8_t head;
+  volatile uint8_t count;
+  volatile uint8_t mode;
+  uint8_t trigger;
+  uint8_t kinds;
+  unsigned long overwritten;
+  uint8_t dumpStage;
+  uint8_t dumpIndex;
+  uint16_t dumpCrc;
+  char line[LOG_LINE_MAX + 1];
+  uint8_t lineLength;
+};
+
+// ========== GLOBAL TRACE STATE ==========
+extern TraceState traceRecorder;
+
+// ========== TRACE FUNCTION DECLARATIONS ==========
+void initializeTrace();
+void traceEvent(TraceKind kind, uint8_t value);
+bool startTrace();
+bool armTrace(TraceKind trigger);
+void stopTrace();
+bool startTraceDump();
+bool traceDumping();
+bool traceCapturing();
+void traceService();
+void printTraceStatus();
+const __FlashStringHelper* traceKindName(uint8_t kind);
+
+// Implemented in binary_protocol.h
+uint16_t crc16Update(uint16_t crc, uint8_t value);
+
+// ========== TRACE FUNCTION IMPLEMENTATIONS ==========
+
+// Called from the step interrupt too, where interrupts must stay masked on
+// the way out
+static inline uint8_t traceLock() {
+#if defined(HAL_TARGET_AVR)
+  uint8_t oldSREG = SREG;
+  cli();
+  return oldSREG;
+#else
+  return 0;
+#endif
+}
+
+static inline void traceUnlock(uint8_t oldSREG) {
+#if defined(HAL_TARGET_AVR)
+  SREG = oldSREG;
+#endif
+}
+
+void initializeTrace() {
+  traceRecorder.head = 0;
+  traceRecorder.count = 0;
+  traceRecorder.mode = TRACE_STOPPED;
+  traceRecorder.kinds = TRACE_ALL_KINDS;
+  traceRecorder.overwritten = 0;
+  traceRecorder.dumpStage = TRACE_DUMP_IDLE;
+  traceRecorder.lineLength = 0;
+}
+
+void traceEvent(TraceKind kind, uint8_t value) {
+  if (traceRecorder.mode == TRACE_STOPPED || !(traceRecorder.kinds & (1 << kind))) return;
+  
+  uint8_t oldSREG = traceLock();
+  uint8_t mode = traceRecorder.mode;
+  if (mode == TRACE_ARMED && kind == traceRecorder.trigger) {
+    mode = TRACE_ONE_SHOT;
+  }
+  if (mode == TRACE_RECORDING || mode == TRACE_ONE_SHOT) {
+    uint8_t head = traceRecorder.head;
+    TraceRecord& record = traceRecorder.ring[head];
+    record.time = micros();
+    record.kind = kind;
+    record.value = value;
+    traceRecorder.head = (head + 1) & (TRACE_RING_SIZE - 1);
+    if (traceRecorder.count < TRACE_RING_SIZE) {
+      traceRecorder.count++;
+    } else {
+      traceRecorder.overwritten++;
+    }
+    if (mode == TRACE_ONE_SHOT && traceRecorder.count == TRACE_RING_SIZE) {
+      mode = TRACE_STOPPED;
+    }
+    traceRecorder.mode = mode;
+  }
+  traceUnlock(oldSREG);
+}
+
+static void clearTrace(uint8_t mode) {
+  uint8_t oldSREG = traceLock();
+  traceRecorder.head = 0;
+  traceRecorder.count = 0;
+  traceRecorder.overwritten = 0;
+  traceRecorder.mode = mode;
+  traceUnlock(oldSREG);
+}
+
+// The ring is still being read while a dump runs
+bool startTrace() {
+  if (traceDumping()) return false;
+  clearTrace(TRACE_RECORDING);
+  return true;
+}
+
+bool armTrace(TraceKind trigger) {
+  if (traceDumping()) return false;
+  traceRecorder.trigger = trigger;
+  clearTrace(TRACE_ARMED);
+  return true;
+}
+
+void stopTrace() {
+  traceRecorder.mode = TRACE_STOPPED;
+}
+
+// Stops recording and queues the records, oldest first:
+//   trace begin <records> <overwritten>
+//   T <hex>      TRACE_RECORDS_PER_LINE records of time32 kind value,
+//                little endian
+//   trace end <crc>  CRC-16/CCITT-FALSE of every record byte
+bool startTraceDump() {
+  if (traceDumping()) return false;
+  stopTrace();
+  traceRecorder.dumpStage = TRACE_DUMP_HEADER;
+  traceRecorder.dumpIndex = 0;
+  traceRecorder.dumpCrc = 0xFFFF;
+  return true;
+}
+
+bool traceDumping() {
+  return traceRecorder.dumpStage != TRACE_DUMP_IDLE || traceRecorder.lineLength > 0;
+}
+
+bool traceCapturing() {
+  return traceRecorder.mode != TRACE_STOPPED;
+}
+
+static void traceHexByte(Print& out, uint8_t value) {
+  static const char digits[] PROGMEM = "0123456789abcdef";
+  out.write(pgm_read_byte(&digits[value >> 4]));
+  out.write(pgm_read_byte(&digits[value & 0x0F]));
+  traceRecorder.dumpCrc = crc16Update(traceRecorder.dumpCrc, value);
+}
+
+static void traceFormatNext() {
+  LogLineBuffer buffer(traceRecorder.line);
+  switch (traceRecorder.dumpStage) {
+    case TRACE_DUMP_HEADER:
+      printItems(buffer, F("trace begin "), traceRecorder.count, ' ', traceRecorder.overwritten);
+      traceRecorder.dumpStage = traceRecorder.count > 0 ? TRACE_DUMP_RECORDS : TRACE_DUMP_END;
+      break;
+    
+    case TRACE_DUMP_RECORDS: {
+      buffer.write('T');
+      buffer.write(' ');
+      uint8_t first = traceRecorder.head - traceRecorder.count;
+      for (uint8_t n = 0; n < TRACE_RECORDS_PER_LINE && traceRecorder.dumpIndex < traceRecorder.count; n++) {
+        const TraceRecord& record = traceRecorder.ring[(first + traceRecorder.dumpIndex++) & (TRACE_RING_SIZE - 1)];
+        for (uint8_t shift = 0; shift < 32; shift += 8) {
+          traceHexByte(buffer, record.time >> shift);
+        }
+        traceHexByte(buffer, record.kind);
+        traceHexByte(buffer, record.value);
+      }
+      if (traceRecorder.dumpIndex == traceRecorder.count) {
+        traceRecorder.dumpStage = TRACE_DUMP_END;
+      }
+      break;
+    }
+    
+    default: {
+      uint16_t crc = traceRecorder.dumpCrc;
+      printItems(buffer, F("trace end "));
+      traceHexByte(buffer, crc >> 8);
+      traceHexByte(buffer, crc);
+      traceRecorder.dumpStage = TRACE_DUMP_IDLE;
+      break;
+    }
+  }
+  traceRecorder.lineLength = buffer.endLine();
+}
+
+// Called at the end of each loop() pass while a dump runs; whole lines
+// only, so dump and log lines never interleave
+void traceService() {
+  for (;;) {
+    if (traceRecorder.lineLength == 0) {
+      if (traceRecorder.dumpStage == TRACE_DUMP_IDLE) return;
+      traceFormatNext();
+    }
+    if (!console.isMuted() && Serial.availableForWrite() < traceRecorder.lineLength) return;
+    console.write((const uint8_t*)traceRecorder.line, traceRecorder.lineLength);
+    traceRecorder.lineLength = 0;
+  }
+}
+
+const __FlashStringHelper* traceKindName(uint8_t kind) {
+  return FPSTR(pgm_read_ptr(&TRACE_KIND_NAMES[kind]));
+}
+
+void printTraceStatus() {
+  switch (traceRecorder.mode) {
+    case TRACE_STOPPED:
+      printItems(console, F("Trace: stopped"));
+      break;
+    case TRACE_RECORDING:
+      printItems(console, F("Trace: recording"));
+      break;
+    case TRACE_ARMED:
+      printItems(console, F("Trace: armed on "), traceKindName(traceRecorder.trigger));
+      break;
+    default:
+      printItems(console, F("Trace: triggered"));
+      break;
+  }
+  printLine(console, F(", "), traceRecorder.count, '/', TRACE_RING_SIZE, F(" records, "), traceRecorder.overwritten, F(" overwritten"));
+  printItems(console, F("Kinds:"));
+  for (uint8_t i = 0; i < TRACE_KIND_COUNT; i++) {
+    printItems(console, ' ', traceKindName(i), traceRecorder.kinds & (1 << i) ? F(" on") : F(" off"));
+  }
+  console.println();
+}
+
+#endif // TRACE_H
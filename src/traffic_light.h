@@ -3,12 +3,39 @@
 
 #include <Arduino.h>
 #include "config.h"
+#include "console.h"
+#include "arg_parser.h"
+#include "scheduler.h"
+#include "stats.h"
+#include "event_log.h"
+#include "trace.h"
+#include "lamp_output.h"
+
+// ========== PHASE PROGRAM STRUCTURE ==========
+// A program is a cycle of lamp masks, one per intersection, each phase held
+// for its duration. All-red clearance and pedestrian intervals are ordinary
+// phases.
+struct TrafficPhase {
+  uint8_t lamps[TRAFFIC_INTERSECTIONS];
+  unsigned long durationMs;
+};
+
+struct TrafficProgram {
+  TrafficPhase phases[TRAFFIC_MAX_PHASES];
+  uint8_t count;
+};
 
 // ========== TRAFFIC LIGHT STATE STRUCTURE ==========
+// phaseDeadline is when the current phase ends; each phase starts at the
+// previous deadline rather than when the task ran, so lateness does not
+// accumulate over cycles. redTime/yellowTime/greenTime are the durations of
+// the default program set by the timing command.
 struct TrafficLightState_t {
   bool isRunning;
-  unsigned long startTime;
   TrafficLightState currentState;
+  TrafficProgram program;
+  uint8_t phaseIndex;
+  unsigned long phaseDeadline;
   unsigned long redTime;
   unsigned long yellowTime;
   unsigned long greenTime;
@@ -21,35 +48,47 @@ extern TrafficLightState_t trafficLight;
 void initializeTrafficLight();
 void setTrafficLight(bool red, bool yellow, bool green);
 void setTrafficLightByColor(LightColor color);
+void setTrafficLamps(uint8_t lamps);
+void setIntersectionLamps(const uint8_t* lamps);
+void stopTrafficSequences();
 void toggleTrafficLightCycle();
-void runTrafficLightCycle();
-void flashAllLights();
-void emergencyFlash();
+void loadDefaultTrafficProgram();
+bool loadTrafficProgram(const TrafficProgram& program);
+bool getTrafficNextTransition(unsigned long& deadline);
+void enterTrafficPhase(uint8_t index, unsigned long startTime);
+unsigned long runTrafficLightCycle();
 bool setTrafficTiming(unsigned long red, unsigned long yellow, unsigned long green);
-bool parseTimingCommand(String command);
+bool parseTimingCommand(const char* args);
 void printTrafficTiming();
+bool parseTrafficPhase(const char*& cursor, TrafficPhase& phase);
+void formatTrafficPhase(uint8_t lamps, char* text);
+void printTrafficProgram();
 
 // ========== TRAFFIC LIGHT FUNCTION IMPLEMENTATIONS ==========
 
 void initializeTrafficLight() {
-  pinMode(RED_LED_PIN, OUTPUT);
-  pinMode(YELLOW_LED_PIN, OUTPUT);
-  pinMode(GREEN_LED_PIN, OUTPUT);
+  lampOutputBegin();
   
   trafficLight.isRunning = false;
-  trafficLight.startTime = 0;
   trafficLight.currentState = TRAFFIC_RED;
+  trafficLight.phaseIndex = 0;
+  trafficLight.phaseDeadline = 0;
   trafficLight.redTime = DEFAULT_RED_TIME_MS;
   trafficLight.yellowTime = DEFAULT_YELLOW_TIME_MS;
   trafficLight.greenTime = DEFAULT_GREEN_TIME_MS;
+  loadDefaultTrafficProgram();
   
-  setTrafficLight(false, false, false);
+  setTrafficLamps(0);
 }
 
+// Head A of every intersection; the other lamps keep their state
 void setTrafficLight(bool red, bool yellow, bool green) {
-  digitalWrite(RED_LED_PIN, red ? HIGH : LOW);
-  digitalWrite(YELLOW_LED_PIN, yellow ? HIGH : LOW);
-  digitalWrite(GREEN_LED_PIN, green ? HIGH : LOW);
+  uint8_t headA = (red ? LAMP_A_RED : 0) | (yellow ? LAMP_A_YELLOW : 0) | (green ? LAMP_A_GREEN : 0);
+  for (uint8_t i = 0; i < TRAFFIC_INTERSECTIONS; i++) {
+    lampOutputSet(i, (lampOutputGet(i) & ~(LAMP_A_RED | LAMP_A_YELLOW | LAMP_A_GREEN)) | headA);
+  }
+  lampOutputLatch();
+  traceEvent(TRACE_LAMPS, lampOutputGet(0));
 }
 
 void setTrafficLightByColor(LightColor color) {
@@ -66,82 +105,125 @@ void setTrafficLightByColor(LightColor color) {
   }
 }
 
+// The same lamps at every intersection
+void setTrafficLamps(uint8_t lamps) {
+  for (uint8_t i = 0; i < TRAFFIC_INTERSECTIONS; i++) {
+    lampOutputSet(i, lamps);
+  }
+  lampOutputLatch();
+  traceEvent(TRACE_LAMPS, lamps);
+}
+
+// TRAFFIC_INTERSECTIONS masks, all switched in one latch
+void setIntersectionLamps(const uint8_t* lamps) {
+  for (uint8_t i = 0; i < TRAFFIC_INTERSECTIONS; i++) {
+    lampOutputSet(i, lamps[i]);
+  }
+  lampOutputLatch();
+  traceEvent(TRACE_LAMPS, lamps[0]);
+}
+
+// Stops the automatic cycle so a caller can take over the lamps. The other
+// head and the pedestrian lamps are only driven by the cycle, so they go
+// dark with it.
+void stopTrafficSequences() {
+  if (trafficLight.isRunning) {
+    setTrafficLamps(0);
+  }
+  trafficLight.isRunning = false;
+  cancelTask(TASK_TRAFFIC_CYCLE);
+}
+
 void toggleTrafficLightCycle() {
-  trafficLight.isRunning = !trafficLight.isRunning;
+  bool start = !trafficLight.isRunning;
+  stopTrafficSequences();
   
-  if (trafficLight.isRunning) {
-    Serial.println("Traffic light cycle STARTED");
-    trafficLight.startTime = millis();
-    trafficLight.currentState = TRAFFIC_RED;
-    setTrafficLight(true, false, false);
+  if (start) {
+    console.println(F("Traffic light cycle STARTED"));
+    trafficLight.isRunning = true;
+    enterTrafficPhase(0, millis());
+    scheduleTask(TASK_TRAFFIC_CYCLE, runTrafficLightCycle, trafficLight.program.phases[0].durationMs);
   } else {
-    Serial.println("Traffic light cycle STOPPED");
-    setTrafficLight(false, false, false);
+    console.println(F("Traffic light cycle STOPPED"));
   }
 }
 
-void runTrafficLightCycle() {
-  if (!trafficLight.isRunning) return;
-  
-  unsigned long currentTime = millis();
-  unsigned long elapsedTime = currentTime - trafficLight.startTime;
+static void setTrafficPhase(TrafficPhase& phase, uint8_t lamps, unsigned long durationMs) {
+  memset(phase.lamps, lamps, sizeof(phase.lamps));
+  phase.durationMs = durationMs;
+}
+
+// RED -> GREEN -> YELLOW on head A of every intersection with the timing
+// command's durations
+void loadDefaultTrafficProgram() {
+  TrafficProgram program;
+  setTrafficPhase(program.phases[0], LAMP_A_RED, trafficLight.redTime);
+  setTrafficPhase(program.phases[1], LAMP_A_GREEN, trafficLight.greenTime);
+  setTrafficPhase(program.phases[2], LAMP_A_YELLOW, trafficLight.yellowTime);
+  program.count = 3;
+  loadTrafficProgram(program);
+}
+
+// A running cycle restarts at the first phase of the new program
+bool loadTrafficProgram(const TrafficProgram& program) {
+  if (program.count == 0 || program.count > TRAFFIC_MAX_PHASES) return false;
   
-  switch (trafficLight.currentState) {
-    case TRAFFIC_RED:
-      if (elapsedTime >= trafficLight.redTime) {
-        trafficLight.currentState = TRAFFIC_GREEN;
-        setTrafficLight(false, false, true);
-        trafficLight.startTime = currentTime;
-        Serial.println("Traffic: RED -> GREEN");
-      }
-      break;
-      
-    case TRAFFIC_GREEN:
-      if (elapsedTime >= trafficLight.greenTime) {
-        trafficLight.currentState = TRAFFIC_YELLOW;
-        setTrafficLight(false, true, false);
-        trafficLight.startTime = currentTime;
-        Serial.println("Traffic: GREEN -> YELLOW");
-      }
-      break;
-      
-    case TRAFFIC_YELLOW:
-      if (elapsedTime >= trafficLight.yellowTime) {
-        trafficLight.currentState = TRAFFIC_RED;
-        setTrafficLight(true, false, false);
-        trafficLight.startTime = currentTime;
-        Serial.println("Traffic: YELLOW -> RED");
-      }
-      break;
+  trafficLight.program = program;
+  if (trafficLight.isRunning) {
+    enterTrafficPhase(0, millis());
+    scheduleTask(TASK_TRAFFIC_CYCLE, runTrafficLightCycle, program.phases[0].durationMs);
   }
+  return true;
 }
 
-void flashAllLights() {
-  trafficLight.isRunning = false;
-  Serial.println("Flashing all traffic lights");
+// When the running cycle next changes its lamps
+bool getTrafficNextTransition(unsigned long& deadline) {
+  if (!trafficLight.isRunning) return false;
+  deadline = trafficLight.phaseDeadline;
+  return true;
+}
+
+void enterTrafficPhase(uint8_t index, unsigned long startTime) {
+  const TrafficPhase& phase = trafficLight.program.phases[index];
+  trafficLight.phaseIndex = index;
+  trafficLight.phaseDeadline = startTime + phase.durationMs;
+  setIntersectionLamps(phase.lamps);
   
-  for (int i = 0; i < FLASH_CYCLES; i++) {
-    setTrafficLight(true, true, true);
-    delay(FLASH_DELAY_MS);
-    setTrafficLight(false, false, false);
-    delay(FLASH_DELAY_MS);
+  // Head A's colour at intersection 0 is what the LCD and the binary status
+  // report
+  if (phase.lamps[0] & LAMP_A_RED) {
+    trafficLight.currentState = TRAFFIC_RED;
+  } else if (phase.lamps[0] & LAMP_A_YELLOW) {
+    trafficLight.currentState = TRAFFIC_YELLOW;
+  } else if (phase.lamps[0] & LAMP_A_GREEN) {
+    trafficLight.currentState = TRAFFIC_GREEN;
   }
-  
-  Serial.println("Flash complete");
 }
 
-void emergencyFlash() {
-  trafficLight.isRunning = false;
-  Serial.println("Emergency flashing RED");
+// Scheduler task: moves to the next phase once the current one has ended
+// and returns the time left until the next transition
+unsigned long runTrafficLightCycle() {
+  if (!trafficLight.isRunning) return TASK_DONE;
   
-  for (int i = 0; i < EMERGENCY_FLASH_CYCLES; i++) {
-    setTrafficLight(true, false, false);
-    delay(EMERGENCY_FLASH_DELAY_MS);
-    setTrafficLight(false, false, false);
-    delay(EMERGENCY_FLASH_DELAY_MS);
+  unsigned long currentTime = millis();
+  long remaining = (long)(trafficLight.phaseDeadline - currentTime);
+  if (remaining > 0) return remaining;
+  
+  statsRecordPhaseLateness(-remaining);
+  if (remaining < 0) {
+    logEvent(LOG_TRAFFIC_LATE, -remaining);
   }
   
-  Serial.println("Emergency flash complete");
+  uint8_t from = trafficLight.program.phases[trafficLight.phaseIndex].lamps[0];
+  uint8_t next = trafficLight.phaseIndex + 1;
+  if (next >= trafficLight.program.count) {
+    next = 0;
+  }
+  enterTrafficPhase(next, trafficLight.phaseDeadline);
+  logEvent(LOG_TRAFFIC_PHASE, from, trafficLight.program.phases[next].lamps[0]);
+  
+  remaining = (long)(trafficLight.phaseDeadline - currentTime);
+  return remaining > 0 ? remaining : 0;
 }
 
 bool setTrafficTiming(unsigned long red, unsigned long yellow, unsigned long green) {
@@ -149,40 +231,140 @@ bool setTrafficTiming(unsigned long red, unsigned long yellow, unsigned long gre
     trafficLight.redTime = red;
     trafficLight.yellowTime = yellow;
     trafficLight.greenTime = green;
+    loadDefaultTrafficProgram();
     return true;
   }
   return false;
 }
 
-bool parseTimingCommand(String command) {
-  String timingStr = command.substring(6);
-  
-  int firstComma = timingStr.indexOf(',');
-  int secondComma = timingStr.indexOf(',', firstComma + 1);
+bool parseTimingCommand(const char* args) {
+  long newRedTime;
+  long newYellowTime;
+  long newGreenTime;
   
-  if (firstComma > 0 && secondComma > firstComma) {
-    unsigned long newRedTime = timingStr.substring(0, firstComma).toInt();
-    unsigned long newYellowTime = timingStr.substring(firstComma + 1, secondComma).toInt();
-    unsigned long newGreenTime = timingStr.substring(secondComma + 1).toInt();
-    
-    if (setTrafficTiming(newRedTime, newYellowTime, newGreenTime)) {
+  if (parseLong(args, newRedTime) && parseChar(args, ',') &&
+      parseLong(args, newYellowTime) && parseChar(args, ',') &&
+      parseLong(args, newGreenTime) && parseEnd(args)) {
+    if (newRedTime > 0 && newYellowTime > 0 && newGreenTime > 0 &&
+        setTrafficTiming(newRedTime, newYellowTime, newGreenTime)) {
       printTrafficTiming();
       return true;
     } else {
-      Serial.println("All timing values must be at least " + String(MIN_TIMING_MS) + "ms");
+      printLine(console, F("All timing values must be at least "), MIN_TIMING_MS, F("ms"));
       return false;
     }
   } else {
-    Serial.println("Invalid timing format. Use: timing5000,2000,4000");
+    console.println(F("Invalid timing format. Use: timing5000,2000,4000"));
     return false;
   }
 }
 
 void printTrafficTiming() {
-  Serial.println("Traffic timing updated:");
-  Serial.println("RED: " + String(trafficLight.redTime/1000) + "s");
-  Serial.println("YELLOW: " + String(trafficLight.yellowTime/1000) + "s");
-  Serial.println("GREEN: " + String(trafficLight.greenTime/1000) + "s");
+  console.println(F("Traffic timing updated:"));
+  printLine(console, F("RED: "), trafficLight.redTime/1000, 's');
+  printLine(console, F("YELLOW: "), trafficLight.yellowTime/1000, 's');
+  printLine(console, F("GREEN: "), trafficLight.greenTime/1000, 's');
+}
+
+// Lamp letters per field of a phase: head A / head B / pedestrian, e.g.
+// "r/g/w". "-" marks an empty field; trailing empty fields may be left out.
+// With more than one intersection their lamps are separated by ',', e.g.
+// "r/g,g/r:8000"; intersections left out copy the first one.
+// TRAFFIC_LAMP_LETTERS[field * 3 + i] is the letter of lamp bit field * 3 + i.
+const char TRAFFIC_LAMP_LETTERS[] PROGMEM = "rygrygwd";
+
+static char trafficLampLetter(uint8_t field, uint8_t i) {
+  return i < 3 ? pgm_read_byte(&TRAFFIC_LAMP_LETTERS[field * 3 + i]) : '\0';
+}
+
+// Parses one "lamps:milliseconds" phase and advances the cursor past it
+bool parseTrafficPhase(const char*& cursor, TrafficPhase& phase) {
+  const char* p = skipSpaces(cursor);
+  uint8_t lamps[TRAFFIC_INTERSECTIONS];
+  uint8_t intersection = 0;
+  uint8_t field = 0;
+  lamps[0] = 0;
+  
+  for (; *p != ':'; p++) {
+    char c = tolower(*p);
+    if (c == '/') {
+      if (++field >= 3) return false;
+      continue;
+    }
+    if (c == ',') {
+      if (++intersection >= TRAFFIC_INTERSECTIONS) return false;
+      lamps[intersection] = 0;
+      field = 0;
+      continue;
+    }
+    if (c == '-') continue;
+    
+    uint8_t i = 0;
+    while (trafficLampLetter(field, i) != '\0' && trafficLampLetter(field, i) != c) {
+      i++;
+    }
+    if (c == '\0' || trafficLampLetter(field, i) == '\0') return false;
+    lamps[intersection] |= 1 << (field * 3 + i);
+  }
+  p++;
+  
+  long duration;
+  if (*p == ' ' || !parseLong(p, duration) || duration < TRAFFIC_MIN_PHASE_MS) return false;
+  
+  for (uint8_t i = 0; i < TRAFFIC_INTERSECTIONS; i++) {
+    phase.lamps[i] = i <= intersection ? lamps[i] : lamps[0];
+  }
+  phase.durationMs = duration;
+  cursor = p;
+  return true;
+}
+
+// Inverse of the lamp part of parseTrafficPhase(); text needs 12 bytes
+void formatTrafficPhase(uint8_t lamps, char* text) {
+  uint8_t lastField = (lamps & (LAMP_WALK | LAMP_DONT_WALK)) ? 2
+                    : (lamps & (LAMP_B_RED | LAMP_B_YELLOW | LAMP_B_GREEN)) ? 1 : 0;
+  
+  for (uint8_t field = 0; field <= lastField; field++) {
+    if (field > 0) {
+      *text++ = '/';
+    }
+    bool any = false;
+    for (uint8_t i = 0; trafficLampLetter(field, i) != '\0'; i++) {
+      if (lamps & (1 << (field * 3 + i))) {
+        *text++ = trafficLampLetter(field, i);
+        any = true;
+      }
+    }
+    if (!any) {
+      *text++ = '-';
+    }
+  }
+  *text = '\0';
+}
+
+// Intersections are listed only when they differ from the first
+void printTrafficProgram() {
+  console.println(F("Traffic program:"));
+  for (uint8_t i = 0; i < trafficLight.program.count; i++) {
+    const TrafficPhase& phase = trafficLight.program.phases[i];
+    uint8_t shown = 1;
+    for (uint8_t n = 1; n < TRAFFIC_INTERSECTIONS; n++) {
+      if (phase.lamps[n] != phase.lamps[0]) {
+        shown = TRAFFIC_INTERSECTIONS;
+      }
+    }
+    
+    printItems(console, F("  "), i + 1, F(". "));
+    for (uint8_t n = 0; n < shown; n++) {
+      char lamps[12];
+      formatTrafficPhase(phase.lamps[n], lamps);
+      if (n > 0) {
+        console.write(',');
+      }
+      printItems(console, lamps);
+    }
+    printLine(console, ' ', phase.durationMs, F("ms"));
+  }
 }
 
-#endif // TRAFFIC_LIGHT_H
\ No newline at end of file
+#endif // TRAFFIC_LIGHT_H
@@ -0,0 +1,140 @@
+// Hot-path timing suite for the native build: pio test -e native -f test_bench -v
+//
+// Runs the firmware's own benchmark set (src/bench.h: loop pass with the
+// traffic cycle, executeStep, command lookup, LCD redraw, lamp latch) and
+// times processCommand() over a command corpus. Every result is a CSV row
+//   bench,<name>,<iterations>,<unit>,<min>,<mean>,<max>
+// printed to standard output and, when BENCH_CSV names a file, written
+// there too so runs can be compared in review. Times are host nanoseconds;
+// 'bench' on the board gives the same rows in CPU cycles.
+
+#include <Arduino.h>
+#include <ArduinoSim.h>
+#include <stdio.h>
+#include <unity.h>
+
+// Implemented in src/main.cpp, src/commands.h and src/bench.h
+void setup();
+void loop();
+void processCommand(const char* input);
+void runBenchmarks();
+
+#define BENCH_OUTPUT_SIZE 4096
+#define PROCESS_COMMAND_ROUNDS 50
+#define PROCESS_COMMAND_PASSES 20  // loop() passes after each command, untimed
+
+static const char* const BENCH_ROWS[] = {
+  "loop_pass", "execute_step", "command_lookup", "lcd_redraw_full", "lcd_redraw_unchanged", "lamp_latch"
+};
+
+// Full dispatch, handler included. Handlers really run, so the corpus
+// moves the motor, changes the lamps and restarts the traffic cycle.
+static const char* const PROCESS_COMMAND_CORPUS[] = {
+  "f100", "r100", "s5", "accel800", "vmax1000", "stop", "traffic", "red",
+  "yellow", "green", "alloff", "allon", "timing5000,2000,4000", "program r/g:1000 r/y:500",
+  "goto 200", "zero", "help", "FLASH", "unknown", "traffic"
+};
+
+#define PROCESS_COMMAND_CORPUS_SIZE (sizeof(PROCESS_COMMAND_CORPUS) / sizeof(PROCESS_COMMAND_CORPUS[0]))
+
+static char benchOutput[BENCH_OUTPUT_SIZE];
+static FILE* benchCsv = NULL;
+
+static void benchWriteRow(const char* row) {
+  printf("%s\n", row);
+  if (benchCsv != NULL) {
+    fprintf(benchCsv, "%s\n", row);
+  }
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+void test_firmware_benchmarks() {
+  simSerialCapture(benchOutput, sizeof(benchOutput));
+  runBenchmarks();
+  simSerialCapture(NULL, 0);
+  
+  TEST_ASSERT_NOT_NULL_MESSAGE(strstr(benchOutput, "bench,end"), "benchmark run did not finish");
+  for (size_t i = 0; i < sizeof(BENCH_ROWS) / sizeof(BENCH_ROWS[0]); i++) {
+    char prefix[32];
+    snprintf(prefix, sizeof(prefix), "bench,%s,", BENCH_ROWS[i]);
+    const char* row = strstr(benchOutput, prefix);
+    TEST_ASSERT_NOT_NULL_MESSAGE(row, BENCH_ROWS[i]);
+    
+    char line[96];
+    size_t length = strcspn(row, "\n");
+    TEST_ASSERT_LESS_THAN(sizeof(line), length);
+    memcpy(line, row, length);
+    line[length] = '\0';
+    
+    unsigned int iterations = 0;
+    TEST_ASSERT_EQUAL(1, sscanf(line + strlen(prefix), "%u", &iterations));
+    TEST_ASSERT_GREATER_THAN(0, iterations);
+    benchWriteRow(line);
+  }
+}
+
+void test_process_command_throughput() {
+  uint32_t minimum = 0xFFFFFFFFUL;
+  uint32_t maximum = 0;
+  unsigned long long total = 0;
+  unsigned int iterations = 0;
+  
+  for (unsigned int round = 0; round < PROCESS_COMMAND_ROUNDS; round++) {
+    for (size_t i = 0; i < PROCESS_COMMAND_CORPUS_SIZE; i++) {
+      simSerialCapture(benchOutput, sizeof(benchOutput));
+      uint32_t start = simHostNanos();
+      processCommand(PROCESS_COMMAND_CORPUS[i]);
+      uint32_t elapsed = simHostNanos() - start;
+      
+      if (elapsed < minimum) {
+        minimum = elapsed;
+      }
+      if (elapsed > maximum) {
+        maximum = elapsed;
+      }
+      total += elapsed;
+      iterations++;
+      
+      for (unsigned int pass = 0; pass < PROCESS_COMMAND_PASSES; pass++) {
+        loop();
+        simAdvanceMicros(100);
+      }
+    }
+  }
+  simSerialCapture(NULL, 0);
+  
+  TEST_ASSERT_EQUAL(PROCESS_COMMAND_ROUNDS * PROCESS_COMMAND_CORPUS_SIZE, iterations);
+  char row[96];
+  snprintf(row, sizeof(row), "bench,process_command,%u,ns,%lu,%lu,%lu", iterations,
+           (unsigned long)minimum, (unsigned long)(total / iterations), (unsigned long)maximum);
+  benchWriteRow(row);
+}
+
+int main(int argc, char** argv) {
+  const char* path = getenv("BENCH_CSV");
+  if (path != NULL) {
+    benchCsv = fopen(path, "w");
+    if (benchCsv != NULL) {
+      fprintf(benchCsv, "bench,name,iterations,unit,min,mean,max\n");
+    }
+  }
+  
+  simSerialCapture(benchOutput, sizeof(benchOutput));
+  setup();
+  simSerialCapture(NULL, 0);
+  
+  UNITY_BEGIN();
+  RUN_TEST(test_firmware_benchmarks);
+  RUN_TEST(test_process_command_throughput);
+  int failures = UNITY_END();
+  
+  if (benchCsv != NULL) {
+    fclose(benchCsv);
+  }
+  return failures;
+}
@@ -0,0 +1,114 @@
+// Command dispatch rate: pio test -e native -f test_command_dispatch -v, or
+// -e megaatmega2560 for the same figure on the board
+//
+// Times findCommand(), the name match and argument split processCommand()
+// does for every line, over a command corpus, and prints
+//   command_dispatch,<commands>,<us>,<commands per second>
+// Handlers are not called: they print to the 9600 baud console and would
+// time the UART instead. The routing checks cover the names that share a
+// prefix with a shorter one.
+
+#include <Arduino.h>
+#include <unity.h>
+#ifdef ARDUINO_SIM
+#include <ArduinoSim.h>
+#endif
+
+// Implemented in src/commands.h
+struct Command;
+const Command* findCommand(const char* input, const char*& args);
+
+#define DISPATCH_ROUNDS 200
+
+static const char* const DISPATCH_CORPUS[] = {
+  "f100", "r100", "s5", "accel800", "vmax1000", "stop", "traffic", "red",
+  "yellow", "green", "alloff", "allon", "timing5000,2000,4000", "flash",
+  "emergency", "demo", "loop", "help", "FLASH", "unknown"
+};
+
+#define DISPATCH_CORPUS_SIZE (sizeof(DISPATCH_CORPUS) / sizeof(DISPATCH_CORPUS[0]))
+
+// Keeps the timed lookups from being optimised out under LTO
+static const Command* volatile dispatchResult;
+
+// The simulated micros() only moves when the simulator is told to, so the
+// host build reads the host clock
+#ifdef ARDUINO_SIM
+static uint32_t dispatchClockStart() {
+  return simHostNanos();
+}
+
+static unsigned long dispatchElapsedMicros(uint32_t start) {
+  return (simHostNanos() - start) / 1000;
+}
+#else
+static uint32_t dispatchClockStart() {
+  return micros();
+}
+
+static unsigned long dispatchElapsedMicros(uint32_t start) {
+  return micros() - start;
+}
+#endif
+
+static const Command* lookup(const char* input) {
+  const char* args;
+  return findCommand(input, args);
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+void test_longest_name_wins() {
+  TEST_ASSERT_NOT_NULL(lookup("stop"));
+  TEST_ASSERT_TRUE(lookup("stop") != lookup("s5"));
+  TEST_ASSERT_TRUE(lookup("red") != lookup("r100"));
+  TEST_ASSERT_TRUE(lookup("flash") != lookup("f100"));
+  TEST_ASSERT_TRUE(lookup("FLASH") == lookup("flash"));
+  TEST_ASSERT_NULL(lookup("unknown"));
+  
+  const char* args;
+  findCommand("timing5000,2000,4000", args);
+  TEST_ASSERT_EQUAL_STRING("5000,2000,4000", args);
+}
+
+void test_dispatch_rate() {
+  uint32_t start = dispatchClockStart();
+  for (unsigned int round = 0; round < DISPATCH_ROUNDS; round++) {
+    for (size_t i = 0; i < DISPATCH_CORPUS_SIZE; i++) {
+      dispatchResult = lookup(DISPATCH_CORPUS[i]);
+    }
+  }
+  unsigned long elapsed = dispatchElapsedMicros(start);
+  
+  unsigned long commands = DISPATCH_ROUNDS * DISPATCH_CORPUS_SIZE;
+  TEST_ASSERT_GREATER_THAN(0, elapsed);
+  char row[64];
+  snprintf(row, sizeof(row), "command_dispatch,%lu,%lu,%lu", commands, elapsed,
+           (unsigned long)(commands * 1000000ULL / elapsed));
+  TEST_MESSAGE(row);
+}
+
+static int runDispatchTests() {
+  UNITY_BEGIN();
+  RUN_TEST(test_longest_name_wins);
+  RUN_TEST(test_dispatch_rate);
+  return UNITY_END();
+}
+
+#ifdef ARDUINO_SIM
+int main(int argc, char** argv) {
+  return runDispatchTests();
+}
+#else
+void setup() {
+  delay(2000);  // opening the port resets the board; let the runner attach
+  runDispatchTests();
+}
+
+void loop() {
+}
+#endif
@@ -0,0 +1,110 @@
+// Cycles per coil step on the board: pio test -e megaatmega2560 -f test_step_cycles -v
+//
+// Times executeStep() against the four digitalWrite() calls it made before
+// the coil tables moved to PROGMEM port bits (src/coil_output.h). Timer5
+// counts CPU clocks with interrupts off; the counter read is measured and
+// taken off, the call into each path is not. Both paths print a row
+//   step_cycles,<path>,<steps>,<min>,<mean>,<max>
+// so the digitalWrite() baseline and the port-write figure come out of the
+// same run, side by side.
+
+#include <Arduino.h>
+#include <unity.h>
+#include "config.h"
+
+// Implemented in src/motor.h and src/coil_output.h
+void initializeMotor();
+void executeStep(MotorDirection direction);
+void releaseCoils();
+
+#define STEP_SAMPLES 800  // a hundred turns of the half-step sequence
+
+// The SRAM int table and pin writes executeStep() used before
+const int LEGACY_STEP_SEQUENCE[MOTOR_STEPS_PER_REVOLUTION][4] = {
+  {1, 0, 0, 0},
+  {1, 1, 0, 0},
+  {0, 1, 0, 0},
+  {0, 1, 1, 0},
+  {0, 0, 1, 0},
+  {0, 0, 1, 1},
+  {0, 0, 0, 1},
+  {1, 0, 0, 1}
+};
+
+static int legacyStep = 0;
+
+static void legacyExecuteStep(MotorDirection direction) {
+  if (direction == CLOCKWISE) {
+    legacyStep = (legacyStep + 1) % MOTOR_STEPS_PER_REVOLUTION;
+  } else {
+    legacyStep = (legacyStep - 1 + MOTOR_STEPS_PER_REVOLUTION) % MOTOR_STEPS_PER_REVOLUTION;
+  }
+  
+  digitalWrite(MOTOR_IN1_PIN, LEGACY_STEP_SEQUENCE[legacyStep][0]);
+  digitalWrite(MOTOR_IN2_PIN, LEGACY_STEP_SEQUENCE[legacyStep][1]);
+  digitalWrite(MOTOR_IN3_PIN, LEGACY_STEP_SEQUENCE[legacyStep][2]);
+  digitalWrite(MOTOR_IN4_PIN, LEGACY_STEP_SEQUENCE[legacyStep][3]);
+}
+
+struct StepCycles {
+  uint16_t minimum;
+  uint16_t maximum;
+  uint32_t total;
+};
+
+static StepCycles timeSteps(const char* path, void (*step)(MotorDirection)) {
+  StepCycles cycles = {0xFFFF, 0, 0};
+  TCCR5A = 0;
+  TCCR5B = _BV(CS50);
+  
+  uint8_t oldSREG = SREG;
+  cli();
+  uint16_t start = TCNT5;
+  uint16_t overhead = TCNT5 - start;
+  for (unsigned int i = 0; i < STEP_SAMPLES; i++) {
+    start = TCNT5;
+    step(CLOCKWISE);
+    uint16_t elapsed = TCNT5 - start - overhead;
+    
+    if (elapsed < cycles.minimum) {
+      cycles.minimum = elapsed;
+    }
+    if (elapsed > cycles.maximum) {
+      cycles.maximum = elapsed;
+    }
+    cycles.total += elapsed;
+  }
+  SREG = oldSREG;
+  TCCR5B = 0;
+  releaseCoils();
+  
+  char row[64];
+  snprintf(row, sizeof(row), "step_cycles,%s,%u,%u,%lu,%u", path, STEP_SAMPLES, cycles.minimum,
+           (unsigned long)(cycles.total / STEP_SAMPLES), cycles.maximum);
+  TEST_MESSAGE(row);
+  return cycles;
+}
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+void test_port_write_beats_digital_write() {
+  StepCycles legacy = timeSteps("digitalwrite", legacyExecuteStep);
+  StepCycles current = timeSteps("port_write", executeStep);
+  TEST_ASSERT_LESS_THAN(legacy.total, current.total);
+}
+
+void setup() {
+  delay(2000);  // opening the port resets the board; let the runner attach
+  initializeMotor();
+  
+  UNITY_BEGIN();
+  RUN_TEST(test_port_write_beats_digital_write);
+  UNITY_END();
+}
+
+void loop() {
+}
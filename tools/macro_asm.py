@@ -0,0 +1,145 @@
+#!/usr/bin/env python3
+"""Assembler for the firmware's macro programs (see src/macro_vm.h).
+
+Reads a text program and prints the console lines that upload it:
+
+    macro_asm.py blink.mac blink > blink.txt
+
+then send blink.txt to the console line by line and start it with
+'macro run blink'. One instruction per line, '#' starts a comment:
+
+    repeat 5
+      lamps a_red|b_green    # lamp names or a number
+      wait 500
+      lamps 0
+      wait 500
+    next
+    move 2000
+    await 0
+    lcd_at 0 1
+    lcd_text "DONE"
+
+END is appended when the program does not finish with one.
+"""
+
+import argparse
+import shlex
+import sys
+
+# MacroOpcode in src/macro_vm.h: (opcode, operand sizes in bytes)
+OPCODES = {
+    "end": (0x00, ()),
+    "lamps": (0x01, (1,)),
+    "wait": (0x02, (2,)),
+    "move": (0x03, (4,)),
+    "goto": (0x04, (4,)),
+    "await": (0x05, (2,)),
+    "repeat": (0x06, (1,)),
+    "next": (0x07, ()),
+    "lcd_clear": (0x08, ()),
+    "lcd_at": (0x09, (1, 1)),
+    "lcd_text": (0x0A, None),
+    "lcd_steps": (0x0B, ()),
+    "lcd_percent": (0x0C, (4,)),
+    "event": (0x0D, (1, 2)),
+}
+
+# LAMP_* masks in src/lamp_output.h
+LAMPS = {
+    "a_red": 0x01, "a_yellow": 0x02, "a_green": 0x04,
+    "b_red": 0x08, "b_yellow": 0x10, "b_green": 0x20,
+    "walk": 0x40, "dont_walk": 0x80,
+}
+
+# LogEvent in src/event_log.h that make sense from a program
+EVENTS = {"demo_reverse": 2, "loop_light": 3}
+
+# Must match the limits in src/config.h
+MACRO_NAME_MAX = 8
+MACRO_CODE_MAX = 116
+DATA_BYTES_PER_LINE = 26  # "macro data " + 52 digits fits SERIAL_LINE_MAX
+
+
+def parse_number(text, size, names=None):
+    if names and not text[0].isdigit() and text[0] != "-":
+        value = 0
+        for name in text.lower().split("|"):
+            if name not in names:
+                raise ValueError("unknown name %r" % name)
+            value |= names[name]
+    else:
+        value = int(text, 0)
+    bits = size * 8
+    if not -(1 << (bits - 1)) <= value < (1 << bits):
+        raise ValueError("%s does not fit in %d bytes" % (text, size))
+    return (value & ((1 << bits) - 1)).to_bytes(size, "little")
+
+
+def assemble(source):
+    code = bytearray()
+    depth = 0
+    for number, line in enumerate(source.splitlines(), 1):
+        try:
+            words = shlex.split(line, comments=True)
+            if not words:
+                continue
+            mnemonic, operands = words[0].lower(), words[1:]
+            if mnemonic not in OPCODES:
+                raise ValueError("unknown instruction %r" % mnemonic)
+            opcode, sizes = OPCODES[mnemonic]
+            code.append(opcode)
+            if sizes is None:
+                text = " ".join(operands).encode("ascii")
+                if not 0 < len(text) <= 20:
+                    raise ValueError("lcd_text takes 1 to 20 characters")
+                code.append(len(text))
+                code += text
+                continue
+            if len(operands) != len(sizes):
+                raise ValueError("%s takes %d operands" % (mnemonic, len(sizes)))
+            names = LAMPS if mnemonic == "lamps" else EVENTS if mnemonic == "event" else None
+            for i, (operand, size) in enumerate(zip(operands, sizes)):
+                code += parse_number(operand, size, names if i == 0 else None)
+            depth += {"repeat": 1, "next": -1}.get(mnemonic, 0)
+            if depth < 0:
+                raise ValueError("next without repeat")
+        except ValueError as error:
+            raise ValueError("line %d: %s" % (number, error))
+    if depth:
+        raise ValueError("repeat without next")
+    if not code or code[-1] != OPCODES["end"][0]:
+        code.append(OPCODES["end"][0])
+    if len(code) > MACRO_CODE_MAX:
+        raise ValueError("program is %d bytes, the limit is %d" % (len(code), MACRO_CODE_MAX))
+    return bytes(code)
+
+
+def upload_lines(name, code):
+    yield "macro begin " + name
+    for i in range(0, len(code), DATA_BYTES_PER_LINE):
+        yield "macro data " + code[i:i + DATA_BYTES_PER_LINE].hex()
+    yield "macro end"
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("source", help="program text, - for stdin")
+    parser.add_argument("name", help="macro name (lower case, at most %d characters)" % MACRO_NAME_MAX)
+    args = parser.parse_args()
+
+    if not 0 < len(args.name) <= MACRO_NAME_MAX or not args.name.replace("_", "").isalnum():
+        parser.error("invalid macro name %r" % args.name)
+    source = sys.stdin.read() if args.source == "-" else open(args.source).read()
+    try:
+        code = assemble(source)
+    except ValueError as error:
+        print("%s: %s" % (args.source, error), file=sys.stderr)
+        return 1
+    for line in upload_lines(args.name.lower(), code):
+        print(line)
+    print("%d bytes" % len(code), file=sys.stderr)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,228 @@
+#!/usr/bin/env python3
+"""Host client for the firmware's binary protocol (see src/binary_protocol.h).
+
+Requests are given as console-style commands: ping, status, text, or any
+command with a binary opcode followed by its arguments (f100, timing5000,2000,4000).
+
+Against a board:      proto_client.py --port /dev/ttyACM0 status f100 --repeat 200
+Against the simulator: proto_client.py --sim .pio/build/native/program ping status f100
+
+The simulator run is a loopback check: every reply is decoded, its CRC and
+sequence number verified, and the exit status is non-zero on any mismatch.
+"""
+
+import argparse
+import subprocess
+import sys
+import time
+
+PROTOCOL_BAUD_RATE = 500000
+CONSOLE_BAUD_RATE = 9600
+
+OP_PING = 0x01
+OP_STATUS = 0x02
+OP_TEXT_MODE = 0x03
+OP_REPLY = 0x80
+
+STATUS_NAMES = {
+    0x00: "ok",
+    0x01: "bad frame",
+    0x02: "bad crc",
+    0x03: "unknown opcode",
+    0x04: "bad argument",
+}
+
+# Opcodes from COMMAND_TABLE in src/commands.h
+COMMAND_OPCODES = {
+    "f": 0x10, "r": 0x11, "stop": 0x12, "s": 0x13, "accel": 0x14, "vmax": 0x15,
+    "demo": 0x16, "m": 0x17, "mode": 0x18, "goto": 0x19, "zero": 0x1A,
+    "red": 0x20, "yellow": 0x21, "green": 0x22, "alloff": 0x23,
+    "allon": 0x24, "flash": 0x25, "emergency": 0x26, "traffic": 0x27,
+    "timing": 0x28, "loop": 0x29, "program": 0x2A,
+}
+
+# Commands with COMMAND_OPCODE_NONE; "stats" and "macro" must not fall
+# through to "s" and "m"
+TEXT_ONLY_COMMANDS = ("stats", "bench", "binary", "help", "macro")
+
+
+def crc16(data):
+    crc = 0xFFFF
+    for value in data:
+        crc ^= value << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xFFFF
+    return crc
+
+
+def cobs_encode(data):
+    out = bytearray()
+    block = bytearray()
+    for value in data:
+        if value == 0:
+            out.append(len(block) + 1)
+            out += block
+            block = bytearray()
+        else:
+            block.append(value)
+            if len(block) == 254:
+                out.append(255)
+                out += block
+                block = bytearray()
+    out.append(len(block) + 1)
+    out += block
+    return bytes(out) + b"\x00"
+
+
+def cobs_decode(frame):
+    out = bytearray()
+    i = 0
+    while i < len(frame):
+        code = frame[i]
+        if code == 0 or i + code > len(frame):
+            raise ValueError("broken COBS frame")
+        out += frame[i + 1:i + code]
+        i += code
+        if code != 0xFF and i < len(frame):
+            out.append(0)
+    return bytes(out)
+
+
+def encode_request(seq, opcode, payload=b""):
+    packet = bytes([seq & 0xFF, opcode]) + payload
+    crc = crc16(packet)
+    return cobs_encode(packet + bytes([crc & 0xFF, crc >> 8]))
+
+
+def decode_reply(frame):
+    """Returns (seq, opcode, status, payload) from an encoded frame without its 0x00."""
+    packet = cobs_decode(frame)
+    if len(packet) < 5:
+        raise ValueError("short reply")
+    body, crc = packet[:-2], packet[-2] | (packet[-1] << 8)
+    if crc16(body) != crc:
+        raise ValueError("reply CRC mismatch")
+    if not body[1] & OP_REPLY:
+        raise ValueError("not a reply")
+    return body[0], body[1] & ~OP_REPLY, body[2], body[3:]
+
+
+def parse_request(text):
+    """Maps a console-style command to (opcode, payload)."""
+    if text == "ping":
+        return OP_PING, b"ping"
+    if text == "status":
+        return OP_STATUS, b""
+    if text == "text":
+        return OP_TEXT_MODE, b""
+    if text.lower().startswith(TEXT_ONLY_COMMANDS):
+        raise ValueError("%r is only available on the text console" % text)
+    # Longest name first, as the firmware's table order guarantees
+    for name in sorted(COMMAND_OPCODES, key=len, reverse=True):
+        if text.lower().startswith(name):
+            return COMMAND_OPCODES[name], text[len(name):].strip().encode()
+    raise ValueError("no binary opcode for %r" % text)
+
+
+def describe(opcode, status, payload):
+    line = "op=0x%02X %s" % (opcode, STATUS_NAMES.get(status, "status 0x%02X" % status))
+    if opcode == OP_STATUS and status == 0 and len(payload) == 11:
+        steps = int.from_bytes(payload[2:6], "little", signed=True)
+        position = int.from_bytes(payload[7:11], "little", signed=True)
+        line += " motor=%s traffic=%s phase=%d steps_remaining=%d queued=%d position=%d" % (
+            "running" if payload[0] & 1 else "idle",
+            "running" if payload[0] & 2 else "off",
+            payload[1], steps, payload[6], position)
+    elif payload:
+        line += " payload=" + payload.hex()
+    return line
+
+
+def run_sim(program, requests, wait_ms):
+    script = ["binary", "@tx hex"]
+    for seq, (opcode, payload) in enumerate(requests):
+        script.append("@rx " + encode_request(seq, opcode, payload).hex(" "))
+        script.append("@wait %d" % wait_ms)
+    result = subprocess.run([program], input="\n".join(script) + "\n",
+                            capture_output=True, text=True, check=True)
+    
+    replies = []
+    for line in result.stdout.splitlines():
+        # Console text after a switch back to text mode is not a frame
+        if line.startswith("[sim] tx: ") and line.endswith(" 00"):
+            data = bytes.fromhex(line[len("[sim] tx: "):])
+            replies.append(data.rstrip(b"\x00"))
+    return replies
+
+
+def run_port(port, requests, repeat):
+    import serial  # pyserial, only needed for real hardware
+    
+    with serial.Serial(port, CONSOLE_BAUD_RATE, timeout=2) as link:
+        time.sleep(2)  # the Mega resets when the port opens
+        link.reset_input_buffer()
+        link.write(b"binary\n")
+        link.readline()
+        link.flush()
+        link.baudrate = PROTOCOL_BAUD_RATE
+        time.sleep(0.05)
+        link.reset_input_buffer()
+        
+        replies = []
+        seq = 0
+        start = time.monotonic()
+        for _ in range(repeat):
+            for opcode, payload in requests:
+                link.write(encode_request(seq, opcode, payload))
+                replies.append(link.read_until(b"\x00").rstrip(b"\x00"))
+                seq = (seq + 1) & 0xFF
+        elapsed = time.monotonic() - start
+        
+        link.write(encode_request(seq, OP_TEXT_MODE))
+        link.read_until(b"\x00")
+    
+    count = repeat * len(requests)
+    print("%d round trips in %.3f s (%.0f/s)" % (count, elapsed, count / elapsed))
+    return replies
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    target = parser.add_mutually_exclusive_group(required=True)
+    target.add_argument("--port", help="serial port of the board")
+    target.add_argument("--sim", help="path to the native simulation build")
+    parser.add_argument("--repeat", type=int, default=1, help="send the request list this many times (board only)")
+    parser.add_argument("--wait-ms", type=int, default=5, help="virtual time between simulated requests")
+    parser.add_argument("requests", nargs="+")
+    args = parser.parse_args()
+    
+    requests = [parse_request(text) for text in args.requests]
+    if args.sim:
+        replies = run_sim(args.sim, requests, args.wait_ms)
+        expected = list(enumerate(requests))
+    else:
+        replies = run_port(args.port, requests, args.repeat)
+        expected = [(i & 0xFF, requests[i % len(requests)]) for i in range(len(replies))]
+    
+    failures = 0
+    if len(replies) != len(expected):
+        print("expected %d replies, got %d" % (len(expected), len(replies)))
+        failures += 1
+    for (seq, (opcode, _)), frame in zip(expected, replies):
+        try:
+            reply_seq, reply_opcode, status, payload = decode_reply(frame)
+        except ValueError as error:
+            print("seq %d: %s" % (seq, error))
+            failures += 1
+            continue
+        if (reply_seq, reply_opcode) != (seq, opcode) or status != 0:
+            failures += 1
+        if args.sim or args.repeat == 1:
+            print("seq %d: %s" % (reply_seq, describe(reply_opcode, status, payload)))
+    
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
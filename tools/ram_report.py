@@ -0,0 +1,96 @@
+#!/usr/bin/env python3
+"""Static SRAM report for a firmware ELF, optionally against a baseline.
+
+Sums the sections the AVR startup code places in SRAM (.data, .bss, .noinit)
+and lists the largest .data symbols, which is where string literals and
+tables end up when they are not in PROGMEM. With a baseline ELF every figure
+is printed as before -> after.
+
+    ram_report.py .pio/build/megaatmega2560/firmware.elf
+    ram_report.py --baseline old.elf .pio/build/megaatmega2560/firmware.elf
+
+The heap and stack are not static; 'stats' on the board reports the heap
+peak and the stack headroom at run time.
+"""
+
+import argparse
+import struct
+import sys
+
+SRAM_BYTES = 8192  # ATmega2560
+RAM_SECTIONS = (".data", ".bss", ".noinit")
+
+SHT_SYMTAB = 2
+STT_OBJECT = 1
+
+
+def read_elf(path):
+    """Returns ({section name: size}, [(symbol size, symbol name, section name)])."""
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[:4] != b"\x7fELF" or data[4] != 1:
+        raise ValueError(path + ": not a 32-bit ELF file")
+
+    endian = "<" if data[5] == 1 else ">"
+    shoff, = struct.unpack_from(endian + "I", data, 0x20)
+    shentsize, shnum, shstrndx = struct.unpack_from(endian + "HHH", data, 0x2E)
+
+    headers = []
+    for i in range(shnum):
+        name, kind, _, _, offset, size, link, _, _, entsize = struct.unpack_from(
+            endian + "IIIIIIIIII", data, shoff + i * shentsize)
+        headers.append((name, kind, offset, size, link, entsize))
+
+    def string_at(table, index):
+        start = headers[table][2] + index
+        return data[start:data.index(b"\0", start)].decode()
+
+    names = [string_at(shstrndx, h[0]) for h in headers]
+    sections = {names[i]: h[3] for i, h in enumerate(headers)}
+
+    symbols = []
+    for i, (_, kind, offset, size, link, entsize) in enumerate(headers):
+        if kind != SHT_SYMTAB:
+            continue
+        for at in range(offset, offset + size, entsize):
+            name, _, sym_size, info, _, shndx = struct.unpack_from(endian + "IIIBBH", data, at)
+            if info & 0xF == STT_OBJECT and sym_size > 0 and shndx < len(names):
+                symbols.append((sym_size, string_at(link, name), names[shndx]))
+    return sections, symbols
+
+
+def ram_figures(sections):
+    figures = [(name, sections.get(name, 0)) for name in RAM_SECTIONS]
+    static = sum(size for _, size in figures)
+    figures.append(("static total", static))
+    figures.append(("left for heap and stack", SRAM_BYTES - static))
+    return figures
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--baseline", help="ELF to compare against")
+    parser.add_argument("--top", type=int, default=10, help="number of .data symbols to list")
+    parser.add_argument("elf")
+    args = parser.parse_args()
+
+    sections, symbols = read_elf(args.elf)
+    after = ram_figures(sections)
+    if args.baseline:
+        before = dict(ram_figures(read_elf(args.baseline)[0]))
+        for name, size in after:
+            print("%-24s %6d -> %6d  (%+d)" % (name, before[name], size, size - before[name]))
+    else:
+        for name, size in after:
+            print("%-24s %6d" % (name, size))
+
+    data_symbols = sorted((s for s in symbols if s[2] == ".data"), reverse=True)[:args.top]
+    if data_symbols:
+        print("\nLargest .data symbols:")
+        for size, name, _ in data_symbols:
+            print("%6d  %s" % (size, name))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
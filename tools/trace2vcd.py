@@ -0,0 +1,266 @@
+#!/usr/bin/env python3
+"""Converts a 'trace dump' from the firmware (see src/trace.h) into a VCD file.
+
+The dump can come from a saved console log, from a board, or from a run of
+the native simulation build:
+
+    trace2vcd.py console.log -o trace.vcd
+    trace2vcd.py --port /dev/ttyACM0 -o trace.vcd
+    trace2vcd.py --sim .pio/build/native/program -o trace.vcd "trace start" f200 "@wait 1000"
+
+With --sim the arguments are scenario lines run before the dump. Open the
+result in GTKWave. Coil patterns, lamps, the last command and LCD flush
+sizes are vectors; cmd and lcd are also strobes, and step_us_<axis> holds the
+interval before each step, which shows step jitter as a trace of its own.
+A summary of the step intervals is printed to stderr.
+"""
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+import time
+
+CONSOLE_BAUD_RATE = 9600
+
+# TraceKind in src/trace.h
+TRACE_COIL = 0
+TRACE_LAMPS = 1
+TRACE_COMMAND = 2
+TRACE_LCD_FLUSH = 3
+
+RECORD_BYTES = 6
+AXIS_NAMES = "xyza"
+
+# LAMP_* bits of intersection 0, src/lamp_output.h
+LAMP_NAMES = ("a_red", "a_yellow", "a_green", "b_red", "b_yellow", "b_green", "walk", "dont_walk")
+
+COMMANDS_H = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "src", "commands.h")
+
+
+def crc16(data):
+    crc = 0xFFFF
+    for value in data:
+        crc ^= value << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xFFFF
+    return crc
+
+
+def command_names(path=COMMANDS_H):
+    """COMMAND_TABLE index -> command name, read from the firmware source."""
+    try:
+        with open(path) as f:
+            source = f.read()
+    except OSError:
+        return {}
+    names = dict(re.findall(r'COMMAND_TEXT\((\w+), "([^"]*)"', source))
+    table = re.search(r"COMMAND_TABLE\[\] PROGMEM = \{(.*?)\n\};", source, re.S)
+    if not table:
+        return {}
+    ids = re.findall(r"\{COMMAND_NAME_(\w+),", table.group(1))
+    return {index: names.get(ident, ident.lower()) for index, ident in enumerate(ids)}
+
+
+def parse_dump(lines):
+    """Returns ([(time, kind, value)], overwritten) from the last complete dump."""
+    records = None
+    result = None
+    for line in lines:
+        line = line.strip()
+        if line.startswith("trace begin "):
+            count, overwritten = (int(field) for field in line.split()[2:4])
+            records = bytearray()
+        elif records is not None and line.startswith("T "):
+            records += bytes.fromhex(line[2:])
+        elif records is not None and line.startswith("trace end "):
+            if len(records) != count * RECORD_BYTES:
+                raise ValueError("dump has %d bytes, expected %d" % (len(records), count * RECORD_BYTES))
+            if crc16(records) != int(line.split()[2], 16):
+                raise ValueError("dump CRC mismatch")
+            result = (records, overwritten)
+            records = None
+    if result is None:
+        raise ValueError("no complete 'trace begin' ... 'trace end' dump found")
+
+    data, overwritten = result
+    events = []
+    for i in range(0, len(data), RECORD_BYTES):
+        events.append((int.from_bytes(data[i:i + 4], "little"), data[i + 4], data[i + 5]))
+    return events, overwritten
+
+
+def read_sim(program, script):
+    lines = list(script) + ["trace dump", "@wait 5000"]
+    result = subprocess.run([program], input="\n".join(lines) + "\n",
+                            capture_output=True, text=True, check=True)
+    return result.stdout.splitlines()
+
+
+def read_port(port):
+    import serial  # pyserial, only needed for real hardware
+
+    with serial.Serial(port, CONSOLE_BAUD_RATE, timeout=5) as link:
+        # Opening the port resets the Mega unless the reset line is held off;
+        # a reset clears the ring, so a board that did reset has nothing to dump
+        time.sleep(0.1)
+        link.reset_input_buffer()
+        link.write(b"trace dump\n")
+        lines = []
+        while True:
+            line = link.readline().decode("ascii", "replace")
+            if not line:
+                raise ValueError("timed out waiting for the dump")
+            lines.append(line)
+            if line.startswith("trace end "):
+                return lines
+
+
+class VcdWriter:
+    def __init__(self, out):
+        self.out = out
+        self.signals = {}
+        self.last = {}
+        self.now = None
+
+    def declare(self, scope, name, kind, width):
+        ident = ""
+        n = len(self.signals)
+        while True:
+            ident += chr(33 + n % 94)
+            n //= 94
+            if n == 0:
+                break
+        self.signals[(scope, name)] = (ident, kind, width)
+
+    def header(self, comments):
+        self.out.write("$date %s $end\n" % time.strftime("%Y-%m-%d %H:%M:%S"))
+        self.out.write("$version trace2vcd.py $end\n")
+        for comment in comments:
+            self.out.write("$comment %s $end\n" % comment)
+        self.out.write("$timescale 1us $end\n")
+        scopes = {}
+        for (scope, name), signal in self.signals.items():
+            scopes.setdefault(scope, []).append((name, signal))
+        self.out.write("$scope module firmware $end\n")
+        for scope, signals in scopes.items():
+            self.out.write("$scope module %s $end\n" % scope)
+            for name, (ident, kind, width) in signals:
+                self.out.write("$var %s %d %s %s $end\n" % (kind, width, ident, name))
+            self.out.write("$upscope $end\n")
+        self.out.write("$upscope $end\n$enddefinitions $end\n")
+
+    def change(self, t, scope, name, value):
+        ident, kind, width = self.signals[(scope, name)]
+        if kind != "event" and ident in self.last and self.last[ident] == value:
+            return
+        self.last[ident] = value
+        if t != self.now:
+            self.out.write("#%d\n" % t)
+            self.now = t
+        if kind == "event":
+            self.out.write("1%s\n" % ident)
+        elif width == 1:
+            self.out.write("%s%s\n" % ("x" if value is None else value, ident))
+        else:
+            self.out.write("b%s %s\n" % ("x" if value is None else format(value, "b"), ident))
+
+
+def write_vcd(out, events, overwritten, names):
+    axes = sorted({value >> 4 for _, kind, value in events if kind == TRACE_COIL})
+    vcd = VcdWriter(out)
+    for axis in axes:
+        vcd.declare("coils", "coil_" + AXIS_NAMES[axis], "wire", 4)
+        vcd.declare("coils", "step_us_" + AXIS_NAMES[axis], "integer", 32)
+    vcd.declare("lamps", "lamps", "wire", 8)
+    for lamp in LAMP_NAMES:
+        vcd.declare("lamps", lamp, "wire", 1)
+    vcd.declare("commands", "command", "wire", 8)
+    vcd.declare("commands", "cmd", "event", 1)
+    vcd.declare("lcd", "flush_bytes", "wire", 8)
+    vcd.declare("lcd", "flush", "event", 1)
+
+    comments = ["%d records, %d overwritten before them" % (len(events), overwritten)]
+    if names:
+        comments.append("command: " + " ".join("%d=%s" % item for item in sorted(names.items())))
+    vcd.header(comments)
+
+    # Everything is unknown until the trace says otherwise
+    for (scope, name), (ident, kind, width) in vcd.signals.items():
+        if kind != "event":
+            vcd.change(0, scope, name, None)
+
+    start = events[0][0] if events else 0
+    last_step = {}
+    intervals = {}
+    for stamp, kind, value in events:
+        t = (stamp - start) & 0xFFFFFFFF
+        if kind == TRACE_COIL:
+            axis = AXIS_NAMES[value >> 4]
+            pattern = value & 0x0F
+            vcd.change(t, "coils", "coil_" + axis, pattern)
+            if pattern:
+                if axis in last_step:
+                    interval = t - last_step[axis]
+                    vcd.change(t, "coils", "step_us_" + axis, interval)
+                    intervals.setdefault(axis, []).append(interval)
+                last_step[axis] = t
+            else:
+                last_step.pop(axis, None)
+        elif kind == TRACE_LAMPS:
+            vcd.change(t, "lamps", "lamps", value)
+            for bit, lamp in enumerate(LAMP_NAMES):
+                vcd.change(t, "lamps", lamp, (value >> bit) & 1)
+        elif kind == TRACE_COMMAND:
+            vcd.change(t, "commands", "command", value)
+            vcd.change(t, "commands", "cmd", 1)
+        elif kind == TRACE_LCD_FLUSH:
+            vcd.change(t, "lcd", "flush_bytes", value)
+            vcd.change(t, "lcd", "flush", 1)
+    return intervals
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    source = parser.add_mutually_exclusive_group()
+    source.add_argument("--port", help="serial port of the board")
+    source.add_argument("--sim", help="path to the native simulation build")
+    parser.add_argument("-o", "--output", help="VCD file to write (default: stdout)")
+    parser.add_argument("inputs", nargs="*",
+                        help="console log to read (default: stdin), or scenario lines with --sim")
+    args = parser.parse_args()
+
+    try:
+        if args.sim:
+            lines = read_sim(args.sim, args.inputs)
+        elif args.port:
+            lines = read_port(args.port)
+        elif args.inputs and args.inputs[0] != "-":
+            with open(args.inputs[0]) as f:
+                lines = f.read().splitlines()
+        else:
+            lines = sys.stdin.read().splitlines()
+        events, overwritten = parse_dump(lines)
+    except ValueError as error:
+        print("trace2vcd: %s" % error, file=sys.stderr)
+        return 1
+
+    out = open(args.output, "w") if args.output else sys.stdout
+    try:
+        intervals = write_vcd(out, events, overwritten, command_names())
+    finally:
+        if args.output:
+            out.close()
+
+    print("%d records, %d overwritten" % (len(events), overwritten), file=sys.stderr)
+    for axis, values in sorted(intervals.items()):
+        mean = sum(values) / len(values)
+        print("axis %s: %d steps, interval min %d us, mean %.1f us, max %d us" % (
+            axis, len(values) + 1, min(values), mean, max(values)), file=sys.stderr)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,265 @@
+#!/usr/bin/env python3
+"""Checks the pin timing of a simulated run against a golden waveform.
+
+Runs a scenario script through the native simulation build with its edge
+capture on (--edges, see lib/ArduinoSim/src/ArduinoSim.h) and compares every
+output change with a golden file:
+
+    waveform_check.py --record traffic.txt traffic.golden
+    waveform_check.py traffic.txt traffic.golden
+    waveform_check.py --all test/waveforms
+
+--record writes the golden file from the current firmware; without it the
+run is checked and the exit status is 1 on any difference. Per pin, the
+golden and the run must have the same values in the same order, and each
+change must come the same time after the previous change of that pin
+within the pin's tolerance. That is what a phase length or a step period
+is, and a late change does not fail every change after it. The report
+starts with the earliest divergent edge.
+
+--all checks every scenario in a directory that has a golden next to it
+(name.txt and name.golden) and fails if any of them does; with --record
+it records a golden for every scenario there. A scenario can say how it is run in comment
+lines at its top, used by --all and as --record defaults:
+
+    # env: native_shift       build to run, .pio/build/<env>/program
+    # pins: 7,12,13           pins to keep in the golden
+    # tolerance-us: 1000      default tolerance to write
+
+The golden file is the capture plus tolerance lines, which may be edited:
+
+    tolerance * 100        default, in microseconds
+    tolerance 12 1000      for pin 12
+    pins 7 12 13           only these pins are compared
+    65000 12 1             <micros> <pin> <value>
+"""
+
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+
+DEFAULT_BUILD_DIR = os.path.join(".pio", "build")
+DEFAULT_ENV = "native"
+DEFAULT_TOLERANCE_US = 100  # one simulated loop() pass
+SCENARIO_SUFFIX = ".txt"
+GOLDEN_SUFFIX = ".golden"
+
+
+class Waveform:
+    def __init__(self):
+        self.edges = {}  # pin -> [(time, value)]
+        self.tolerances = {"*": DEFAULT_TOLERANCE_US}
+        self.pins = None
+
+    def add(self, time, pin, value):
+        if self.pins is None or pin in self.pins:
+            self.edges.setdefault(pin, []).append((time, value))
+
+    def tolerance(self, pin):
+        return self.tolerances.get(pin, self.tolerances["*"])
+
+    def count(self):
+        return sum(len(edges) for edges in self.edges.values())
+
+
+def parse_waveform(lines, name):
+    waveform = Waveform()
+    for number, line in enumerate(lines, 1):
+        words = line.split("#", 1)[0].split()
+        if not words:
+            continue
+        try:
+            if words[0] == "tolerance" and len(words) == 3:
+                waveform.tolerances[words[1]] = int(words[2])
+            elif words[0] == "pins":
+                waveform.pins = set(words[1:])
+            elif len(words) == 3:
+                waveform.add(int(words[0]), words[1], words[2])
+            else:
+                raise ValueError
+        except ValueError:
+            raise ValueError("%s:%d: cannot parse %r" % (name, number, line.strip()))
+    return waveform
+
+
+def capture(program, scenario, pass_us):
+    with tempfile.TemporaryDirectory() as scratch:
+        path = os.path.join(scratch, "edges")
+        command = [program, "--edges", path]
+        if pass_us is not None:
+            command += ["--pass-us", str(pass_us)]
+        subprocess.run(command + [scenario], stdout=subprocess.DEVNULL, check=True)
+        with open(path) as f:
+            return parse_waveform(f, "capture")
+
+
+def write_golden(out, scenario, waveform, pins, tolerance):
+    out.write("# Golden waveform of %s, written by waveform_check.py --record\n" % os.path.basename(scenario))
+    out.write("tolerance * %d\n" % tolerance)
+    if pins:
+        out.write("pins %s\n" % " ".join(pins))
+    # Sorted on time alone: a pin's edges in one instant (a latch pulse) keep
+    # their order
+    edges = sorted(((time, pin, value) for pin, changes in waveform.edges.items()
+                    for time, value in changes if not pins or pin in pins), key=lambda edge: edge[0])
+    for time, pin, value in edges:
+        out.write("%d %s %s\n" % (time, pin, value))
+    return len(edges)
+
+
+def ms(us):
+    return "%.3f ms" % (us / 1000.0)
+
+
+def compare_pin(pin, expected, actual, tolerance):
+    """Returns (time, description) of the first divergence, or None, and the
+    largest interval error seen before it."""
+    worst = 0
+    previous_expected = previous_actual = 0
+    for index in range(max(len(expected), len(actual))):
+        if index >= len(actual):
+            time, value = expected[index]
+            return (time, "pin %s edge %d: expected %s at %s, the run has no more edges"
+                    % (pin, index + 1, value, ms(time))), worst
+        if index >= len(expected):
+            time, value = actual[index]
+            return (time, "pin %s edge %d: unexpected %s at %s, the golden has no more edges"
+                    % (pin, index + 1, value, ms(time))), worst
+
+        expected_time, expected_value = expected[index]
+        actual_time, actual_value = actual[index]
+        expected_interval = expected_time - previous_expected
+        actual_interval = actual_time - previous_actual
+        error = actual_interval - expected_interval
+        if actual_value != expected_value:
+            return (min(expected_time, actual_time),
+                    "pin %s edge %d: expected %s at %s, got %s at %s"
+                    % (pin, index + 1, expected_value, ms(expected_time), actual_value, ms(actual_time))), worst
+        if abs(error) > tolerance:
+            return (min(expected_time, actual_time),
+                    "pin %s edge %d (%s): %s after the previous edge, expected %s, off by %+d us (tolerance %d us)"
+                    % (pin, index + 1, actual_value, ms(actual_interval), ms(expected_interval), error, tolerance)), worst
+        worst = max(worst, abs(error))
+        previous_expected, previous_actual = expected_time, actual_time
+    return None, worst
+
+
+def check(golden, run):
+    """Returns the divergences sorted by time and the worst in-tolerance error."""
+    divergences = []
+    worst = (0, None)
+    for pin in sorted(set(golden.edges) | set(run.edges)):
+        if golden.pins is not None and pin not in golden.pins:
+            continue
+        divergence, error = compare_pin(pin, golden.edges.get(pin, []), run.edges.get(pin, []),
+                                        golden.tolerance(pin))
+        if divergence:
+            divergences.append(divergence)
+        if error > worst[0]:
+            worst = (error, pin)
+    return sorted(divergences), worst
+
+
+def scenario_options(scenario):
+    """Returns the "# key: value" lines at the top of a scenario script."""
+    options = {}
+    with open(scenario) as f:
+        for line in f:
+            if not line.startswith("#"):
+                break
+            key, colon, value = line[1:].partition(":")
+            if colon:
+                options[key.strip()] = value.strip()
+    return options
+
+
+def record(program, scenario, golden_path, pass_us, pins, tolerance):
+    run = capture(program, scenario, pass_us)
+    with open(golden_path, "w") as out:
+        count = write_golden(out, scenario, run, pins, tolerance)
+    print("%s: recorded %d edges" % (golden_path, count))
+
+
+def verify(program, scenario, golden_path, pass_us):
+    """Prints the result and returns True when the run matches the golden."""
+    run = capture(program, scenario, pass_us)
+    with open(golden_path) as f:
+        golden = parse_waveform(f, golden_path)
+
+    divergences, (worst, worst_pin) = check(golden, run)
+    if divergences:
+        time, first = divergences[0]
+        print("FAIL %s: first divergence at %s" % (scenario, ms(time)))
+        print("  " + first)
+        for time, description in divergences[1:]:
+            print("  then " + description)
+        return False
+
+    print("ok %s: %d edges on %d pins match %s" % (
+        scenario, golden.count(), len(golden.edges), golden_path), end="")
+    print(", largest error %d us on pin %s" % (worst, worst_pin) if worst_pin else "")
+    return True
+
+
+def run_scenario(args, scenario, golden_path):
+    options = scenario_options(scenario)
+    program = args.sim or os.path.join(args.build_dir, options.get("env", DEFAULT_ENV), "program")
+    if args.record:
+        pins = args.pins or options.get("pins")
+        tolerance = args.tolerance_us if args.tolerance_us is not None else int(options.get("tolerance-us", DEFAULT_TOLERANCE_US))
+        record(program, scenario, golden_path, args.pass_us, pins.split(",") if pins else None, tolerance)
+        return True
+    return verify(program, scenario, golden_path, args.pass_us)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--sim", help="simulation build to run, instead of the scenario's env under --build-dir")
+    parser.add_argument("--build-dir", default=DEFAULT_BUILD_DIR,
+                        help="where the env builds are (default: %(default)s)")
+    parser.add_argument("--pass-us", type=int, help="virtual time per loop() pass, passed to the simulator")
+    parser.add_argument("--record", action="store_true", help="write the golden file instead of checking it")
+    parser.add_argument("--pins", help="with --record: comma-separated pins to keep, e.g. 7,12,13")
+    parser.add_argument("--tolerance-us", type=int,
+                        help="with --record: default tolerance to write (default: %d)" % DEFAULT_TOLERANCE_US)
+    parser.add_argument("--all", metavar="DIR", help="run every scenario in DIR that has a golden file")
+    parser.add_argument("scenario", nargs="?", help="simulator script to run")
+    parser.add_argument("golden", nargs="?", help="golden waveform file")
+    args = parser.parse_args()
+
+    if args.all:
+        if args.scenario:
+            parser.error("--all takes no scenario arguments")
+        pairs = []
+        for name in sorted(os.listdir(args.all)):
+            base, suffix = os.path.splitext(name)
+            golden = os.path.join(args.all, base + GOLDEN_SUFFIX)
+            if suffix == SCENARIO_SUFFIX and (args.record or os.path.exists(golden)):
+                pairs.append((os.path.join(args.all, name), golden))
+        if not pairs:
+            print("waveform_check: no scenario with a golden file in %s" % args.all, file=sys.stderr)
+            return 2
+    elif args.golden:
+        pairs = [(args.scenario, args.golden)]
+    else:
+        parser.error("give a scenario and a golden file, or --all DIR")
+
+    failed = 0
+    for scenario, golden in pairs:
+        try:
+            if not run_scenario(args, scenario, golden):
+                failed += 1
+        except (OSError, ValueError, subprocess.CalledProcessError) as error:
+            print("waveform_check: %s" % error, file=sys.stderr)
+            return 2
+
+    if len(pairs) > 1:
+        print("%d of %d scenarios %s" % (len(pairs) - failed, len(pairs),
+                                         "recorded" if args.record else "match"))
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())